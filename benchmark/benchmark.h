@@ -18,7 +18,15 @@
 
 #pragma once
 
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
 #include "../test/test.h"
 
 class XorShift128Plus final {
@@ -39,4 +47,163 @@ public:
 	}
 private:
 	uint64_t _s[2];
-};
\ No newline at end of file
+};
+
+//Gray's zipfian generator, yields 0 to n-1 where 0 is the hottest, theta in (0,1)
+class ZipfGenerator final {
+public:
+	ZipfGenerator(uint64_t n, double theta) : m_n(n), m_theta(theta) {
+		m_alpha = 1.0 / (1.0 - theta);
+		m_zetan = Zeta(n, theta);
+		m_eta = (1.0 - std::pow(2.0/n, 1.0-theta)) / (1.0 - Zeta(2, theta)/m_zetan);
+		m_half_pow_theta = 1.0 + std::pow(0.5, theta);
+	}
+	uint64_t operator()(uint64_t rnd) const noexcept {
+		const double u = (rnd >> 11U) * (1.0 / (1ULL << 53U));
+		const double uz = u * m_zetan;
+		if (uz < 1.0) return 0;
+		if (uz < m_half_pow_theta) return 1;
+		auto r = (uint64_t)(m_n * std::pow(m_eta*u - m_eta + 1.0, m_alpha));
+		return std::min(r, m_n-1);
+	}
+
+private:
+	uint64_t m_n;
+	double m_theta;
+	double m_alpha;
+	double m_zetan;
+	double m_eta;
+	double m_half_pow_theta;
+
+	//sum exactly for head, integrate for tail
+	static double Zeta(uint64_t n, double theta) {
+		constexpr uint64_t head = 1U << 20U;
+		double sum = 0;
+		for (uint64_t i = 1; i <= std::min(n, head); i++) {
+			sum += std::pow((double)i, -theta);
+		}
+		if (n > head) {
+			sum += (std::pow((double)n+0.5, 1.0-theta) - std::pow(head+0.5, 1.0-theta)) / (1.0-theta);
+		}
+		return sum;
+	}
+};
+
+struct LatencySummary {
+	uint64_t p50 = 0;
+	uint64_t p99 = 0;
+	uint64_t p999 = 0;
+	uint64_t max = 0;
+	std::vector<uint64_t> histogram;	//log2 buckets
+};
+
+static inline LatencySummary Summarize(std::vector<uint64_t>& samples) {
+	LatencySummary out;
+	if (samples.empty()) {
+		return out;
+	}
+	std::sort(samples.begin(), samples.end());
+	auto pick = [&samples](double q)->uint64_t {
+		auto idx = (size_t)std::ceil(q * samples.size());
+		return samples[std::min(std::max(idx, (size_t)1U), samples.size()) - 1U];
+	};
+	out.p50 = pick(0.5);
+	out.p99 = pick(0.99);
+	out.p999 = pick(0.999);
+	out.max = samples.back();
+	for (auto x : samples) {
+		unsigned b = x == 0 ? 0 : 64U - __builtin_clzll(x);
+		if (b >= out.histogram.size()) {
+			out.histogram.resize(b+1U);
+		}
+		out.histogram[b]++;
+	}
+	return out;
+}
+
+//key is a 8 byte serial number padded with zero, value has fixed or varied length
+class RecordGenerator : public ssht::IDataReader {
+public:
+	RecordGenerator(uint64_t begin, uint64_t total, unsigned key_len, unsigned val_len,
+					bool varied=false, uint64_t mask=EmbeddingGenerator::MASK0)
+		: m_begin(begin), m_total(total), m_key_len(key_len), m_val_len(val_len),
+		  m_varied(varied), m_mask(mask), m_current(begin),
+		  m_key(std::max(key_len, 8U)), m_val(varied? val_len*2U : val_len) {
+		memset(m_val.data(), 0, m_val.size());
+	}
+	RecordGenerator(const RecordGenerator&) = delete;
+	RecordGenerator& operator=(const RecordGenerator&) = delete;
+
+	void reset() override {
+		m_current = m_begin;
+	}
+	size_t total() override {
+		return m_total;
+	}
+	ssht::Record read(bool key_only) override {
+		auto id = m_current++;
+		*(uint64_t*)m_key.data() = id;
+		ssht::Record out;
+		out.key = {m_key.data(), m_key_len};
+		if (!key_only) {
+			size_t len = m_varied? (id*7U) % m_val.size() + 1U : m_val_len;
+			uint64_t tag = id ^ m_mask;
+			memcpy(m_val.data(), &tag, std::min(len, sizeof(tag)));
+			out.val = {m_val.data(), len};
+		}
+		return out;
+	}
+
+private:
+	const uint64_t m_begin;
+	const uint64_t m_total;
+	const unsigned m_key_len;
+	const unsigned m_val_len;
+	const bool m_varied;
+	const uint64_t m_mask;
+	uint64_t m_current;
+	std::vector<uint8_t> m_key;
+	std::vector<uint8_t> m_val;
+};
+
+static inline std::vector<std::string> SplitList(const std::string& str) {
+	std::vector<std::string> out;
+	size_t pos = 0;
+	while (pos <= str.size()) {
+		auto end = str.find(',', pos);
+		if (end == std::string::npos) end = str.size();
+		if (end > pos) out.push_back(str.substr(pos, end-pos));
+		pos = end + 1;
+	}
+	return out;
+}
+
+//run in child process, so that resource usage is isolated
+template <typename Result, typename Fn>
+static inline bool Isolate(const Fn& fn, Result& res, struct rusage& usage) {
+	static_assert(std::is_trivially_copyable<Result>::value, "");
+	int fds[2];
+	if (pipe(fds) != 0) {
+		return false;
+	}
+	auto pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		Result out = fn();
+		auto ret = write(fds[1], &out, sizeof(out));
+		_exit(ret == sizeof(out) ? 0 : 1);
+	}
+	close(fds[1]);
+	bool ok = read(fds[0], &res, sizeof(res)) == sizeof(res);
+	close(fds[0]);
+	int status = 0;
+	if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		ok = false;
+	}
+	return ok;
+}
@@ -16,6 +16,7 @@
 // along with the This Library; if not, see <https://www.gnu.org/licenses/>.
 //==============================================================================
 
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <algorithm>
@@ -28,11 +29,22 @@
 #include <ssht.h>
 #include <gflags/gflags.h>
 #include "benchmark.h"
+#include "perf.h"
 
 DEFINE_string(file, "bench.ssht", "dict filename");
 DEFINE_uint32(thread, 4, "number of worker threads");
 DEFINE_bool(build, false, "build instead of fetching");
 DEFINE_bool(copy, false, "load by copy");
+DEFINE_string(mode, "fetch", "fetch, batch_search or search");
+DEFINE_string(dist, "uniform", "key distribution: uniform, zipf or hot");
+DEFINE_double(zipf_theta, 0.99, "skew of zipf distribution, in (0,1)");
+DEFINE_double(hot_ratio, 0.01, "fraction of keys in hot set");
+DEFINE_double(hot_share, 0.9, "fraction of lookups on hot set");
+DEFINE_double(miss_ratio, 0, "fraction of lookups on absent keys");
+DEFINE_uint32(batch, 5000, "keys per batch");
+DEFINE_uint32(loop, 1000, "batches per thread");
+DEFINE_string(patch, "", "patch filename");
+DEFINE_string(json, "", "write results to this file in json");
 
 static constexpr size_t BILLION = 1UL << 30U;
 
@@ -65,8 +77,119 @@ static int BenchBuild() {
 	return 0;
 }
 
+enum Mode {MODE_FETCH, MODE_BATCH_SEARCH, MODE_SEARCH};
+enum Dist {DIST_UNIFORM, DIST_ZIPF, DIST_HOT};
+
+class KeyGenerator {
+public:
+	KeyGenerator(Dist dist, const ZipfGenerator* zipf)
+		: m_dist(dist), m_zipf(zipf),
+		  m_hot((uint64_t)(FLAGS_hot_ratio*BILLION)),
+		  m_hot_bar((uint64_t)(FLAGS_hot_share*UINT32_MAX)),
+		  m_miss_bar((uint64_t)(FLAGS_miss_ratio*UINT32_MAX)) {
+		if (m_hot == 0) m_hot = 1;
+	}
+	uint64_t operator()() noexcept {
+		auto r = m_rnd();
+		if ((r & UINT32_MAX) < m_miss_bar) {
+			return BILLION + (m_rnd() % BILLION);
+		}
+		uint64_t rank;
+		switch (m_dist) {
+			case DIST_ZIPF:
+				rank = (*m_zipf)(m_rnd());
+				break;
+			case DIST_HOT:
+				rank = (r >> 32U) < m_hot_bar ? m_rnd() % m_hot : m_rnd() % BILLION;
+				break;
+			default:
+				return m_rnd() % BILLION;
+		}
+		//scatter hot ranks over key space
+		return (rank * 0x9e3779b97f4a7c15ULL) & (BILLION-1);
+	}
+private:
+	XorShift128Plus m_rnd;
+	const Dist m_dist;
+	const ZipfGenerator* m_zipf;
+	uint64_t m_hot;
+	const uint64_t m_hot_bar;
+	const uint64_t m_miss_bar;
+};
+
+struct PerfResult {
+	bool available[PerfCounters::EVENT_CNT] = {};
+	uint64_t value[PerfCounters::EVENT_CNT] = {};
+};
+
+static void WriteJson(const LatencySummary& latency, uint64_t qps, uint64_t ns, const PerfResult& perf, uint64_t ops) {
+	FILE* fp = fopen(FLAGS_json.c_str(), "w");
+	if (fp == nullptr) {
+		std::cout << "fail to write: " << FLAGS_json << std::endl;
+		return;
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"config\": {\"mode\": \"%s\", \"dist\": \"%s\", \"zipf_theta\": %g, "
+				"\"hot_ratio\": %g, \"hot_share\": %g, \"miss_ratio\": %g, \"batch\": %u, "
+				"\"loop\": %u, \"thread\": %u, \"patch\": \"%s\", \"copy\": %s},\n",
+			FLAGS_mode.c_str(), FLAGS_dist.c_str(), FLAGS_zipf_theta, FLAGS_hot_ratio, FLAGS_hot_share,
+			FLAGS_miss_ratio, FLAGS_batch, FLAGS_loop, FLAGS_thread, FLAGS_patch.c_str(), FLAGS_copy? "true" : "false");
+	fprintf(fp, "  \"qps\": %lu,\n  \"ns_per_op\": %lu,\n", qps, ns);
+	fprintf(fp, "  \"batch_ns\": {\"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu},\n",
+			latency.p50, latency.p99, latency.p999, latency.max);
+	fprintf(fp, "  \"histogram\": [");
+	for (unsigned i = 0; i < latency.histogram.size(); i++) {
+		fprintf(fp, "%s{\"below_ns\": %lu, \"count\": %lu}", i==0? "" : ", ", 1UL<<i, latency.histogram[i]);
+	}
+	fprintf(fp, "],\n  \"per_lookup\": {");
+	for (unsigned i = 0; i < PerfCounters::EVENT_CNT; i++) {
+		auto name = PerfCounters::Name((PerfCounters::Event)i);
+		if (perf.available[i]) {
+			fprintf(fp, "%s\"%s\": %.4f", i==0? "" : ", ", name, perf.value[i]/(double)ops);
+		} else {
+			fprintf(fp, "%s\"%s\": null", i==0? "" : ", ", name);
+		}
+	}
+	fprintf(fp, "}\n}\n");
+	fclose(fp);
+}
+
 static int BenchFetch() {
-	ssht::Hashtable dict(FLAGS_file, FLAGS_copy ? ssht::Hashtable::COPY_DATA : ssht::Hashtable::MAP_FETCH);
+	Mode mode;
+	if (FLAGS_mode == "fetch") {
+		mode = MODE_FETCH;
+	} else if (FLAGS_mode == "batch_search") {
+		mode = MODE_BATCH_SEARCH;
+	} else if (FLAGS_mode == "search") {
+		mode = MODE_SEARCH;
+	} else {
+		std::cout << "unknown mode: " << FLAGS_mode << std::endl;
+		return -1;
+	}
+	Dist dist;
+	std::unique_ptr<ZipfGenerator> zipf;
+	if (FLAGS_dist == "uniform") {
+		dist = DIST_UNIFORM;
+	} else if (FLAGS_dist == "zipf") {
+		if (FLAGS_zipf_theta <= 0 || FLAGS_zipf_theta >= 1) {
+			std::cout << "zipf_theta should be in (0,1)" << std::endl;
+			return -1;
+		}
+		dist = DIST_ZIPF;
+		zipf = std::make_unique<ZipfGenerator>(BILLION, FLAGS_zipf_theta);
+	} else if (FLAGS_dist == "hot") {
+		dist = DIST_HOT;
+	} else {
+		std::cout << "unknown distribution: " << FLAGS_dist << std::endl;
+		return -1;
+	}
+	if (FLAGS_batch == 0 || FLAGS_loop == 0) {
+		std::cout << "batch and loop should not be zero" << std::endl;
+		return -1;
+	}
+
+	const auto policy = FLAGS_copy ? ssht::Hashtable::COPY_DATA : ssht::Hashtable::MAP_FETCH;
+	ssht::Hashtable dict(FLAGS_file, policy);
 	if (!dict) {
 		std::cout << "fail to load: " << FLAGS_file << std::endl;
 		return -1;
@@ -75,33 +198,69 @@ static int BenchFetch() {
 		std::cout << "need billion dict" << std::endl;
 		return 1;
 	}
+	std::unique_ptr<ssht::Hashtable> patch;
+	if (!FLAGS_patch.empty()) {
+		patch = std::make_unique<ssht::Hashtable>(FLAGS_patch, policy);
+		if (!*patch) {
+			std::cout << "fail to load: " << FLAGS_patch << std::endl;
+			return -1;
+		}
+	}
 
 	const unsigned n = FLAGS_thread;
-	constexpr unsigned batch = 5000;
-	constexpr unsigned loop = 1000;
+	const unsigned batch = FLAGS_batch;
+	const unsigned loop = FLAGS_loop;
 
 	std::vector<std::thread> workers;
 	workers.reserve(n);
 	std::vector<uint64_t> results(n);
+	std::vector<uint64_t> samples(n*(size_t)loop);
+	std::vector<PerfResult> perf_results(n);
 
 	for (unsigned i = 0; i < n; i++) {
-		workers.emplace_back([&dict](uint64_t* res){
+		workers.emplace_back([&, mode, dist](uint64_t* res, uint64_t* batch_ns, PerfResult* perf_res){
 			std::vector<uint64_t> key_vec(batch);
+			std::vector<const uint8_t*> key_ptr(batch);
+			std::vector<const uint8_t*> val_ptr(batch);
 			auto out = std::make_unique<uint8_t[]>(EmbeddingGenerator::VALUE_SIZE*batch);
+			for (unsigned j = 0; j < batch; j++) {
+				key_ptr[j] = (const uint8_t*)&key_vec[j];
+			}
 
-			XorShift128Plus rnd;
+			KeyGenerator gen(dist, zipf.get());
+			PerfCounters perf;
 			uint64_t sum_ns = 0;
 			for (unsigned i = 0; i < loop; i++) {
 				for (unsigned j = 0; j < batch; j++) {
-					key_vec[j] = rnd()%BILLION;
+					key_vec[j] = gen();
 				}
+				perf.start();
 				auto start = std::chrono::steady_clock::now();
-				dict.batch_fetch(batch, (const uint8_t*)key_vec.data(), out.get());
+				switch (mode) {
+					case MODE_FETCH:
+						dict.batch_fetch(batch, (const uint8_t*)key_vec.data(), out.get(), nullptr, patch.get());
+						break;
+					case MODE_BATCH_SEARCH:
+						dict.batch_search(batch, key_ptr.data(), val_ptr.data(), patch.get());
+						break;
+					case MODE_SEARCH:
+						for (unsigned j = 0; j < batch; j++) {
+							val_ptr[j] = dict.search(key_ptr[j]).ptr;
+						}
+						break;
+				}
 				auto end = std::chrono::steady_clock::now();
-				sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+				perf.stop();
+				auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+				batch_ns[i] = ns;
+				sum_ns += ns;
 			}
 			*res = sum_ns;
-		}, &results[i]);
+			for (unsigned j = 0; j < PerfCounters::EVENT_CNT; j++) {
+				perf_res->available[j] = perf.available((PerfCounters::Event)j);
+				perf_res->value[j] = perf.value((PerfCounters::Event)j);
+			}
+		}, &results[i], &samples[i*(size_t)loop], &perf_results[i]);
 	}
 	for (auto& t : workers) {
 		t.join();
@@ -110,13 +269,41 @@ static int BenchFetch() {
 	uint64_t qps = 0;
 	uint64_t ns = 0;
 	for (auto x : results) {
-		qps += (loop*batch)*1000000000ULL/x;
+		qps += (loop*(uint64_t)batch)*1000000000ULL/x;
 		ns += x;
 	}
 	ns /= n*(uint64_t)loop*(uint64_t)batch;
 
 	std::cout << (qps/1000000U) << " mqps with " << n << " threads" << std::endl;
 	std::cout << ns << " ns/op" << std::endl;
+
+	auto latency = Summarize(samples);
+	std::cout << "batch latency: p50 " << latency.p50 << " ns, p99 " << latency.p99
+		<< " ns, p999 " << latency.p999 << " ns, max " << latency.max << " ns" << std::endl;
+	for (unsigned i = 0; i < latency.histogram.size(); i++) {
+		if (latency.histogram[i] != 0) {
+			std::cout << "  < " << (1UL<<i) << " ns: " << latency.histogram[i] << std::endl;
+		}
+	}
+
+	PerfResult perf;
+	const uint64_t ops = n*(uint64_t)loop*(uint64_t)batch;
+	for (unsigned j = 0; j < PerfCounters::EVENT_CNT; j++) {
+		perf.available[j] = true;
+		for (auto& part : perf_results) {
+			perf.available[j] &= part.available[j];
+			perf.value[j] += part.value[j];
+		}
+		std::cout << PerfCounters::Name((PerfCounters::Event)j) << "/op: ";
+		if (perf.available[j]) {
+			std::cout << perf.value[j]/(double)ops << std::endl;
+		} else {
+			std::cout << "n/a" << std::endl;
+		}
+	}
+	if (!FLAGS_json.empty()) {
+		WriteJson(latency, qps, ns, perf, ops);
+	}
 	return 0;
 }
 
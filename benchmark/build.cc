@@ -0,0 +1,280 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <unistd.h>
+#include <ssht.h>
+#include <gflags/gflags.h>
+#include "benchmark.h"
+
+DEFINE_string(threads, "1,2,4,8", "numbers of readers, one thread per reader");
+DEFINE_string(items, "10000000", "numbers of items");
+DEFINE_string(key_len, "8", "key sizes, no less than 8");
+DEFINE_string(val_len, "32", "value sizes, average is half for varied dict");
+DEFINE_string(types, "set,dict,varied,derive", "set, dict, varied or derive");
+DEFINE_string(delta, "0.01,0.1", "ratios of delta items to base for derive");
+DEFINE_string(output, "", "write table to this file instead of counting bytes only");
+DEFINE_string(json, "", "write results to this file in json");
+DEFINE_string(placement, "local", "local, interleave or partition placement of table pages");
+DEFINE_bool(slot_order, false, "store values of varied dict in slot order");
+
+static const char* BASE_FILE = "bench-build-base.ssht";
+
+class CountingWriter : public ssht::IDataWriter {
+public:
+	CountingWriter() {
+		if (!FLAGS_output.empty()) {
+			m_file = std::make_unique<ssht::FileWriter>(FLAGS_output.c_str());
+		}
+	}
+	bool operator!() const noexcept override {
+		return m_file != nullptr && !*m_file;
+	}
+	bool flush() noexcept override {
+		return m_file == nullptr || m_file->flush();
+	}
+	bool write(const void* data, size_t n) noexcept override {
+		auto start = std::chrono::steady_clock::now();
+		m_bytes += n;
+		bool ok = m_file == nullptr || m_file->write(data, n);
+		m_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return ok;
+	}
+	uint64_t bytes() const noexcept { return m_bytes; }
+	uint64_t ns() const noexcept { return m_ns; }
+private:
+	std::unique_ptr<ssht::FileWriter> m_file;
+	uint64_t m_bytes = 0;
+	uint64_t m_ns = 0;
+};
+
+struct Config {
+	std::string type;
+	unsigned thread;
+	uint64_t item;
+	unsigned key_len;
+	unsigned val_len;
+	double delta;
+};
+
+struct Result {
+	int status = -1;
+	uint64_t ns = 0;
+	uint64_t bytes = 0;
+	uint64_t write_ns = 0;
+	uint64_t peak_rss = 0;	//KB
+};
+
+static ssht::DataReaders CreateReaders(const Config& cfg, uint64_t begin, uint64_t total, uint64_t mask) {
+	ssht::DataReaders out;
+	const auto piece = total / cfg.thread;
+	const auto remain = total % cfg.thread;
+	for (unsigned i = 0; i < cfg.thread; i++) {
+		auto sz = i<remain? piece+1 : piece;
+		out.push_back(std::make_unique<RecordGenerator>(begin, sz, cfg.key_len, cfg.val_len,
+														cfg.type == "varied" || cfg.type == "derive", mask));
+		begin += sz;
+	}
+	return out;
+}
+
+static int BuildBase(const Config& cfg) {
+	ssht::FileWriter output(BASE_FILE);
+	auto input = CreateReaders(cfg, 0, cfg.item, EmbeddingGenerator::MASK1);
+	return ssht::BuildDictWithVariedValue(input, output);
+}
+
+static ssht::BuildOptions Options() {
+	ssht::BuildOptions options;
+	if (FLAGS_placement == "interleave") {
+		options.placement = ssht::BuildOptions::PLACE_INTERLEAVE;
+	} else if (FLAGS_placement == "partition") {
+		options.placement = ssht::BuildOptions::PLACE_PARTITION;
+	}
+	options.slot_order = FLAGS_slot_order;
+	return options;
+}
+
+static Result RunOne(const Config& cfg) {
+	Result res;
+	std::unique_ptr<ssht::Hashtable> base;
+	ssht::DataReaders input;
+	if (cfg.type == "derive") {
+		base = std::make_unique<ssht::Hashtable>(BASE_FILE, ssht::Hashtable::MAP_FETCH);
+		if (!*base) {
+			return res;
+		}
+		//half of delta updates old items, the other half is new
+		const uint64_t delta = cfg.item * cfg.delta;
+		input = CreateReaders(cfg, cfg.item - delta/2, delta, EmbeddingGenerator::MASK0);
+	} else {
+		input = CreateReaders(cfg, 0, cfg.item, EmbeddingGenerator::MASK0);
+	}
+	CountingWriter output;
+	if (!output) {
+		return res;
+	}
+	auto start = std::chrono::steady_clock::now();
+	ssht::BuildStatus status;
+	if (cfg.type == "set") {
+		status = ssht::BuildSet(input, output, Options());
+	} else if (cfg.type == "dict") {
+		status = ssht::BuildDict(input, output, Options());
+	} else if (cfg.type == "varied") {
+		status = ssht::BuildDictWithVariedValue(input, output, Options());
+	} else {
+		status = base->derive(input, output, Options());
+	}
+	if (status == ssht::BUILD_STATUS_OK && !output.flush()) {
+		status = ssht::BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
+	res.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	res.status = status;
+	res.bytes = output.bytes();
+	res.write_ns = output.ns();
+	return res;
+}
+
+static Result RunIsolated(const std::function<Result()>& fn) {
+	Result res;
+	struct rusage usage;
+	if (!Isolate(fn, res, usage)) {
+		res.status = -1;
+		return res;
+	}
+	res.peak_rss = usage.ru_maxrss;
+	return res;
+}
+
+static std::vector<uint64_t> ParseNumbers(const std::string& str) {
+	std::vector<uint64_t> out;
+	for (auto& s : SplitList(str)) {
+		out.push_back(strtoull(s.c_str(), nullptr, 10));
+	}
+	return out;
+}
+
+int main(int argc, char* argv[]) {
+	google::ParseCommandLineFlags(&argc, &argv, true);
+
+	if (FLAGS_placement != "local" && FLAGS_placement != "interleave" && FLAGS_placement != "partition") {
+		std::cout << "unknown placement: " << FLAGS_placement << std::endl;
+		return -1;
+	}
+	std::vector<double> deltas;
+	for (auto& s : SplitList(FLAGS_delta)) {
+		deltas.push_back(strtod(s.c_str(), nullptr));
+	}
+	std::vector<Config> configs;
+	for (auto& type : SplitList(FLAGS_types)) {
+		if (type != "set" && type != "dict" && type != "varied" && type != "derive") {
+			std::cout << "unknown type: " << type << std::endl;
+			return -1;
+		}
+		for (auto item : ParseNumbers(FLAGS_items)) {
+			for (auto key_len : ParseNumbers(FLAGS_key_len)) {
+				if (key_len < 8 || key_len > ssht::MAX_KEY_LEN) {
+					std::cout << "illegal key size: " << key_len << std::endl;
+					return -1;
+				}
+				for (auto val_len : ParseNumbers(FLAGS_val_len)) {
+					if ((type != "set" && val_len == 0) || val_len > ssht::MAX_INLINE_VALUE_LEN) {
+						std::cout << "illegal value size: " << val_len << std::endl;
+						return -1;
+					}
+					for (auto thread : ParseNumbers(FLAGS_threads)) {
+						if (thread == 0) continue;
+						Config cfg = {type, (unsigned)thread, item, (unsigned)key_len, (unsigned)val_len, 0};
+						if (type != "derive") {
+							configs.push_back(cfg);
+							continue;
+						}
+						for (auto delta : deltas) {
+							cfg.delta = delta;
+							configs.push_back(cfg);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	FILE* json = nullptr;
+	if (!FLAGS_json.empty()) {
+		json = fopen(FLAGS_json.c_str(), "w");
+		if (json == nullptr) {
+			std::cout << "fail to write: " << FLAGS_json << std::endl;
+			return -1;
+		}
+		fprintf(json, "[");
+	}
+
+	printf("%-7s %7s %11s %4s %6s %6s %12s %10s %10s %8s\n", "type", "thread", "item", "key", "value",
+		   "delta", "item/s", "rss(MB)", "out(MB/s)", "write%");
+	const Config* last_base = nullptr;
+	bool first = true;
+	for (auto& cfg : configs) {
+		if (cfg.type == "derive" && (last_base == nullptr || last_base->item != cfg.item
+			|| last_base->key_len != cfg.key_len || last_base->val_len != cfg.val_len)) {
+			auto ret = RunIsolated([&cfg]()->Result {
+				Result res;
+				res.status = BuildBase(cfg);
+				return res;
+			});
+			if (ret.status != ssht::BUILD_STATUS_OK) {
+				std::cout << "fail to build base: " << ret.status << std::endl;
+				return 1;
+			}
+			last_base = &cfg;
+		}
+		auto res = RunIsolated([&cfg]() { return RunOne(cfg); });
+		if (res.status != ssht::BUILD_STATUS_OK) {
+			std::cout << "fail to build " << cfg.type << ": " << res.status << std::endl;
+			return 1;
+		}
+		const double sec = res.ns / 1e9;
+		//items in output table
+		const uint64_t item = cfg.type == "derive"? cfg.item + (uint64_t)(cfg.item*cfg.delta)/2U : cfg.item;
+		const double item_rate = item / sec;
+		const double out_rate = res.bytes / sec / (1U<<20U);
+		const double write_pct = res.write_ns * 100.0 / res.ns;
+		printf("%-7s %7u %11lu %4u %6u %6.3f %12.0f %10.1f %10.1f %8.1f\n", cfg.type.c_str(), cfg.thread,
+			   cfg.item, cfg.key_len, cfg.val_len, cfg.delta, item_rate, res.peak_rss/1024.0, out_rate, write_pct);
+		if (json != nullptr) {
+			fprintf(json, "%s\n  {\"type\": \"%s\", \"thread\": %u, \"item\": %lu, \"key_len\": %u, "
+						  "\"val_len\": %u, \"delta\": %g, \"ns\": %lu, \"item_per_sec\": %.0f, "
+						  "\"peak_rss_kb\": %lu, \"output_bytes\": %lu, \"write_ns\": %lu}",
+					first? "" : ",", cfg.type.c_str(), cfg.thread, cfg.item, cfg.key_len, cfg.val_len,
+					cfg.delta, res.ns, item_rate, res.peak_rss, res.bytes, res.write_ns);
+			first = false;
+		}
+	}
+	if (json != nullptr) {
+		fprintf(json, "\n]\n");
+		fclose(json);
+	}
+	unlink(BASE_FILE);
+	return 0;
+}
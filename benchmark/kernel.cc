@@ -0,0 +1,214 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+#include "../src/internal.h"
+#include "benchmark.h"
+#include "perf.h"
+
+//results go to kernel.json unless --benchmark_out is given
+
+static constexpr unsigned KEY_POOL = 1U << 16U;
+
+static std::vector<uint64_t> RandomKeys(uint64_t range) {
+	XorShift128Plus rnd;
+	std::vector<uint64_t> keys(KEY_POOL);
+	for (auto& key : keys) {
+		key = rnd() % range;
+	}
+	return keys;
+}
+
+static void BM_Hash(benchmark::State& state) {
+	const uint8_t len = state.range(0);
+	auto keys = RandomKeys(UINT64_MAX);
+	uint8_t buf[256] = {};
+	unsigned i = 0;
+	for (auto _ : state) {
+		*(uint64_t*)buf = keys[i++ & (KEY_POOL-1)];
+		benchmark::DoNotOptimize(ssht::Hash(buf, len, 0));
+	}
+	state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_Hash)->Arg(4)->Arg(8)->Arg(12)->Arg(16)->Arg(24)->Arg(32)->Arg(64)->Arg(255);
+
+static void BM_CalcHint(benchmark::State& state) {
+	auto vec = RandomKeys(UINT64_MAX);
+	unsigned i = 0;
+	for (auto _ : state) {
+		auto v = vec[i++ & (KEY_POOL-1)];
+		benchmark::DoNotOptimize(ssht::CalcHint(v, v >> 57U));
+	}
+}
+BENCHMARK(BM_CalcHint);
+
+static void BM_DivisorMod(benchmark::State& state) {
+	const ssht::Divisor<uint64_t> d(1000000007ULL);
+	auto vec = RandomKeys(UINT64_MAX);
+	unsigned i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(vec[i++ & (KEY_POOL-1)] % d);
+	}
+}
+BENCHMARK(BM_DivisorMod);
+
+static void BM_HardwareMod(benchmark::State& state) {
+	uint64_t d = 1000000007ULL;
+	benchmark::DoNotOptimize(d);
+	auto vec = RandomKeys(UINT64_MAX);
+	unsigned i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(vec[i++ & (KEY_POOL-1)] % d);
+	}
+}
+BENCHMARK(BM_HardwareMod);
+
+static void BM_SeparatedValue(benchmark::State& state) {
+	const size_t len = state.range(0);
+	std::vector<uint8_t> buf;
+	auto n = len;
+	while ((n & ~0x7fULL) != 0) {
+		buf.push_back(0x80U | (n & 0x7fU));
+		n >>= 7U;
+	}
+	buf.push_back(n);
+	buf.resize(buf.size()+len);
+	auto end = buf.data() + buf.size();
+	for (auto _ : state) {
+		auto pt = buf.data();
+		benchmark::DoNotOptimize(pt);
+		benchmark::DoNotOptimize(ssht::SeparatedValue(pt, end));
+	}
+}
+BENCHMARK(BM_SeparatedValue)->Arg(8)->Arg(200)->Arg(20000)->Arg(2000000);
+
+//table files are built once and cached in working directory
+static const ssht::Hashtable& GetTable(unsigned item, bool patch=false) {
+	static std::map<std::pair<unsigned,bool>, std::unique_ptr<ssht::Hashtable>> tables;
+	auto& table = tables[{item, patch}];
+	if (table == nullptr) {
+		const std::string filename = "kernel-" + std::to_string(item) + (patch? "-patch.ssht" : ".ssht");
+		ssht::DataReaders input;
+		if (patch) {
+			//patch covers a quarter of keys
+			input.push_back(std::make_unique<EmbeddingGenerator>(0, item/4U, EmbeddingGenerator::MASK1));
+		} else {
+			input.push_back(std::make_unique<EmbeddingGenerator>(0, item));
+		}
+		if (access(filename.c_str(), F_OK) != 0
+			|| ssht::Hashtable(filename).item() != input.front()->total()) {
+			ssht::FileWriter output(filename.c_str());
+			if (!output || ssht::BuildDict(input, output) != ssht::BUILD_STATUS_OK) {
+				abort();
+			}
+		}
+		table = std::make_unique<ssht::Hashtable>(filename, ssht::Hashtable::COPY_DATA);
+		if (!*table) {
+			abort();
+		}
+	}
+	return *table;
+}
+
+//about 41 bytes per item: L1, L2, LLC, DRAM
+#define TABLE_SIZES ->Arg(1U<<9U)->Arg(1U<<14U)->Arg(1U<<19U)->Arg(1U<<24U)
+
+//hardware events per item, skip unavailable ones
+static void ReportPerf(benchmark::State& state, const PerfCounters& perf, uint64_t items) {
+	for (unsigned i = 0; i < PerfCounters::EVENT_CNT; i++) {
+		auto event = (PerfCounters::Event)i;
+		if (perf.available(event) && items != 0) {
+			state.counters[PerfCounters::Name(event)] = perf.value(event) / (double)items;
+		}
+	}
+}
+
+static void BM_Search(benchmark::State& state) {
+	auto& table = GetTable(state.range(0));
+	auto keys = RandomKeys(state.range(0));
+	PerfCounters perf;
+	unsigned i = 0;
+	perf.start();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(table.search((const uint8_t*)&keys[i++ & (KEY_POOL-1)]));
+	}
+	perf.stop();
+	state.SetItemsProcessed(state.iterations());
+	ReportPerf(state, perf, state.iterations());
+}
+BENCHMARK(BM_Search) TABLE_SIZES;
+
+static void BatchFetch(benchmark::State& state, bool with_patch) {
+	constexpr unsigned batch = 1000;
+	auto& table = GetTable(state.range(0));
+	auto patch = with_patch? &GetTable(state.range(0), true) : nullptr;
+	auto keys = RandomKeys(state.range(0));
+	auto out = std::make_unique<uint8_t[]>(EmbeddingGenerator::VALUE_SIZE*batch);
+	PerfCounters perf;
+	unsigned i = 0;
+	perf.start();
+	for (auto _ : state) {
+		auto in = (const uint8_t*)&keys[i];
+		i = (i + batch) % (KEY_POOL - batch);
+		benchmark::DoNotOptimize(table.batch_fetch(batch, in, out.get(), nullptr, patch));
+	}
+	perf.stop();
+	state.SetItemsProcessed(state.iterations() * batch);
+	ReportPerf(state, perf, state.iterations() * batch);
+}
+
+static void BM_BatchFetch(benchmark::State& state) {
+	BatchFetch(state, false);
+}
+BENCHMARK(BM_BatchFetch) TABLE_SIZES;
+
+static void BM_BatchFetchWithPatch(benchmark::State& state) {
+	BatchFetch(state, true);
+}
+BENCHMARK(BM_BatchFetchWithPatch) TABLE_SIZES;
+
+
+int main(int argc, char* argv[]) {
+	std::vector<char*> args(argv, argv+argc);
+	bool has_out = false;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--benchmark_out=", 16) == 0) {
+			has_out = true;
+		}
+	}
+	char out_file[] = "--benchmark_out=kernel.json";
+	char out_format[] = "--benchmark_out_format=json";
+	if (!has_out) {
+		args.push_back(out_file);
+		args.push_back(out_format);
+	}
+	int n = args.size();
+	benchmark::Initialize(&n, args.data());
+	if (benchmark::ReportUnrecognizedArguments(n, args.data())) {
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
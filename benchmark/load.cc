@@ -0,0 +1,272 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sysinfo.h>
+#include <ssht.h>
+#include <gflags/gflags.h>
+#include "benchmark.h"
+
+DEFINE_string(file, "bench-load.ssht", "dict filename, keys should be 0 to item-1");
+DEFINE_uint64(item, 10000000, "item of dict to build when file is missing");
+DEFINE_string(policies, "map_only,map_fetch,map_occupy,copy_data,tiered", "load policies to test");
+DEFINE_uint32(thread, 4, "number of worker threads for steady qps");
+DEFINE_uint32(batch, 1000, "keys per batch");
+DEFINE_uint32(warmup, 2000, "batches to watch after load");
+DEFINE_uint32(loop, 1000, "batches per thread for steady qps");
+DEFINE_string(json, "", "write results to this file in json");
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t Since(Clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+static const struct {
+	const char* name;
+	ssht::Hashtable::LoadPolicy policy;
+} POLICIES[] = {
+	{"map_only", ssht::Hashtable::MAP_ONLY},
+	{"map_fetch", ssht::Hashtable::MAP_FETCH},
+	{"map_occupy", ssht::Hashtable::MAP_OCCUPY},
+	{"copy_data", ssht::Hashtable::COPY_DATA},
+	{"tiered", ssht::Hashtable::TIERED},
+};
+
+struct Result {
+	uint64_t open_ns = 0;
+	uint64_t first_ns = 0;		//latency of first batch
+	uint64_t settle_ns = 0;		//time from load till batch latency settles
+	uint64_t steady_ns = 0;		//median batch latency after settling
+	uint64_t rss = 0;			//bytes
+	uint64_t minor_fault = 0;
+	uint64_t major_fault = 0;
+	uint64_t qps = 0;
+};
+
+static bool DropCache() {
+	if (geteuid() == 0) {
+		sync();
+		int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+		if (fd >= 0) {
+			bool ok = write(fd, "3", 1) == 1;
+			close(fd);
+			if (ok) return true;
+		}
+	}
+	//unprivileged or in container, evict clean pages of the file only
+	int fd = open(FLAGS_file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	close(fd);
+	return ok;
+}
+
+static uint64_t ResidentSize() {
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if (fp == nullptr) {
+		return 0;
+	}
+	unsigned long size = 0, resident = 0;
+	if (fscanf(fp, "%lu %lu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(fp);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+class Worker {
+public:
+	//tiered table only supports batch_fetch
+	Worker(const ssht::Hashtable& dict, bool fetch)
+		: m_dict(dict), m_fetch(fetch), m_keys(FLAGS_batch), m_ptrs(FLAGS_batch), m_vals(FLAGS_batch),
+		  m_data(fetch? FLAGS_batch*(size_t)dict.val_len() : 0) {
+		for (unsigned i = 0; i < FLAGS_batch; i++) {
+			m_ptrs[i] = (const uint8_t*)&m_keys[i];
+		}
+	}
+	uint64_t run() {
+		for (auto& key : m_keys) {
+			key = m_rnd() % m_dict.item();
+		}
+		auto start = Clock::now();
+		if (m_fetch) {
+			m_dict.batch_fetch(FLAGS_batch, (const uint8_t*)m_keys.data(), m_data.data());
+		} else if (m_dict.type() == ssht::Hashtable::KV_SEPARATED) {
+			for (unsigned i = 0; i < FLAGS_batch; i++) {
+				m_vals[i] = m_dict.search(m_ptrs[i]).ptr;
+			}
+		} else {
+			m_dict.batch_search(FLAGS_batch, m_ptrs.data(), m_vals.data());
+		}
+		return Since(start);
+	}
+private:
+	const ssht::Hashtable& m_dict;
+	const bool m_fetch;
+	XorShift128Plus m_rnd;
+	std::vector<uint64_t> m_keys;
+	std::vector<const uint8_t*> m_ptrs;
+	std::vector<const uint8_t*> m_vals;
+	std::vector<uint8_t> m_data;
+};
+
+static Result Measure(ssht::Hashtable::LoadPolicy policy) {
+	Result res;
+	struct rusage usage0, usage1;
+	getrusage(RUSAGE_SELF, &usage0);
+	auto start = Clock::now();
+	ssht::Hashtable dict(FLAGS_file, policy);
+	res.open_ns = Since(start);
+	if (!dict || dict.item() == 0 || dict.key_len() != sizeof(uint64_t)) {
+		res.open_ns = 0;
+		return res;
+	}
+
+	const bool fetch = policy == ssht::Hashtable::TIERED;
+	Worker worker(dict, fetch);
+	std::vector<uint64_t> latency(FLAGS_warmup);
+	std::vector<uint64_t> elapse(FLAGS_warmup);
+	for (unsigned i = 0; i < FLAGS_warmup; i++) {
+		latency[i] = worker.run();
+		elapse[i] = Since(start);
+	}
+	getrusage(RUSAGE_SELF, &usage1);
+	res.first_ns = latency.front();
+	res.rss = ResidentSize();
+	res.minor_fault = usage1.ru_minflt - usage0.ru_minflt;
+	res.major_fault = usage1.ru_majflt - usage0.ru_majflt;
+
+	//settled when 8 batches in a row are close to median of the last quarter
+	std::vector<uint64_t> tail(latency.end()-latency.size()/4, latency.end());
+	res.steady_ns = Summarize(tail).p50;
+	constexpr unsigned WINDOW = 8;
+	unsigned run = 0;
+	res.settle_ns = elapse.back();
+	for (unsigned i = 0; i < latency.size(); i++) {
+		if (latency[i] * 2 > res.steady_ns * 3) {
+			run = 0;
+		} else if (++run == WINDOW) {
+			res.settle_ns = elapse[i+1-WINDOW] - latency[i+1-WINDOW];
+			break;
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<uint64_t> cost(FLAGS_thread);
+	for (unsigned i = 0; i < FLAGS_thread; i++) {
+		threads.emplace_back([&dict, fetch](uint64_t* ns) {
+			Worker worker(dict, fetch);
+			for (unsigned j = 0; j < FLAGS_loop; j++) {
+				*ns += worker.run();
+			}
+		}, &cost[i]);
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	for (auto ns : cost) {
+		res.qps += FLAGS_loop*(uint64_t)FLAGS_batch*1000000000ULL/std::max(ns, (uint64_t)1U);
+	}
+	return res;
+}
+
+static bool PrepareFile() {
+	if (access(FLAGS_file.c_str(), F_OK) == 0) {
+		return true;
+	}
+	ssht::FileWriter output(FLAGS_file.c_str());
+	ssht::DataReaders input;
+	input.push_back(std::make_unique<EmbeddingGenerator>(0, FLAGS_item));
+	return ssht::BuildDict(input, output) == ssht::BUILD_STATUS_OK && output.flush();
+}
+
+int main(int argc, char* argv[]) {
+	google::ParseCommandLineFlags(&argc, &argv, true);
+
+	auto cpus = get_nprocs();
+	if (cpus <= 0) cpus = 1;
+	if (FLAGS_thread == 0 || FLAGS_thread > (unsigned)cpus) {
+		FLAGS_thread = cpus;
+	}
+	if (FLAGS_batch == 0 || FLAGS_warmup < 16 || FLAGS_loop == 0) {
+		std::cout << "batch and loop should not be zero, warmup should be at least 16" << std::endl;
+		return -1;
+	}
+	if (!PrepareFile()) {
+		std::cout << "fail to prepare: " << FLAGS_file << std::endl;
+		return -1;
+	}
+
+	FILE* json = nullptr;
+	if (!FLAGS_json.empty()) {
+		json = fopen(FLAGS_json.c_str(), "w");
+		if (json == nullptr) {
+			std::cout << "fail to write: " << FLAGS_json << std::endl;
+			return -1;
+		}
+		fprintf(json, "[");
+	}
+	printf("%-10s %10s %10s %10s %10s %10s %10s %10s %8s\n", "policy", "open(ms)", "first(us)", "settle(ms)",
+		   "steady(us)", "rss(MB)", "minflt", "majflt", "mqps");
+	bool first = true;
+	for (auto& name : SplitList(FLAGS_policies)) {
+		auto it = std::find_if(std::begin(POLICIES), std::end(POLICIES),
+							   [&name](auto& p) { return name == p.name; });
+		if (it == std::end(POLICIES)) {
+			std::cout << "unknown policy: " << name << std::endl;
+			return -1;
+		}
+		if (!DropCache()) {
+			std::cout << "fail to drop page cache" << std::endl;
+		}
+		Result res;
+		struct rusage usage;
+		auto policy = it->policy;
+		if (!Isolate([policy]() { return Measure(policy); }, res, usage) || res.open_ns == 0) {
+			std::cout << "fail to test " << name << std::endl;
+			return 1;
+		}
+		printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %10lu %10lu %8.1f\n", name.c_str(), res.open_ns/1e6,
+			   res.first_ns/1e3, res.settle_ns/1e6, res.steady_ns/1e3, res.rss/1048576.0,
+			   res.minor_fault, res.major_fault, res.qps/1e6);
+		if (json != nullptr) {
+			fprintf(json, "%s\n  {\"policy\": \"%s\", \"open_ns\": %lu, \"first_batch_ns\": %lu, "
+						  "\"settle_ns\": %lu, \"steady_batch_ns\": %lu, \"rss\": %lu, \"minor_fault\": %lu, "
+						  "\"major_fault\": %lu, \"qps\": %lu}", first? "" : ",", name.c_str(), res.open_ns,
+					res.first_ns, res.settle_ns, res.steady_ns, res.rss, res.minor_fault, res.major_fault, res.qps);
+			first = false;
+		}
+	}
+	if (json != nullptr) {
+		fprintf(json, "\n]\n");
+		fclose(json);
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+//hardware counters of calling thread, unavailable ones (e.g. in container) just read as zero
+class PerfCounters final {
+public:
+	enum Event {INSTRUCTION, LLC_MISS, DTLB_MISS, BRANCH_MISS, EVENT_CNT};
+
+	PerfCounters() noexcept {
+		static constexpr auto cache_miss = [](uint64_t cache) {
+			return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8U) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16U);
+		};
+		const struct {
+			uint32_t type;
+			uint64_t config;
+		} events[EVENT_CNT] = {
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+			{PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB)},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		};
+		for (unsigned i = 0; i < EVENT_CNT; i++) {
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[i].type;
+			attr.config = events[i].config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			m_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+	}
+	~PerfCounters() noexcept {
+		for (auto fd : m_fds) {
+			if (fd >= 0) close(fd);
+		}
+	}
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool available(Event event) const noexcept {
+		return m_fds[event] >= 0;
+	}
+	bool any_available() const noexcept {
+		for (auto fd : m_fds) {
+			if (fd >= 0) return true;
+		}
+		return false;
+	}
+	void start() noexcept {
+		for (auto fd : m_fds) {
+			if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	void stop() noexcept {
+		for (auto fd : m_fds) {
+			if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	//accumulated value, scaled when counters are multiplexed
+	uint64_t value(Event event) const noexcept {
+		if (m_fds[event] < 0) {
+			return 0;
+		}
+		uint64_t buf[3];
+		if (read(m_fds[event], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0) {
+			return 0;
+		}
+		if (buf[2] == buf[1]) {
+			return buf[0];
+		}
+		return (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+	}
+
+	static const char* Name(Event event) noexcept {
+		static const char* names[EVENT_CNT] = {"instruction", "llc_miss", "dtlb_miss", "branch_miss"};
+		return names[event];
+	}
+
+private:
+	int m_fds[EVENT_CNT];
+};
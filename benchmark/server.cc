@@ -0,0 +1,216 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstdio>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <gflags/gflags.h>
+#include "../tool/protocol.h"
+#include "../tool/shm.h"
+#include "benchmark.h"
+
+DEFINE_string(address, "ssht.sock", "unix socket path, or host:port for tcp");
+DEFINE_string(shm, "", "talk through this shared memory instead of socket");
+DEFINE_uint32(connection, 4, "number of connections, one thread each");
+DEFINE_uint32(table, 0, "table id");
+DEFINE_string(op, "fetch", "fetch or search");
+DEFINE_uint32(batch, 1000, "keys per request");
+DEFINE_uint32(loop, 10000, "requests per connection");
+DEFINE_uint32(pipeline, 1, "requests sent in one write before reading replies, keep it small for socket buffers");
+DEFINE_string(json, "", "write results to this file in json");
+
+using namespace ssht::proto;
+
+struct Client {
+	uint64_t ns = 0;
+	uint64_t hit = 0;
+	bool ok = false;
+};
+
+static bool Call(int fd, RequestHeader& req, const void* keys, size_t key_size,
+				 ResponseHeader& rsp, std::vector<uint8_t>& payload) {
+	if (!SendAll(fd, &req, sizeof(req)) || (key_size != 0 && !SendAll(fd, keys, key_size))
+		|| !RecvAll(fd, &rsp, sizeof(rsp)) || rsp.magic != RESPONSE_MAGIC || rsp.id != req.id) {
+		return false;
+	}
+	payload.resize(rsp.size);
+	return RecvAll(fd, payload.data(), rsp.size);
+}
+
+static void Run(Client* client, uint64_t* batch_ns, Op op) {
+	int fd = Connect(FLAGS_address);
+	if (fd < 0) {
+		return;
+	}
+	RequestHeader req;
+	ResponseHeader rsp;
+	std::vector<uint8_t> payload;
+	req.op = OP_INFO;
+	req.table = FLAGS_table;
+	if (!Call(fd, req, nullptr, 0, rsp, payload) || rsp.status != STATUS_OK || rsp.size != sizeof(TableInfo)) {
+		close(fd);
+		return;
+	}
+	TableInfo info;
+	memcpy(&info, payload.data(), sizeof(info));
+	if (info.key_len != sizeof(uint64_t) || info.item == 0) {
+		close(fd);
+		return;
+	}
+
+	//a window of requests with keys is sent in one piece, latency is counted from the write
+	const size_t stride = FLAGS_batch + sizeof(RequestHeader)/sizeof(uint64_t);
+	std::vector<uint64_t> buf(stride * FLAGS_pipeline);
+	XorShift128Plus rnd;
+	req.op = op;
+	req.batch = FLAGS_batch;
+	for (unsigned i = 0; i < FLAGS_loop; ) {
+		const unsigned window = std::min(FLAGS_pipeline, FLAGS_loop - i);
+		for (unsigned k = 0; k < window; k++) {
+			auto piece = buf.data() + k*stride;
+			auto keys = piece + sizeof(RequestHeader)/sizeof(uint64_t);
+			for (unsigned j = 0; j < FLAGS_batch; j++) {
+				keys[j] = rnd() % info.item;
+			}
+			req.id = i + k;
+			memcpy(piece, &req, sizeof(req));
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (!SendAll(fd, buf.data(), window*stride*sizeof(uint64_t))) {
+			close(fd);
+			return;
+		}
+		for (unsigned k = 0; k < window; k++, i++) {
+			if (!RecvAll(fd, &rsp, sizeof(rsp)) || rsp.magic != RESPONSE_MAGIC
+				|| rsp.id != i || rsp.status != STATUS_OK) {
+				close(fd);
+				return;
+			}
+			payload.resize(rsp.size);
+			if (!RecvAll(fd, payload.data(), rsp.size)) {
+				close(fd);
+				return;
+			}
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			batch_ns[i] = ns;
+			client->ns += ns;
+			client->hit += rsp.hit;
+		}
+	}
+	close(fd);
+	client->ok = true;
+}
+
+//keys are generated in the slot directly, one request in flight
+static void RunShm(Client* client, uint64_t* batch_ns, Op op) {
+	ShmClient shm(FLAGS_shm);
+	if (!shm) {
+		return;
+	}
+	auto& header = shm.header();
+	TableInfo info;
+	if (!ReadTableInfo(header, FLAGS_table, info) || FLAGS_batch > header.max_batch) {
+		return;
+	}
+	if (info.key_len != sizeof(uint64_t) || info.item == 0) {
+		return;
+	}
+
+	XorShift128Plus rnd;
+	for (unsigned i = 0; i < FLAGS_loop; i++) {
+		auto keys = (uint64_t*)shm.next()->keys();
+		for (unsigned j = 0; j < FLAGS_batch; j++) {
+			keys[j] = rnd() % info.item;
+		}
+		auto start = std::chrono::steady_clock::now();
+		auto slot = shm.call(op, FLAGS_table, FLAGS_batch);
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		if (slot->status != STATUS_OK) {
+			return;
+		}
+		batch_ns[i] = ns;
+		client->ns += ns;
+		client->hit += slot->hit;
+	}
+	client->ok = true;
+}
+
+int main(int argc, char* argv[]) {
+	google::ParseCommandLineFlags(&argc, &argv, true);
+
+	Op op;
+	if (FLAGS_op == "fetch") {
+		op = OP_FETCH;
+	} else if (FLAGS_op == "search") {
+		op = OP_SEARCH;
+	} else {
+		std::cout << "unknown op: " << FLAGS_op << std::endl;
+		return -1;
+	}
+	if (FLAGS_connection == 0 || FLAGS_batch == 0 || FLAGS_batch > MAX_BATCH || FLAGS_loop == 0
+		|| FLAGS_pipeline == 0) {
+		std::cout << "illegal arguments" << std::endl;
+		return -1;
+	}
+
+	const unsigned n = FLAGS_connection;
+	std::vector<Client> clients(n);
+	std::vector<uint64_t> samples(n*(size_t)FLAGS_loop);
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < n; i++) {
+		threads.emplace_back(FLAGS_shm.empty()? Run : RunShm, &clients[i], &samples[i*(size_t)FLAGS_loop], op);
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	uint64_t hit = 0;
+	for (auto& c : clients) {
+		if (!c.ok) {
+			std::cout << "fail to talk with server" << std::endl;
+			return 1;
+		}
+		hit += c.hit;
+	}
+
+	const uint64_t keys = n * (uint64_t)FLAGS_loop * FLAGS_batch;
+	const double kqps = keys * 1e6 / wall;
+	auto latency = Summarize(samples);
+	std::cout << kqps/1000 << " mqps with " << n << " connections, hit rate " << hit/(double)keys << std::endl;
+	std::cout << "request latency: p50 " << latency.p50 << " ns, p99 " << latency.p99
+		<< " ns, p999 " << latency.p999 << " ns, max " << latency.max << " ns" << std::endl;
+	if (!FLAGS_json.empty()) {
+		FILE* fp = fopen(FLAGS_json.c_str(), "w");
+		if (fp == nullptr) {
+			std::cout << "fail to write: " << FLAGS_json << std::endl;
+			return 1;
+		}
+		fprintf(fp, "{\"op\": \"%s\", \"connection\": %u, \"batch\": %u, \"loop\": %u, \"qps\": %.0f, "
+					"\"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}\n",
+				FLAGS_op.c_str(), n, FLAGS_batch, FLAGS_loop, kqps*1000, latency.p50, latency.p99,
+				latency.p999, latency.max);
+		fclose(fp);
+	}
+	return 0;
+}
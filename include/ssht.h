@@ -22,6 +22,8 @@
 #define SSHT_H_
 
 #include <cstdint>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <memory>
@@ -41,20 +43,67 @@ enum BuildStatus {
 
 using DataReaders = std::vector<std::unique_ptr<IDataReader>>;
 
+static constexpr uint32_t VARIED_VALUE_LEN = UINT32_MAX;
+
+//split a mapped file of records into n readers at record boundaries, records are read in place
+//each record is a key of key_len bytes and a value of val_len bytes, or a value with varint length
+//prefix if val_len is VARIED_VALUE_LEN, return empty if the file does not match
+extern DataReaders SplitRecordFile(const char* path, uint8_t key_len, uint32_t val_len, unsigned n);
+
+struct BuildOptions {
+	//size of thread pool when all readers support slice, 0 means hardware concurrency,
+	//otherwise one thread per reader
+	unsigned thread = 0;
+	//where pages of table are placed on numa machine by first touch
+	enum Placement : uint8_t {
+		PLACE_LOCAL,		//parallel initialization, threads are not pinned
+		PLACE_INTERLEAVE,	//pages spread over nodes in turn, threads pinned across nodes
+		PLACE_PARTITION,	//contiguous range of sets per node, records are inserted by threads of their node,
+							//input is read once per node
+	};
+	Placement placement = PLACE_LOCAL;
+	//if set, KV_SEPARATED build spills values to an unnamed file under this directory while mapping keys,
+	//so every reader is read only once and reset() is never called
+	const char* spill_dir = nullptr;
+	//keys in descending order of access frequency, they are inserted first to take their home slots,
+	//and values of KV_SEPARATED are clustered at the beginning of extend, BUILD_STATUS_BAD_INPUT with spill_dir
+	//or if a hot key is found twice in input
+	IDataReader* hot_keys = nullptr;
+	//KV_SEPARATED values are stored in order of their slots instead of input order, so scans over slots
+	//read extend sequentially, extend is staged in memory, BUILD_STATUS_BAD_INPUT with spill_dir
+	bool slot_order = false;
+};
+
 //key should have fixed length
 //dynamic length key is not useful, just pad or use checksum instead
-extern BuildStatus BuildSet(const DataReaders& in, IDataWriter& out);
+extern BuildStatus BuildSet(const DataReaders& in, IDataWriter& out, const BuildOptions& options={});
 
 //inline large value may consume a lot of memory
-extern BuildStatus BuildDict(const DataReaders& in, IDataWriter& out);
+extern BuildStatus BuildDict(const DataReaders& in, IDataWriter& out, const BuildOptions& options={});
+
+extern BuildStatus BuildDictWithVariedValue(const DataReaders& in, IDataWriter& out, const BuildOptions& options={});
+
+class Hashtable;
+class HotCache;
+class LookupProbe;
+struct Tier;
+struct CounterStore;
 
-extern BuildStatus BuildDictWithVariedValue(const DataReaders& in, IDataWriter& out);
+//output a patch table with items of neo which are absent or changed in old,
+//keys only exist in old are dumped to tombstone (if not null) one by one
+extern BuildStatus Diff(const Hashtable& old, const Hashtable& neo, IDataWriter& out, IDataWriter* tombstone=nullptr);
 
 
 class Hashtable {
 public:
-	enum LoadPolicy {MAP_ONLY, MAP_FETCH, MAP_OCCUPY, COPY_DATA};
-	explicit Hashtable(const std::string& path, LoadPolicy load_policy=MAP_ONLY);
+	//TIERED keeps only guide in memory, content stays in file and is read by blocks through a cache,
+	//only batch_fetch works then, and verify is ignored; batch_fetch submits reads of a whole batch
+	//together but waits for all of them before return, there is no asynchronous completion
+	enum LoadPolicy {MAP_ONLY, MAP_FETCH, MAP_OCCUPY, COPY_DATA, TIERED};
+	//verify checksums in parallel while loading, files without checksum are accepted
+	explicit Hashtable(const std::string& path, LoadPolicy load_policy=MAP_ONLY, bool verify=false);
+	//table built in memory, such as output of MemWriter
+	explicit Hashtable(MemBlock&& data);
 	bool operator!() const noexcept { return !m_res && !m_mem; }
 
 	enum Type : uint8_t {
@@ -81,7 +130,41 @@ public:
 	unsigned batch_fetch(unsigned batch, const uint8_t* __restrict__ keys, uint8_t* __restrict__ data,
 						 const uint8_t* __restrict__ dft_val=nullptr, const Hashtable* patch=nullptr) const noexcept;
 
-	BuildStatus derive(const DataReaders& in, IDataWriter& out) const;
+	BuildStatus derive(const DataReaders& in, IDataWriter& out, const BuildOptions& options={}) const;
+
+	//lookups are sampled into cache, and batch_fetch tries its hot table after patch and before base,
+	//search and batch_search only sample, as pointers they return could outlive a swap of hot table,
+	//cache should outlive this and be attached before lookups
+	void attach(HotCache* cache) noexcept { m_hot = cache; }
+
+	struct Stats {
+		uint64_t guide_size = 0;
+		uint64_t content_size = 0;
+		uint64_t extend_size = 0;
+		uint64_t occupancy[65] = {};	//number of sets with n used slots
+		uint64_t overflow = 0;			//items not in home set
+		uint64_t hit_probe[16] = {};	//tags scanned to hit, log2 buckets
+		uint64_t max_hit_probe = 0;
+		uint64_t max_miss_scan = 0;		//tags scanned to miss
+		double avg_hit_probe = 0;
+		double avg_miss_scan = 0;
+		double hit_false_tag = 0;		//tag matches with different key per hit
+		double miss_false_tag = 0;		//estimated tag matches per miss
+	};
+	//scan whole table, may be slow
+	Stats stats() const;
+
+	struct Counters {
+		uint64_t lookup = 0;
+		uint64_t hit = 0;
+		uint64_t patch_hit = 0;
+		uint64_t hot_hit = 0;
+		uint64_t set_probe = 0;
+		uint64_t false_tag = 0;
+		uint64_t default_fill = 0;
+	};
+	//sum of all threads, always zero unless library is built with ENABLE_LOOKUP_COUNTER
+	Counters counters() const noexcept;
 
 	struct View {
 		Type type = ILLEGAL_TYPE;
@@ -95,14 +178,98 @@ public:
 		const uint8_t* content = nullptr;
 		const uint8_t* extend = nullptr;
 		const uint8_t* space_end = nullptr;
+		bool slot_ordered = false;
 	};
 
 private:
+	friend BuildStatus Diff(const Hashtable&, const Hashtable&, IDataWriter&, IDataWriter*);
+	friend class HotCache;
+	friend class LookupProbe;
+	void InitCounter() noexcept;
 	MemMap m_res;
 	MemBlock m_mem;
+	std::shared_ptr<CounterStore> m_counter;
 	View m_view;
+	HotCache* m_hot = nullptr;
+	std::shared_ptr<Tier> m_tier;
+};
+
+//one lookup split into steps, every unfinished step ends with a prefetch, so steps of many probes
+//can be run in turn to overlap cache misses of independent requests, see ssht_coro.h
+class LookupProbe {
+public:
+	//KEY_SET, KV_INLINE or KV_SEPARATED, patch is searched first, key should live until finished,
+	//return true if finished at once (bad input)
+	bool start(const Hashtable& table, const uint8_t* key, const Hashtable* patch=nullptr) noexcept;
+	//advance one step, return true when finished
+	bool step() noexcept;
+	//same as search() once finished
+	Slice result() const noexcept { return m_result; }
+
+private:
+	enum Stage : uint8_t {STAGE_SCAN, STAGE_LINE, STAGE_VALUE, STAGE_DONE};
+	const Hashtable* m_table = nullptr;
+	const Hashtable::View* m_patch = nullptr;
+	const Hashtable::View* m_pack = nullptr;
+	const uint8_t* m_key = nullptr;
+	const uint8_t* m_line = nullptr;
+	uint64_t m_set = 0;
+	uint8_t m_mark = 0;
+	uint8_t m_sft = 0;
+	uint8_t m_cur = 0;
+	Stage m_stage = STAGE_DONE;
+	Slice m_result;
+	Hashtable::Counters m_counters;
+
+	void bind(const Hashtable::View& pack) noexcept;
+	bool finish() noexcept;
+};
+
+//small table of hot items in base found by sampled lookups, only for KEY_SET and KV_INLINE,
+//it is rebuilt by one thread and swapped without blocking lookups
+class HotCache {
+public:
+	//profile keeps at most capacity keys, 1 of 2^rate_shift lookups is sampled
+	explicit HotCache(const Hashtable& base, unsigned capacity=1U<<16U, unsigned rate_shift=6U);
+	~HotCache() noexcept;
+	bool operator!() const noexcept { return !m_profile; }
+
+	//samples are dropped rather than waiting for contended slots
+	void sample(unsigned batch, const uint8_t* keys) noexcept;
+
+	//build hot table with at most n most sampled keys in base, then halve counts to age the profile
+	bool refresh(size_t n);
+
+	//takes a lock, lookups pin the table without it
+	std::shared_ptr<const Hashtable> table() const;
+
+private:
+	friend class Hashtable;
+	//current table stays alive until unpin, epoch is set for unpin, never blocks
+	const Hashtable* pin(unsigned& epoch) const noexcept;
+	void unpin(unsigned epoch) const noexcept;
+	//swap table then wait for lookups pinned before the swap
+	void publish(std::shared_ptr<const Hashtable>&& table);
+
+	const Hashtable& m_base;
+	const unsigned m_capacity;
+	const unsigned m_rate_shift;
+	const unsigned m_slot_size;
+	MemBlock m_profile;
+	mutable std::mutex m_lock;
+	std::shared_ptr<const Hashtable> m_table;
+	std::atomic<const Hashtable*> m_current{nullptr};
+	std::atomic<unsigned> m_epoch{0};
+	struct alignas(64) PinCount {
+		std::atomic<uint64_t> val{0};
+	};
+	mutable PinCount m_pins[2];	//lookups by parity of epoch
 };
 
+//for readers which do not know total, each one is read once until a record with null key,
+//records are appended to logs under spill_dir (or /tmp), then the table is sized and built from logs
+extern BuildStatus BuildFromStream(Hashtable::Type type, const DataReaders& in, IDataWriter& out,
+								   const BuildOptions& options={});
 
 } //ssht
 #endif //SSHT_H_
\ No newline at end of file
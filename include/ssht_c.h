@@ -0,0 +1,114 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#pragma once
+#ifndef SSHT_C_H_
+#define SSHT_C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//C interface for FFI, lookup functions forward to Hashtable without allocation
+
+typedef struct ssht_table ssht_table;
+
+enum {
+	SSHT_MAP_ONLY = 0,
+	SSHT_MAP_FETCH = 1,
+	SSHT_MAP_OCCUPY = 2,
+	SSHT_COPY_DATA = 3,
+	SSHT_TIERED = 4,	//only ssht_batch_fetch works
+};
+
+enum {
+	SSHT_KEY_SET = 0,
+	SSHT_KV_INLINE = 1,
+	SSHT_KV_SEPARATED = 2,
+};
+
+enum {
+	SSHT_BUILD_OK = 0,
+	SSHT_BUILD_BAD_INPUT = 1,
+	SSHT_BUILD_FAIL_TO_OUTPUT = 2,
+};
+
+//return NULL if fail
+extern ssht_table* ssht_open(const char* path, int policy);
+extern void ssht_close(ssht_table* table);
+
+extern int ssht_type(const ssht_table* table);
+extern uint8_t ssht_key_len(const ssht_table* table);
+extern uint16_t ssht_val_len(const ssht_table* table);
+extern uint64_t ssht_item(const ssht_table* table);
+
+//return value or NULL if miss, val_len can be NULL
+extern const uint8_t* ssht_search(const ssht_table* table, const uint8_t* key, size_t* val_len);
+
+//KEY_SET or KV_INLINE, patch can be NULL, keys == out is OK
+extern unsigned ssht_batch_search(const ssht_table* table, unsigned batch, const uint8_t* const keys[],
+								  const uint8_t* out[], const ssht_table* patch);
+
+//only KV_INLINE, dft_val and patch can be NULL
+extern unsigned ssht_batch_fetch(const ssht_table* table, unsigned batch, const uint8_t* keys, uint8_t* data,
+								 const uint8_t* dft_val, const ssht_table* patch);
+
+
+typedef struct ssht_record {
+	const uint8_t* key;
+	size_t key_len;
+	const uint8_t* val;
+	size_t val_len;
+} ssht_record;
+
+//one reader is consumed by one build thread, callbacks of different readers may run concurrently
+typedef struct ssht_reader {
+	void* ctx;
+	void (*reset)(void* ctx);
+	size_t (*total)(void* ctx);
+	void (*read)(void* ctx, int key_only, ssht_record* out);
+} ssht_reader;
+
+//n readers, table is written to path
+extern int ssht_build_set(const ssht_reader* readers, unsigned n, const char* path);
+extern int ssht_build_dict(const ssht_reader* readers, unsigned n, const char* path);
+extern int ssht_build_dict_with_varied_value(const ssht_reader* readers, unsigned n, const char* path);
+extern int ssht_derive(const ssht_table* base, const ssht_reader* readers, unsigned n, const char* path);
+
+typedef struct ssht_array {
+	const uint8_t* keys;		//item * key_len bytes
+	size_t key_len;
+	size_t item;
+	const uint8_t* vals;		//NULL for set
+	size_t val_len;				//fixed value length, ignored when offsets is not NULL
+	const uint64_t* offsets;	//item+1 offsets in vals for varied values
+} ssht_array;
+
+//array is split into pieces for thread (0 means hardware concurrency)
+extern int ssht_build_set_from_array(const ssht_array* in, unsigned thread, const char* path);
+extern int ssht_build_dict_from_array(const ssht_array* in, unsigned thread, const char* path);
+extern int ssht_build_dict_with_varied_value_from_array(const ssht_array* in, unsigned thread, const char* path);
+extern int ssht_derive_from_array(const ssht_table* base, const ssht_array* in, unsigned thread, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //SSHT_C_H_
@@ -0,0 +1,101 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+
+#pragma once
+#ifndef SSHT_CORO_H_
+#define SSHT_CORO_H_
+
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "ssht_coro.h needs C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <vector>
+#include "ssht.h"
+
+namespace ssht {
+
+//lookups of suspended coroutines are stepped in turn, so cache misses of independent requests overlap,
+//a coroutine is resumed by poll() of the same thread once its lookup finishes
+class LookupScheduler {
+public:
+	class Lookup {
+	public:
+		bool await_ready() noexcept {
+			return m_probe.start(m_table, m_key, m_patch);
+		}
+		void await_suspend(std::coroutine_handle<> handle) {
+			m_handle = handle;
+			m_scheduler.m_pending.push_back(this);
+		}
+		Slice await_resume() const noexcept {
+			return m_probe.result();
+		}
+
+	private:
+		friend class LookupScheduler;
+		Lookup(LookupScheduler& scheduler, const Hashtable& table, const uint8_t* key, const Hashtable* patch) noexcept
+			: m_scheduler(scheduler), m_table(table), m_key(key), m_patch(patch) {}
+		LookupScheduler& m_scheduler;
+		const Hashtable& m_table;
+		const uint8_t* m_key;
+		const Hashtable* m_patch;
+		LookupProbe m_probe;
+		std::coroutine_handle<> m_handle;
+	};
+
+	//co_await scheduler.search(table, key) gives the same as table.search(key), with patch searched first
+	Lookup search(const Hashtable& table, const uint8_t* key, const Hashtable* patch=nullptr) noexcept {
+		return {*this, table, key, patch};
+	}
+
+	//step every pending lookup once and resume finished ones, return number still pending
+	size_t poll() {
+		for (size_t i = 0; i < m_pending.size();) {
+			if (m_pending[i]->m_probe.step()) {
+				m_ready.push_back(m_pending[i]);
+				m_pending[i] = m_pending.back();
+				m_pending.pop_back();
+			} else {
+				i++;
+			}
+		}
+		//resumed coroutines may issue new lookups
+		for (auto lookup : m_ready) {
+			lookup->m_handle.resume();
+		}
+		m_ready.clear();
+		return m_pending.size();
+	}
+
+	//poll until no lookup is pending
+	void run() {
+		while (poll() != 0);
+	}
+
+	size_t pending() const noexcept { return m_pending.size(); }
+
+private:
+	std::vector<Lookup*> m_pending;
+	std::vector<Lookup*> m_ready;
+};
+
+} //ssht
+#endif //SSHT_CORO_H_
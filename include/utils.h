@@ -23,6 +23,7 @@
 #include <cstdint>
 #include <cstdarg>
 #include <memory>
+#include <string>
 #include <utility>
 #include <type_traits>
 
@@ -126,6 +127,20 @@ struct IDataReader {
 	virtual void reset() = 0;
 	virtual size_t total() = 0;
 	virtual Record read(bool key_only) = 0;
+	//read up to n (n > 0) records, which stay valid until next read, return number of records read
+	//default reads one by one, override it when records do not share buffer
+	virtual size_t read_batch(Record* out, size_t n, bool key_only) {
+		(void)n;
+		out[0] = read(key_only);
+		return 1;
+	}
+	//optional, an independent reader of records [begin, end) in this one, which may be used by
+	//another thread, return nullptr if not supported
+	virtual std::unique_ptr<IDataReader> slice(size_t begin, size_t end) {
+		(void)begin;
+		(void)end;
+		return nullptr;
+	}
 	virtual ~IDataReader() noexcept = default;
 };
 
@@ -136,6 +151,18 @@ struct IDataWriter {
 	virtual ~IDataWriter() noexcept = default;
 };
 
+//collect output in memory
+class MemWriter : public IDataWriter {
+public:
+	bool operator!() const noexcept override { return false; }
+	bool flush() noexcept override { return true; }
+	bool write(const void* data, size_t n) noexcept override;
+	//move output to a block, writer is empty after that
+	MemBlock release() noexcept;
+private:
+	std::string m_buf;
+};
+
 class FileWriter : public IDataWriter {
 public:
 	FileWriter() = default;
@@ -158,6 +185,10 @@ public:
 	bool flush() noexcept override;
 	bool write(const void* data, size_t n) noexcept override;
 
+	//unnamed file under dir, it can be read back through fd until closed
+	static FileWriter Temporary(const char* dir);
+	int fd() const noexcept { return m_fd; }
+
 private:
 	static constexpr size_t BUFSZ = 8192;
 	std::unique_ptr<uint8_t[]> m_buf;
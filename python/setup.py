@@ -0,0 +1,39 @@
+#===============================================================================
+# A static set-associative hashtable.
+# Copyright (C) 2020  Ruan Kunliang
+#
+# This library is free software; you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation; either version 2.1 of the License, or (at your option)
+# any later version.
+#
+# This library is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with the This Library; if not, see <https:#www.gnu.org/licenses/>.
+#===============================================================================
+
+# python3 setup.py build_ext --inplace
+import glob
+import os
+from setuptools import setup, Extension
+
+os.chdir(os.path.dirname(os.path.abspath(__file__)))
+
+module = Extension(
+	'ssht',
+	sources=['sshtmodule.cc'] + sorted(glob.glob('../src/*.cc')),
+	include_dirs=['../include'],
+	extra_compile_args=['-std=c++17', '-O2', '-fno-unroll-loops', '-fno-stack-protector'],
+	libraries=['pthread'],
+)
+
+setup(
+	name='ssht',
+	version='0.1',
+	description='static set-associative hashtable',
+	ext_modules=[module],
+)
@@ -0,0 +1,590 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <ssht.h>
+
+//Arrays are passed by buffer protocol, so numpy arrays, bytearrays and memoryviews work without copy.
+//Keys are contiguous with fixed length, values of fixed length are contiguous too, varied values
+//are described by an offset array with n+1 uint64 elements. GIL is released during lookups and builds.
+
+using namespace ssht;
+
+namespace {
+
+class Buffer {
+public:
+	Buffer() = default;
+	~Buffer() {
+		if (m_view.obj != nullptr) {
+			PyBuffer_Release(&m_view);
+		}
+	}
+	Buffer(const Buffer&) = delete;
+	Buffer& operator=(const Buffer&) = delete;
+
+	bool get(PyObject* obj, bool writable, const char* name) {
+		if (PyObject_GetBuffer(obj, &m_view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable? PyBUF_WRITABLE : 0)) != 0) {
+			PyErr_Format(PyExc_TypeError, "%s should be a %scontiguous buffer", name, writable? "writable " : "");
+			return false;
+		}
+		return true;
+	}
+	uint8_t* data() const noexcept { return (uint8_t*)m_view.buf; }
+	size_t size() const noexcept { return m_view.len; }
+	//first dimension
+	size_t rows() const noexcept {
+		if (m_view.ndim <= 0 || m_view.shape == nullptr) {
+			return m_view.len / std::max<Py_ssize_t>(m_view.itemsize, 1);
+		}
+		return m_view.shape[0];
+	}
+	//bytes per row
+	size_t width() const noexcept {
+		auto n = rows();
+		return n == 0? m_view.itemsize : m_view.len / n;
+	}
+
+private:
+	Py_buffer m_view = {};
+};
+
+struct HashtableObject {
+	PyObject_HEAD
+	Hashtable* table;
+	bool tiered;	//only batch_fetch works
+};
+
+extern PyTypeObject HashtableType;
+
+static constexpr size_t MAX_CHUNK = 1U << 20U;
+
+class ArrayReader : public IDataReader {
+public:
+	ArrayReader(const uint8_t* keys, size_t key_len, const uint8_t* vals, size_t val_len,
+				const uint64_t* offsets, size_t begin, size_t end)
+		: m_keys(keys), m_key_len(key_len), m_vals(vals), m_val_len(val_len),
+		  m_offsets(offsets), m_begin(begin), m_end(end), m_current(begin) {}
+
+	void reset() override { m_current = m_begin; }
+	size_t total() override { return m_end - m_begin; }
+	Record read(bool key_only) override {
+		Record rec;
+		rec.key = {m_keys + m_current*m_key_len, m_key_len};
+		if (!key_only && m_vals != nullptr) {
+			if (m_offsets != nullptr) {
+				rec.val = {m_vals + m_offsets[m_current], m_offsets[m_current+1] - m_offsets[m_current]};
+			} else {
+				rec.val = {m_vals + m_current*m_val_len, m_val_len};
+			}
+		}
+		m_current++;
+		return rec;
+	}
+	//records point into arrays
+	size_t read_batch(Record* out, size_t n, bool key_only) override {
+		n = std::min(n, m_end - m_current);
+		for (size_t i = 0; i < n; i++) {
+			out[i] = read(key_only);
+		}
+		return n;
+	}
+	std::unique_ptr<IDataReader> slice(size_t begin, size_t end) override {
+		if (begin > end || m_begin + end > m_end) {
+			return nullptr;
+		}
+		return std::make_unique<ArrayReader>(m_keys, m_key_len, m_vals, m_val_len, m_offsets,
+											 m_begin + begin, m_begin + end);
+	}
+
+private:
+	const uint8_t* m_keys;
+	size_t m_key_len;
+	const uint8_t* m_vals;
+	size_t m_val_len;
+	const uint64_t* m_offsets;
+	size_t m_begin;
+	size_t m_end;
+	size_t m_current;
+};
+
+class Input {
+public:
+	//parse keys, values and offsets, then split them into pieces
+	bool init(PyObject* keys, PyObject* vals, PyObject* offsets, Py_ssize_t key_len, unsigned thread) {
+		if (!m_keys.get(keys, false, "keys")) {
+			return false;
+		}
+		m_key_len = key_len > 0? (size_t)key_len : m_keys.width();
+		if (m_key_len == 0 || m_key_len > MAX_KEY_LEN || m_keys.size() % m_key_len != 0) {
+			PyErr_SetString(PyExc_ValueError, "illegal key length");
+			return false;
+		}
+		m_item = m_keys.size() / m_key_len;
+		if (vals != nullptr && vals != Py_None) {
+			if (!m_vals.get(vals, false, "values")) {
+				return false;
+			}
+			m_has_value = true;
+			if (offsets != nullptr && offsets != Py_None) {
+				if (!m_offsets.get(offsets, false, "offsets")) {
+					return false;
+				}
+				m_varied = true;
+				auto off = (const uint64_t*)m_offsets.data();
+				if (m_offsets.size() != (m_item+1)*sizeof(uint64_t) || off[0] != 0 || off[m_item] > m_vals.size()) {
+					PyErr_SetString(PyExc_ValueError, "offsets should be n+1 ascending uint64 within values");
+					return false;
+				}
+				for (size_t i = 0; i < m_item; i++) {
+					if (off[i] > off[i+1]) {
+						PyErr_SetString(PyExc_ValueError, "offsets should be ascending");
+						return false;
+					}
+				}
+			} else {
+				if (m_item == 0 ? m_vals.size() != 0 : m_vals.size() % m_item != 0) {
+					PyErr_SetString(PyExc_ValueError, "values should match keys");
+					return false;
+				}
+				m_val_len = m_item == 0? 0 : m_vals.size() / m_item;
+				if (m_val_len > MAX_INLINE_VALUE_LEN) {
+					PyErr_SetString(PyExc_ValueError, "value is too long");
+					return false;
+				}
+			}
+		}
+		m_options.thread = thread;
+		if (thread == 0) {
+			thread = std::max(std::thread::hardware_concurrency(), 1U);
+		}
+		size_t piece = std::max<size_t>(std::min<size_t>(thread, m_item/1024U), 1U);
+		for (size_t i = 0; i < piece; i++) {
+			m_readers.emplace_back(new ArrayReader(m_keys.data(), m_key_len,
+				m_has_value? m_vals.data() : nullptr, m_val_len,
+				m_varied? (const uint64_t*)m_offsets.data() : nullptr,
+				m_item*i/piece, m_item*(i+1)/piece));
+		}
+		return true;
+	}
+	const DataReaders& readers() const noexcept { return m_readers; }
+	const BuildOptions& options() const noexcept { return m_options; }
+	bool has_value() const noexcept { return m_has_value; }
+	bool varied() const noexcept { return m_varied; }
+
+private:
+	Buffer m_keys;
+	Buffer m_vals;
+	Buffer m_offsets;
+	size_t m_item = 0;
+	size_t m_key_len = 0;
+	size_t m_val_len = 0;
+	bool m_has_value = false;
+	bool m_varied = false;
+	DataReaders m_readers;
+	BuildOptions m_options;
+};
+
+static PyObject* BuildResult(BuildStatus status) {
+	switch (status) {
+		case BUILD_STATUS_OK:
+			Py_RETURN_NONE;
+		case BUILD_STATUS_BAD_INPUT:
+			PyErr_SetString(PyExc_ValueError, "bad input, maybe duplicate keys");
+			return nullptr;
+		default:
+			PyErr_SetString(PyExc_OSError, "fail to output");
+			return nullptr;
+	}
+}
+
+enum BuildKind {BUILD_SET, BUILD_DICT, BUILD_VARIED_DICT, BUILD_DERIVE};
+
+static PyObject* Build(BuildKind kind, const Hashtable* base, PyObject* args, PyObject* kwds) {
+	static const char* kwlist[] = {"path", "keys", "values", "offsets", "key_len", "thread", nullptr};
+	const char* path = nullptr;
+	PyObject* keys = nullptr;
+	PyObject* vals = nullptr;
+	PyObject* offsets = nullptr;
+	Py_ssize_t key_len = 0;
+	unsigned thread = 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO|OOnI", (char**)kwlist,
+									 &path, &keys, &vals, &offsets, &key_len, &thread)) {
+		return nullptr;
+	}
+	Input input;
+	if (!input.init(keys, vals, offsets, key_len, thread)) {
+		return nullptr;
+	}
+	const bool need_value = kind != BUILD_SET && !(kind == BUILD_DERIVE && base->type() == Hashtable::KEY_SET);
+	const bool need_offsets = kind == BUILD_VARIED_DICT || (kind == BUILD_DERIVE && base->type() == Hashtable::KV_SEPARATED);
+	if (need_value != input.has_value() || (need_value && need_offsets != input.varied())) {
+		PyErr_SetString(PyExc_ValueError, need_offsets? "values and offsets are required"
+			: need_value? "values are required without offsets" : "values are not needed");
+		return nullptr;
+	}
+	FileWriter writer(path);
+	if (!writer) {
+		PyErr_Format(PyExc_OSError, "fail to open: %s", path);
+		return nullptr;
+	}
+	BuildStatus status;
+	Py_BEGIN_ALLOW_THREADS
+	switch (kind) {
+		case BUILD_SET: status = BuildSet(input.readers(), writer, input.options()); break;
+		case BUILD_DICT: status = BuildDict(input.readers(), writer, input.options()); break;
+		case BUILD_VARIED_DICT: status = BuildDictWithVariedValue(input.readers(), writer, input.options()); break;
+		default: status = base->derive(input.readers(), writer, input.options()); break;
+	}
+	Py_END_ALLOW_THREADS
+	return BuildResult(status);
+}
+
+static int Hashtable_init(HashtableObject* self, PyObject* args, PyObject* kwds) {
+	static const char* kwlist[] = {"path", "policy", nullptr};
+	const char* path = nullptr;
+	int policy = Hashtable::MAP_ONLY;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|i", (char**)kwlist, &path, &policy)) {
+		return -1;
+	}
+	if (policy < Hashtable::MAP_ONLY || policy > Hashtable::TIERED) {
+		PyErr_SetString(PyExc_ValueError, "unknown load policy");
+		return -1;
+	}
+	//other threads may be in calls on the loaded table without the GIL
+	if (self->table != nullptr) {
+		PyErr_SetString(PyExc_RuntimeError, "table is already loaded");
+		return -1;
+	}
+	Hashtable* table;
+	Py_BEGIN_ALLOW_THREADS
+	table = new Hashtable(path, (Hashtable::LoadPolicy)policy);
+	Py_END_ALLOW_THREADS
+	if (!*table) {
+		delete table;
+		PyErr_Format(PyExc_OSError, "fail to load: %s", path);
+		return -1;
+	}
+	self->table = table;
+	self->tiered = policy == Hashtable::TIERED;
+	return 0;
+}
+
+static void Hashtable_dealloc(HashtableObject* self) {
+	delete self->table;
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static const Hashtable* Table(HashtableObject* self) {
+	if (self->table == nullptr) {
+		PyErr_SetString(PyExc_RuntimeError, "table is not loaded");
+	}
+	return self->table;
+}
+
+//table for calls other than batch_fetch
+static const Hashtable* MappedTable(HashtableObject* self) {
+	if (self->table != nullptr && self->tiered) {
+		PyErr_SetString(PyExc_TypeError, "TIERED table supports batch_fetch only");
+		return nullptr;
+	}
+	return Table(self);
+}
+
+static bool GetPatch(PyObject* obj, const Hashtable* base, const Hashtable*& patch) {
+	patch = nullptr;
+	if (obj == nullptr || obj == Py_None) {
+		return true;
+	}
+	if (!PyObject_TypeCheck(obj, &HashtableType)) {
+		PyErr_SetString(PyExc_TypeError, "patch should be a Hashtable");
+		return false;
+	}
+	patch = MappedTable((HashtableObject*)obj);
+	if (patch == nullptr) {
+		return false;
+	}
+	if (patch->type() != base->type() || patch->key_len() != base->key_len() || patch->val_len() != base->val_len()) {
+		PyErr_SetString(PyExc_ValueError, "patch does not match base");
+		return false;
+	}
+	return true;
+}
+
+static bool GetKeys(PyObject* obj, const Hashtable* table, Buffer& keys, size_t& n) {
+	if (!keys.get(obj, false, "keys")) {
+		return false;
+	}
+	if (keys.size() % table->key_len() != 0) {
+		PyErr_SetString(PyExc_ValueError, "keys do not match key length");
+		return false;
+	}
+	n = keys.size() / table->key_len();
+	return true;
+}
+
+static PyObject* Hashtable_search(HashtableObject* self, PyObject* arg) {
+	auto table = MappedTable(self);
+	if (table == nullptr) {
+		return nullptr;
+	}
+	Buffer key;
+	if (!key.get(arg, false, "key")) {
+		return nullptr;
+	}
+	if (key.size() != table->key_len()) {
+		PyErr_SetString(PyExc_ValueError, "key length mismatch");
+		return nullptr;
+	}
+	auto val = table->search(key.data());
+	if (val.ptr == nullptr) {
+		Py_RETURN_NONE;
+	}
+	return PyBytes_FromStringAndSize((const char*)val.ptr, val.len);
+}
+
+//write 0 or 1 to mask for each key, return hit count
+static PyObject* Hashtable_batch_search(HashtableObject* self, PyObject* args, PyObject* kwds) {
+	static const char* kwlist[] = {"keys", "mask", "patch", nullptr};
+	PyObject* keys_obj = nullptr;
+	PyObject* mask_obj = nullptr;
+	PyObject* patch_obj = nullptr;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|O", (char**)kwlist, &keys_obj, &mask_obj, &patch_obj)) {
+		return nullptr;
+	}
+	auto table = MappedTable(self);
+	const Hashtable* patch = nullptr;
+	Buffer keys, mask;
+	size_t n = 0;
+	if (table == nullptr || !GetPatch(patch_obj, table, patch) || !GetKeys(keys_obj, table, keys, n)
+		|| !mask.get(mask_obj, true, "mask")) {
+		return nullptr;
+	}
+	if (mask.size() != n) {
+		PyErr_SetString(PyExc_ValueError, "mask should have one byte per key");
+		return nullptr;
+	}
+	size_t hit = 0;
+	Py_BEGIN_ALLOW_THREADS
+	constexpr unsigned CHUNK = 4096;
+	const uint8_t* ptrs[CHUNK];
+	const size_t key_len = table->key_len();
+	auto out = mask.data();
+	for (size_t off = 0; off < n; off += CHUNK) {
+		unsigned m = std::min<size_t>(n - off, CHUNK);
+		for (unsigned i = 0; i < m; i++) {
+			ptrs[i] = keys.data() + (off+i)*key_len;
+		}
+		if (table->type() == Hashtable::KV_SEPARATED) {
+			for (unsigned i = 0; i < m; i++) {
+				auto val = patch == nullptr? Slice() : patch->search(ptrs[i]);
+				ptrs[i] = val.ptr != nullptr? val.ptr : table->search(ptrs[i]).ptr;
+			}
+		} else {
+			table->batch_search(m, ptrs, ptrs, patch);
+		}
+		for (unsigned i = 0; i < m; i++) {
+			out[off+i] = ptrs[i] != nullptr;
+			hit += ptrs[i] != nullptr;
+		}
+	}
+	Py_END_ALLOW_THREADS
+	return PyLong_FromSize_t(hit);
+}
+
+//write values to out, missing ones are filled with default if given, return hit count
+static PyObject* Hashtable_batch_fetch(HashtableObject* self, PyObject* args, PyObject* kwds) {
+	static const char* kwlist[] = {"keys", "out", "default", "patch", nullptr};
+	PyObject* keys_obj = nullptr;
+	PyObject* out_obj = nullptr;
+	PyObject* dft_obj = nullptr;
+	PyObject* patch_obj = nullptr;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|OO", (char**)kwlist, &keys_obj, &out_obj, &dft_obj, &patch_obj)) {
+		return nullptr;
+	}
+	auto table = Table(self);
+	if (table == nullptr) {
+		return nullptr;
+	}
+	if (table->type() != Hashtable::KV_INLINE) {
+		PyErr_SetString(PyExc_TypeError, "batch_fetch is only for KV_INLINE");
+		return nullptr;
+	}
+	const Hashtable* patch = nullptr;
+	Buffer keys, out, dft;
+	size_t n = 0;
+	if (!GetPatch(patch_obj, table, patch) || !GetKeys(keys_obj, table, keys, n) || !out.get(out_obj, true, "out")) {
+		return nullptr;
+	}
+	if (out.size() != n * table->val_len()) {
+		PyErr_SetString(PyExc_ValueError, "out should have val_len bytes per key");
+		return nullptr;
+	}
+	if (dft_obj != nullptr && dft_obj != Py_None) {
+		if (!dft.get(dft_obj, false, "default")) {
+			return nullptr;
+		}
+		if (dft.size() != table->val_len()) {
+			PyErr_SetString(PyExc_ValueError, "default should have val_len bytes");
+			return nullptr;
+		}
+	}
+	size_t hit = 0;
+	Py_BEGIN_ALLOW_THREADS
+	const size_t key_len = table->key_len();
+	const size_t val_len = table->val_len();
+	for (size_t off = 0; off < n; off += MAX_CHUNK) {
+		unsigned m = std::min<size_t>(n - off, MAX_CHUNK);
+		hit += table->batch_fetch(m, keys.data()+off*key_len, out.data()+off*val_len, dft.data(), patch);
+	}
+	Py_END_ALLOW_THREADS
+	return PyLong_FromSize_t(hit);
+}
+
+static PyObject* Hashtable_derive(HashtableObject* self, PyObject* args, PyObject* kwds) {
+	auto table = MappedTable(self);
+	if (table == nullptr) {
+		return nullptr;
+	}
+	return Build(BUILD_DERIVE, table, args, kwds);
+}
+
+static PyObject* Hashtable_get_type(HashtableObject* self, void*) {
+	auto table = Table(self);
+	return table == nullptr? nullptr : PyLong_FromLong(table->type());
+}
+
+static PyObject* Hashtable_get_key_len(HashtableObject* self, void*) {
+	auto table = Table(self);
+	return table == nullptr? nullptr : PyLong_FromLong(table->key_len());
+}
+
+static PyObject* Hashtable_get_val_len(HashtableObject* self, void*) {
+	auto table = Table(self);
+	return table == nullptr? nullptr : PyLong_FromLong(table->val_len());
+}
+
+static PyObject* Hashtable_get_item(HashtableObject* self, void*) {
+	auto table = Table(self);
+	return table == nullptr? nullptr : PyLong_FromSize_t(table->item());
+}
+
+static Py_ssize_t Hashtable_len(HashtableObject* self) {
+	auto table = Table(self);
+	return table == nullptr? -1 : (Py_ssize_t)table->item();
+}
+
+static PyMethodDef Hashtable_methods[] = {
+	{"search", (PyCFunction)Hashtable_search, METH_O,
+		"search(key) -> bytes or None"},
+	{"batch_search", (PyCFunction)(void(*)(void))Hashtable_batch_search, METH_VARARGS | METH_KEYWORDS,
+		"batch_search(keys, mask, patch=None) -> hit count, mask gets one byte per key"},
+	{"batch_fetch", (PyCFunction)(void(*)(void))Hashtable_batch_fetch, METH_VARARGS | METH_KEYWORDS,
+		"batch_fetch(keys, out, default=None, patch=None) -> hit count, only for KV_INLINE"},
+	{"derive", (PyCFunction)(void(*)(void))Hashtable_derive, METH_VARARGS | METH_KEYWORDS,
+		"derive(path, keys, values=None, offsets=None, key_len=0, thread=0)"},
+	{nullptr}
+};
+
+static PyGetSetDef Hashtable_getset[] = {
+	{"type", (getter)Hashtable_get_type, nullptr, "KEY_SET, KV_INLINE or KV_SEPARATED", nullptr},
+	{"key_len", (getter)Hashtable_get_key_len, nullptr, "key length", nullptr},
+	{"val_len", (getter)Hashtable_get_val_len, nullptr, "value length, 0 if varied", nullptr},
+	{"item", (getter)Hashtable_get_item, nullptr, "number of items", nullptr},
+	{nullptr}
+};
+
+static PySequenceMethods Hashtable_as_sequence = {
+	(lenfunc)Hashtable_len,
+};
+
+PyTypeObject HashtableType = {
+	PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+static PyObject* BuildSetFunc(PyObject*, PyObject* args, PyObject* kwds) {
+	return Build(BUILD_SET, nullptr, args, kwds);
+}
+
+static PyObject* BuildDictFunc(PyObject*, PyObject* args, PyObject* kwds) {
+	return Build(BUILD_DICT, nullptr, args, kwds);
+}
+
+static PyObject* BuildDictWithVariedValueFunc(PyObject*, PyObject* args, PyObject* kwds) {
+	return Build(BUILD_VARIED_DICT, nullptr, args, kwds);
+}
+
+static PyMethodDef module_methods[] = {
+	{"build_set", (PyCFunction)(void(*)(void))BuildSetFunc, METH_VARARGS | METH_KEYWORDS,
+		"build_set(path, keys, key_len=0, thread=0)"},
+	{"build_dict", (PyCFunction)(void(*)(void))BuildDictFunc, METH_VARARGS | METH_KEYWORDS,
+		"build_dict(path, keys, values, key_len=0, thread=0)"},
+	{"build_dict_with_varied_value", (PyCFunction)(void(*)(void))BuildDictWithVariedValueFunc, METH_VARARGS | METH_KEYWORDS,
+		"build_dict_with_varied_value(path, keys, values, offsets, key_len=0, thread=0)"},
+	{nullptr}
+};
+
+static struct PyModuleDef module_def = {
+	PyModuleDef_HEAD_INIT,
+	"ssht",
+	"static set-associative hashtable",
+	-1,
+	module_methods,
+};
+
+} //namespace
+
+PyMODINIT_FUNC PyInit_ssht() {
+	HashtableType.tp_name = "ssht.Hashtable";
+	HashtableType.tp_doc = "Hashtable(path, policy=MAP_ONLY)";
+	HashtableType.tp_basicsize = sizeof(HashtableObject);
+	HashtableType.tp_flags = Py_TPFLAGS_DEFAULT;
+	HashtableType.tp_new = PyType_GenericNew;
+	HashtableType.tp_init = (initproc)Hashtable_init;
+	HashtableType.tp_dealloc = (destructor)Hashtable_dealloc;
+	HashtableType.tp_methods = Hashtable_methods;
+	HashtableType.tp_getset = Hashtable_getset;
+	HashtableType.tp_as_sequence = &Hashtable_as_sequence;
+	if (PyType_Ready(&HashtableType) < 0) {
+		return nullptr;
+	}
+	auto module = PyModule_Create(&module_def);
+	if (module == nullptr) {
+		return nullptr;
+	}
+	Py_INCREF(&HashtableType);
+	if (PyModule_AddObject(module, "Hashtable", (PyObject*)&HashtableType) != 0
+		|| PyModule_AddIntConstant(module, "MAP_ONLY", Hashtable::MAP_ONLY) != 0
+		|| PyModule_AddIntConstant(module, "MAP_FETCH", Hashtable::MAP_FETCH) != 0
+		|| PyModule_AddIntConstant(module, "MAP_OCCUPY", Hashtable::MAP_OCCUPY) != 0
+		|| PyModule_AddIntConstant(module, "COPY_DATA", Hashtable::COPY_DATA) != 0
+		|| PyModule_AddIntConstant(module, "TIERED", Hashtable::TIERED) != 0
+		|| PyModule_AddIntConstant(module, "KEY_SET", Hashtable::KEY_SET) != 0
+		|| PyModule_AddIntConstant(module, "KV_INLINE", Hashtable::KV_INLINE) != 0
+		|| PyModule_AddIntConstant(module, "KV_SEPARATED", Hashtable::KV_SEPARATED) != 0) {
+		Py_DECREF(&HashtableType);
+		Py_DECREF(module);
+		return nullptr;
+	}
+	return module;
+}
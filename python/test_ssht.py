@@ -0,0 +1,132 @@
+#===============================================================================
+# A static set-associative hashtable.
+# Copyright (C) 2020  Ruan Kunliang
+#
+# This library is free software; you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation; either version 2.1 of the License, or (at your option)
+# any later version.
+#
+# This library is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with the This Library; if not, see <https:#www.gnu.org/licenses/>.
+#===============================================================================
+
+# python3 setup.py build_ext --inplace && python3 -m unittest test_ssht
+import array
+import os
+import tempfile
+import threading
+import unittest
+
+import ssht
+
+N = 10000
+
+
+def pack(n, size=8):
+	return n.to_bytes(size, 'little')
+
+
+class TestHashtable(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.TemporaryDirectory()
+		cls.keys = array.array('Q', range(N))
+		cls.vals = b''.join(pack(i*7, 4) for i in range(N))
+		cls.path = os.path.join(cls.dir.name, 'dict.ssht')
+		ssht.build_dict(cls.path, cls.keys, cls.vals, thread=3)
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.dir.cleanup()
+
+	def test_policy(self):
+		for policy in (ssht.MAP_ONLY, ssht.MAP_FETCH, ssht.MAP_OCCUPY, ssht.COPY_DATA):
+			table = ssht.Hashtable(self.path, policy)
+			self.assertEqual(table.type, ssht.KV_INLINE)
+			self.assertEqual((table.key_len, table.val_len, len(table)), (8, 4, N))
+			self.assertEqual(table.search(pack(5)), pack(35, 4))
+			self.assertIsNone(table.search(pack(N)))
+
+	def test_tiered(self):
+		table = ssht.Hashtable(self.path, ssht.TIERED)
+		keys = array.array('Q', [1, 5, N+3, 9])
+		out = bytearray(16)
+		self.assertEqual(table.batch_fetch(keys, out, default=b'\xff'*4), 3)
+		self.assertEqual(out, pack(7, 4) + pack(35, 4) + b'\xff'*4 + pack(63, 4))
+		with self.assertRaises(TypeError):
+			table.search(pack(5))
+		with self.assertRaises(TypeError):
+			ssht.Hashtable(self.path).batch_fetch(keys, out, patch=table)
+
+	def test_batch(self):
+		table = ssht.Hashtable(self.path)
+		keys = array.array('Q', [1, 5, N+3, 9])
+		out = bytearray(16)
+		self.assertEqual(table.batch_fetch(keys, out, default=b'\xff'*4), 3)
+		self.assertEqual(out, pack(7, 4) + pack(35, 4) + b'\xff'*4 + pack(63, 4))
+		mask = bytearray(4)
+		self.assertEqual(table.batch_search(keys, mask), 3)
+		self.assertEqual(list(mask), [1, 1, 0, 1])
+		with self.assertRaises(ValueError):
+			table.batch_fetch(keys, bytearray(15))
+
+	def test_patch(self):
+		table = ssht.Hashtable(self.path)
+		path = os.path.join(self.dir.name, 'patch.ssht')
+		table.derive(path, array.array('Q', [1, N+3]), pack(1, 4)*2)
+		patch = ssht.Hashtable(path)
+		keys = array.array('Q', [1, N+3])
+		out = bytearray(8)
+		self.assertEqual(table.batch_fetch(keys, out, patch=patch), 2)
+		self.assertEqual(out, pack(1, 4)*2)
+
+	def test_set(self):
+		path = os.path.join(self.dir.name, 'set.ssht')
+		ssht.build_set(path, self.keys)
+		table = ssht.Hashtable(path)
+		self.assertEqual(table.type, ssht.KEY_SET)
+		self.assertEqual(table.search(pack(3)), b'')
+		mask = bytearray(2)
+		self.assertEqual(table.batch_search(array.array('Q', [3, N]), mask), 1)
+
+	def test_varied(self):
+		path = os.path.join(self.dir.name, 'varied.ssht')
+		offsets = array.array('Q', [0])
+		for i in range(N):
+			offsets.append(offsets[-1] + i%5)
+		vals = b''.join(b'x'*(i%5) for i in range(N))
+		ssht.build_dict_with_varied_value(path, self.keys, vals, offsets)
+		table = ssht.Hashtable(path)
+		self.assertEqual(table.type, ssht.KV_SEPARATED)
+		self.assertEqual(table.search(pack(7)), b'xx')
+		mask = bytearray(2)
+		self.assertEqual(table.batch_search(array.array('Q', [7, N]), mask), 1)
+
+	def test_threads(self):
+		table = ssht.Hashtable(self.path)
+		results = [0] * 4
+		def run(idx):
+			out = bytearray(N*4)
+			results[idx] = table.batch_fetch(self.keys, out)
+		threads = [threading.Thread(target=run, args=(i,)) for i in range(4)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertEqual(results, [N]*4)
+
+	def test_reinit(self):
+		table = ssht.Hashtable(self.path)
+		with self.assertRaises(RuntimeError):
+			table.__init__(self.path)
+		self.assertEqual(table.search(pack(5)), pack(35, 4))
+
+
+if __name__ == '__main__':
+	unittest.main()
@@ -18,9 +18,16 @@
 
 #include <cassert>
 #include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <thread>
+#include <algorithm>
 #include <exception>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "internal.h"
 
 namespace ssht {
@@ -59,6 +66,59 @@ static uint64_t GetSeed() {
 			std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+//pass through data, then append crc32c of each chunk and trailer
+class ChecksumWriter : public IDataWriter {
+public:
+	explicit ChecksumWriter(IDataWriter& out) : m_out(out) {}
+	bool operator!() const noexcept override { return !m_out; }
+	bool flush() override { return m_out.flush(); }
+	bool write(const void* data, size_t n) override {
+		if (!m_out.write(data, n)) {
+			return false;
+		}
+		constexpr size_t chunk = 1ULL << CHECKSUM_CHUNK_SHIFT;
+		auto pt = (const uint8_t*)data;
+		while (n != 0) {
+			auto m = std::min(n, chunk - (m_size & (chunk-1U)));
+			m_crc = Crc32c(m_crc, pt, m);
+			m_size += m;
+			pt += m;
+			n -= m;
+			if ((m_size & (chunk-1U)) == 0) {
+				m_sums.push_back(m_crc);
+				m_crc = 0;
+			}
+		}
+		return true;
+	}
+	bool finish() {
+		if ((m_size & ((1ULL << CHECKSUM_CHUNK_SHIFT)-1U)) != 0) {
+			m_sums.push_back(m_crc);
+		}
+		Trailer trailer;
+		trailer.data_size = m_size;
+		trailer.chunk_shift = CHECKSUM_CHUNK_SHIFT;
+		return m_out.write(m_sums.data(), m_sums.size()*sizeof(uint32_t))
+			&& m_out.write(&trailer, sizeof(trailer));
+	}
+
+private:
+	IDataWriter& m_out;
+	size_t m_size = 0;
+	uint32_t m_crc = 0;
+	std::vector<uint32_t> m_sums;
+};
+
+template <typename Build>
+static BuildStatus WithChecksum(IDataWriter& out, const Build& build) {
+	ChecksumWriter wrapped(out);
+	auto status = build(wrapped);
+	if (status == BUILD_STATUS_OK && !wrapped.finish()) {
+		return BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
+	return status;
+}
+
 static size_t SumInputSize(const DataReaders& in) {
 	size_t total = 0;
 	for (auto& reader : in) {
@@ -67,12 +127,133 @@ static size_t SumInputSize(const DataReaders& in) {
 	return total;
 }
 
+static constexpr size_t TASK_SIZE = 1U << 16U;
+
+//slice all readers into tasks of fixed size, empty if any reader does not support it
+static DataReaders SliceInput(const DataReaders& in) {
+	DataReaders tasks;
+	for (auto& reader : in) {
+		const auto total = reader->total();
+		for (size_t off = 0; off < total; off += TASK_SIZE) {
+			auto task = reader->slice(off, std::min(off+TASK_SIZE, total));
+			if (task == nullptr) {
+				return {};
+			}
+			tasks.push_back(std::move(task));
+		}
+	}
+	return tasks;
+}
+
+//threads of pool take tasks from a shared index, so skewed readers do not leave threads idle,
+//fall back to one thread per reader when input can not be sliced
+template <typename Fn>
+static bool RunTasks(const DataReaders& in, const BuildOptions& options, const Fn& fn) {
+	auto sliced = SliceInput(in);
+	const bool pooled = !sliced.empty();
+	const auto& tasks = pooled? sliced : in;
+	size_t n = tasks.size();
+	if (pooled) {
+		n = std::min<size_t>(n, options.thread != 0? options.thread : std::max(std::thread::hardware_concurrency(), 1U));
+	}
+	size_t next = 0;
+	bool fail = false;
+	std::vector<std::thread> threads;
+	threads.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		threads.emplace_back([&tasks, &next, &fail, &fn, &options, pooled, i, n]() {
+			PinWorker(options, i, n);
+			size_t idx;
+			while (!LoadRelaxed(fail) && (idx = AddRelaxed(next, (size_t)1)) < tasks.size()) {
+				try {
+					if (!pooled) {
+						tasks[idx]->reset();
+					}
+					fn(*tasks[idx]);
+				} catch (const BuildException&) {
+					StoreRelease(fail, true);
+				}
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	return !fail;
+}
+
+//with PLACE_PARTITION, sets are cut into one part per node as InitTable placed their pages,
+//workers pinned to a node scan every task but insert only records whose home set is in its part,
+//so each node writes local memory at the cost of reading input once per node
+template <typename Fn>
+static bool RunRoutedTasks(const DataReaders& in, uint64_t set_cnt, const BuildOptions& options, const Fn& fn) {
+	const unsigned parts = PartitionCount(options);
+	if (parts < 2) {
+		return RunTasks(in, options, [set_cnt, &fn](IDataReader& reader) {
+			fn(reader, 0, set_cnt);
+		});
+	}
+	bool fail = false;
+	auto run = [&fail, &fn, set_cnt, parts](unsigned part, IDataReader& task) {
+		try {
+			auto range = PartRange(set_cnt, part, parts);
+			fn(task, range.first, range.second);
+		} catch (const BuildException&) {
+			StoreRelease(fail, true);
+		}
+	};
+	std::vector<std::thread> threads;
+	//readers keep their position, so every node needs its own slices
+	std::vector<DataReaders> tasks;
+	tasks.push_back(SliceInput(in));
+	if (!tasks[0].empty()) {
+		while (tasks.size() < parts) {
+			tasks.push_back(SliceInput(in));
+		}
+		//pool is shared out to nodes, at least one worker each, with one task counter per node
+		size_t n = options.thread != 0? options.thread : std::max(std::thread::hardware_concurrency(), 1U);
+		n = std::max<size_t>(n, parts);
+		std::vector<size_t> next(parts, 0);
+		threads.reserve(n);
+		for (size_t i = 0; i < n; i++) {
+			threads.emplace_back([&tasks, &next, &fail, &run, part=(unsigned)(i*parts/n)]() {
+				PinToNode(part);
+				auto& mine = tasks[part];
+				size_t idx;
+				while (!LoadRelaxed(fail) && (idx = AddRelaxed(next[part], (size_t)1)) < mine.size()) {
+					run(part, *mine[idx]);
+				}
+			});
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+		return !fail;
+	}
+	//readers that can not be sliced are read by each node in turn, one thread per reader
+	for (unsigned part = 0; part < parts && !fail; part++) {
+		threads.clear();
+		for (auto& reader : in) {
+			threads.emplace_back([&reader, &run, part]() {
+				PinToNode(part);
+				reader->reset();
+				run(part, *reader);
+			});
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+	return !fail;
+}
+
+using HashCode = std::tuple<uint64_t,uint8_t,uint8_t>;
 
 template <typename Fill>
 static FORCE_INLINE bool Mapping(uint8_t* guide, uint8_t* space, const Header& header,
-								 const Divisor<uint64_t>& set_cnt, const uint8_t* key, const Fill& fill) {
+								 const HashCode& code, const uint8_t* key, const Fill& fill) {
 	const unsigned line_size = header.key_len + (unsigned)header.val_len;
-	auto [set, mark, sft] = HashKey(key, header.key_len, header.seed, set_cnt);
+	auto [set, mark, sft] = code;
 	while (true) {
 		auto g = guide + (set<<6U);
 		for (unsigned j = sft; j < sft+64U; j++) {
@@ -92,46 +273,176 @@ static FORCE_INLINE bool Mapping(uint8_t* guide, uint8_t* space, const Header& h
 				return false;
 			}
 		}
-		if (++set >= set_cnt.value()) {
+		if (++set >= header.set_cnt) {
 			set = 0;
 		}
 	}
 }
 
-static NOINLINE size_t Mapping(uint8_t* guide, uint8_t* space, const Header& header, IDataReader& reader) {
-	Divisor<uint64_t> set_cnt(header.set_cnt);
+static constexpr unsigned READ_BATCH = 32;
+
+//in-range records of one chunk copied as lines, as records only stay valid until next read
+struct MappingStage {
+	unsigned cnt = 0;
+	HashCode codes[READ_BATCH];
+	uint8_t* lines = nullptr;
+};
+
+//records are consumed in chunks through two stages, chunk k+1 is read and its guide and first
+//probed lines are prefetched before chunk k is inserted, records whose home set is out of [lo,hi) are skipped
+static NOINLINE size_t Mapping(uint8_t* guide, uint8_t* space, const Header& header, IDataReader& reader,
+							   uint64_t lo=0, uint64_t hi=UINT64_MAX) {
+	const Divisor<uint64_t> set_cnt(header.set_cnt);
+	const unsigned line_size = header.key_len + (unsigned)header.val_len;
 	auto total = reader.total();
-	size_t cnt = total;
-	for (size_t i = 0; i < total; i++) {
-		auto rec = reader.read(false);
-		if (rec.key.ptr == nullptr || rec.key.len != header.key_len
-			|| (header.val_len != 0 && (rec.val.ptr == nullptr || rec.val.len != header.val_len))) {
+	auto buf = std::make_unique<uint8_t[]>(2*READ_BATCH*(size_t)line_size);
+	MappingStage stages[2];
+	stages[0].lines = buf.get();
+	stages[1].lines = buf.get() + READ_BATCH*line_size;
+	Record recs[READ_BATCH];
+	size_t i = 0;
+	auto load = [&](MappingStage& stage) {
+		stage.cnt = 0;
+		if (i >= total) {
+			return;
+		}
+		auto m = reader.read_batch(recs, std::min<size_t>(READ_BATCH, total-i), false);
+		if (m == 0 || m > READ_BATCH) {
 			throw BuildException();
 		}
-		if (!Mapping(guide, space, header, set_cnt, rec.key.ptr, [&rec, &header](uint8_t* line){
+		i += m;
+		for (unsigned j = 0; j < m; j++) {
+			auto& rec = recs[j];
+			if (rec.key.ptr == nullptr || rec.key.len != header.key_len
+				|| (header.val_len != 0 && (rec.val.ptr == nullptr || rec.val.len != header.val_len))) {
+				throw BuildException();
+			}
+			auto code = HashKey(rec.key.ptr, header.key_len, header.seed, set_cnt);
+			auto [set, mark, sft] = code;
+			if (set < lo || set >= hi) {
+				continue;
+			}
+			__builtin_prefetch(guide + (set<<6U) + sft, 1, 3);
+			__builtin_prefetch(space + ((set<<6U)+sft)*line_size, 1, 3);
+			auto line = stage.lines + stage.cnt*line_size;
 			Assign(line, rec.key.ptr, header.key_len);
 			if (header.val_len != 0) {
 				memcpy(line+header.key_len, rec.val.ptr, header.val_len);
 			}
-		})) cnt--;
+			stage.codes[stage.cnt++] = code;
+		}
+	};
+	size_t cnt = 0;
+	load(stages[0]);
+	for (unsigned k = 0; stages[k].cnt != 0 || i < total; k ^= 1U) {
+		load(stages[k^1U]);
+		auto& stage = stages[k];
+		for (unsigned j = 0; j < stage.cnt; j++) {
+			auto src = stage.lines + j*line_size;
+			if (Mapping(guide, space, header, stage.codes[j], src, [src, line_size](uint8_t* line){
+				memcpy(line, src, line_size);
+			})) cnt++;
+		}
 	}
 	return cnt;
 }
 
+//keys of BuildOptions::hot_keys by rank, with value of first record found in input
+struct HotRecords {
+	uint8_t key_len = 0;
+	std::unique_ptr<uint8_t[]> keys;
+	std::unordered_map<std::string_view, uint32_t> ranks;
+	std::vector<std::string> vals;
+	std::unique_ptr<uint8_t[]> found;
+};
+
+static std::unique_ptr<HotRecords> LoadHotKeys(IDataReader& reader, uint8_t key_len) {
+	auto hot = std::make_unique<HotRecords>();
+	reader.reset();
+	const auto total = reader.total();
+	hot->key_len = key_len;
+	hot->keys = std::make_unique<uint8_t[]>(total*key_len + 1);
+	hot->ranks.reserve(total);
+	for (size_t i = 0; i < total; i++) {
+		auto rec = reader.read(true);
+		if (rec.key.ptr == nullptr || rec.key.len != key_len) {
+			return nullptr;
+		}
+		auto key = hot->keys.get() + hot->ranks.size()*key_len;
+		memcpy(key, rec.key.ptr, key_len);
+		hot->ranks.emplace(std::string_view((const char*)key, key_len), hot->ranks.size());
+	}
+	hot->vals.resize(hot->ranks.size());
+	hot->found = std::make_unique<uint8_t[]>(hot->ranks.size() + 1);
+	memset(hot->found.get(), 0, hot->ranks.size());
+	return hot;
+}
+
+static FORCE_INLINE const uint32_t* FindHot(const HotRecords& hot, const uint8_t* key) {
+	auto it = hot.ranks.find(std::string_view((const char*)key, hot.key_len));
+	return it == hot.ranks.end()? nullptr : &it->second;
+}
+
+//keep values of hot keys in reader, return number of records with hot keys,
+//a hot key found twice is bad input, or racing readers would pick its value by chance
+static size_t CollectHot(IDataReader& reader, HotRecords& hot, bool key_only) {
+	Record recs[READ_BATCH];
+	size_t hit = 0;
+	auto total = reader.total();
+	for (size_t i = 0; i < total; ) {
+		auto m = reader.read_batch(recs, std::min<size_t>(READ_BATCH, total-i), key_only);
+		if (m == 0 || m > READ_BATCH) {
+			throw BuildException();
+		}
+		for (unsigned j = 0; j < m; j++) {
+			auto& rec = recs[j];
+			if (rec.key.ptr == nullptr || rec.key.len != hot.key_len) {
+				throw BuildException();
+			}
+			auto rank = FindHot(hot, rec.key.ptr);
+			if (rank == nullptr) {
+				continue;
+			}
+			hit++;
+			if (__atomic_exchange_n(&hot.found[*rank], 1, __ATOMIC_RELAXED) != 0) {
+				throw BuildException();
+			}
+			if (!key_only) {
+				if (rec.val.len != 0 && rec.val.ptr == nullptr) {
+					throw BuildException();
+				}
+				hot.vals[*rank].assign((const char*)rec.val.ptr, rec.val.len);
+			}
+		}
+		i += m;
+	}
+	return hit;
+}
+
 struct BasicInfo {
 	Hashtable::Type type;
 	uint8_t key_len;
 	uint16_t val_len;
 };
 
+//guide is filled with empty marks, space is touched first only when placement matters,
+//both are placed by sets, so a part of sets has its guide and lines on one node
+static void InitTable(const MemBlock& guide, const MemBlock& space, uint64_t set_cnt, const BuildOptions& options) {
+	ParallelFill(guide.addr(), 0xff, set_cnt, guide.size()/set_cnt, options);
+	if (options.placement != BuildOptions::PLACE_LOCAL) {
+		ParallelFill(space.addr(), 0, set_cnt, space.size()/set_cnt, options);
+	}
+}
+
 static size_t CalcSetCnt(size_t item) {
 	const auto reserved = (item+(RESERVE_FACTOR-1))/RESERVE_FACTOR;
 	return (((item+reserved+63U)/64U)&(~1ULL))+1U;
 }
 
-static BuildStatus BuildWithFixedSizeValue(const BasicInfo& info, const DataReaders& in, IDataWriter& out) {
+static BuildStatus BuildWithFixedSizeValue(const BasicInfo& info, const DataReaders& in, IDataWriter& out,
+										   const BuildOptions& options) {
 	auto total = SumInputSize(in);
-	Assert(!in.empty() && info.key_len != 0 && total != 0);
+	Assert(!in.empty() && info.key_len != 0);
 
 	Header header;
 	header.type = info.type;
@@ -141,31 +452,43 @@ static BuildStatus BuildWithFixedSizeValue(const BasicInfo& info, const DataRead
 	header.set_cnt = CalcSetCnt(total);
 	const auto slot = header.set_cnt << 6U;
 
-	ALLOC_MEM_BLOCK(guide, slot)
-	memset(guide.addr(), 0xff, slot);
-
 	const auto line_size = header.key_len + (uint32_t)header.val_len;
+	ALLOC_MEM_BLOCK(guide, slot)
 	ALLOC_MEM_BLOCK(space, slot*line_size);
+	InitTable(guide, space, header.set_cnt, options);
 
-	bool fail = false;
-	std::vector<std::thread> threads;
-	threads.reserve(in.size());
-
-	for (auto& reader : in) {
-		reader->reset();
-		threads.emplace_back([&fail, &guide, &space, &header](IDataReader* reader) {
-			try {
-				auto cnt = Mapping(guide.addr(), space.addr(), header, *reader);
-				AddRelaxed(header.item, cnt);
-			} catch (const BuildException&) {
-				fail = true;
+	if (options.hot_keys != nullptr) {
+		//hot keys are inserted first, their records are dropped as duplicates by mapping later
+		auto hot = LoadHotKeys(*options.hot_keys, header.key_len);
+		if (hot == nullptr || !RunTasks(in, options, [&hot, &header](IDataReader& reader) {
+			CollectHot(reader, *hot, header.val_len == 0);
+		})) {
+			return BUILD_STATUS_BAD_INPUT;
+		}
+		const Divisor<uint64_t> set_cnt(header.set_cnt);
+		auto key = hot->keys.get();
+		for (size_t i = 0; i < hot->vals.size(); i++, key += header.key_len) {
+			auto& val = hot->vals[i];
+			if (!hot->found[i]) {
+				continue;
 			}
-		}, reader.get());
-	}
-	for (auto& t : threads) {
-		t.join();
+			if (val.size() != header.val_len) {
+				return BUILD_STATUS_BAD_INPUT;
+			}
+			if (Mapping(guide.addr(), space.addr(), header, HashKey(key, header.key_len, header.seed, set_cnt), key,
+						[key, &val, &header](uint8_t* line) {
+							Assign(line, key, header.key_len);
+							memcpy(line+header.key_len, val.data(), header.val_len);
+						})) {
+				header.item++;
+			}
+		}
 	}
-	if (fail) {
+
+	if (!RunRoutedTasks(in, header.set_cnt, options, [&guide, &space, &header](IDataReader& reader, uint64_t lo, uint64_t hi) {
+		auto cnt = Mapping(guide.addr(), space.addr(), header, reader, lo, hi);
+		AddRelaxed(header.item, cnt);
+	})) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
 
@@ -176,10 +499,19 @@ static BuildStatus BuildWithFixedSizeValue(const BasicInfo& info, const DataRead
 	return BUILD_STATUS_OK;
 }
 
-static bool DetectKeyValueLen(IDataReader& reader, uint8_t* key_len, uint16_t* val_len) {
-	if (key_len == nullptr) {
+//first nonempty reader, or the front one if all are empty
+static IDataReader& FirstReader(const DataReaders& in) {
+	Assert(!in.empty());
+	auto it = std::find_if(in.begin(), in.end(), [](auto& r) { return r->total() != 0; });
+	return it != in.end()? **it : *in.front();
+}
+
+//first record of first nonempty reader
+static bool DetectKeyValueLen(const DataReaders& in, uint8_t* key_len, uint16_t* val_len) {
+	if (in.empty() || key_len == nullptr) {
 		return false;
 	}
+	auto& reader = FirstReader(in);
 	auto rec = reader.read(val_len == nullptr);
 	if (rec.key.ptr == nullptr || rec.key.len == 0 || rec.key.len > MAX_KEY_LEN) {
 		return false;
@@ -195,21 +527,25 @@ static bool DetectKeyValueLen(IDataReader& reader, uint8_t* key_len, uint16_t* v
 	return true;
 }
 
-BuildStatus BuildSet(const DataReaders& in, IDataWriter& out) {
+BuildStatus BuildSet(const DataReaders& in, IDataWriter& out, const BuildOptions& options) {
 	uint8_t key_len;
-	if (in.empty() || !(DetectKeyValueLen(*in.front(), &key_len, nullptr))) {
+	if (!DetectKeyValueLen(in, &key_len, nullptr)) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
-	return BuildWithFixedSizeValue( {Hashtable::KEY_SET, key_len, 0}, in, out);
+	return WithChecksum(out, [&](IDataWriter& w) {
+		return BuildWithFixedSizeValue({Hashtable::KEY_SET, key_len, 0}, in, w, options);
+	});
 }
 
-extern BuildStatus BuildDict(const DataReaders& in, IDataWriter& out) {
+extern BuildStatus BuildDict(const DataReaders& in, IDataWriter& out, const BuildOptions& options) {
 	uint8_t key_len;
 	uint16_t val_len;
-	if (in.empty() || !(DetectKeyValueLen(*in.front(), &key_len, &val_len))) {
+	if (!DetectKeyValueLen(in, &key_len, &val_len)) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
-	return BuildWithFixedSizeValue({Hashtable::KV_INLINE, key_len, val_len}, in, out);
+	return WithChecksum(out, [&](IDataWriter& w) {
+		return BuildWithFixedSizeValue({Hashtable::KV_INLINE, key_len, val_len}, in, w, options);
+	});
 }
 
 static unsigned VarIntSize(size_t n) {
@@ -220,21 +556,85 @@ static unsigned VarIntSize(size_t n) {
 	}
 	return cnt;
 }
-static bool WriteVarInt(size_t n, IDataWriter& out) {
-	uint8_t buf[10];
-	unsigned w = 0;
-	while ((n & ~0x7fULL) != 0) {
-		buf[w++] = 0x80ULL | (n & 0x7fULL);
-		n >>= 7U;
-	}
-	buf[w++] = n;
-	return out.write(buf, w);
+static FORCE_INLINE bool DumpVariedValue(const Slice& val, IDataWriter& out) {
+	return WriteVarInt(val.len, out) && (val.len == 0 || out.write(val.ptr, val.len));
 }
 
+//the record already taken from core is returned first
+class ReplayReader : public IDataReader {
+public:
+	ReplayReader(IDataReader& core, const Record& first) : m_core(core), m_first(first) {}
+
+	void reset() override {}	//never used
+	size_t total() override {
+		return m_core.total();
+	}
+	Record read(bool key_only) override {
+		if (m_replay) {
+			m_replay = false;
+			return m_first;
+		}
+		return m_core.read(key_only);
+	}
+	size_t read_batch(Record* out, size_t n, bool key_only) override {
+		if (m_replay) {
+			out[0] = read(key_only);
+			return 1;
+		}
+		return m_core.read_batch(out, n, key_only);
+	}
+
+private:
+	IDataReader& m_core;
+	const Record& m_first;
+	bool m_replay = true;
+};
+
+//records with hot keys are skipped, as they are handled ahead
+class SkipReader : public IDataReader {
+public:
+	SkipReader(IDataReader& core, const HotRecords& hot, size_t hit)
+		: m_core(core), m_hot(hot), m_total(core.total() - hit) {}
+
+	void reset() override {
+		m_core.reset();
+	}
+	size_t total() override {
+		return m_total;
+	}
+	Record read(bool key_only) override {
+		Record rec;
+		read_batch(&rec, 1, key_only);
+		return rec;
+	}
+	size_t read_batch(Record* out, size_t n, bool key_only) override {
+		size_t m = 0;
+		while (m == 0) {
+			auto k = m_core.read_batch(out, n, key_only);
+			if (k == 0 || k > n) {
+				return 0;
+			}
+			for (size_t i = 0; i < k; i++) {
+				if (out[i].key.ptr == nullptr || out[i].key.len != m_hot.key_len
+					|| FindHot(m_hot, out[i].key.ptr) == nullptr) {
+					out[m++] = out[i];
+				}
+			}
+		}
+		return m;
+	}
+
+private:
+	IDataReader& m_core;
+	const HotRecords& m_hot;
+	const size_t m_total;
+};
+
+//values are replaced by offset fields, and dumped to spill if given
 class KeyOffReader : public IDataReader {
 public:
-	explicit KeyOffReader(IDataReader& core, size_t off)
-		: m_core(core), m_base(off), m_offset(m_base) {}
+	explicit KeyOffReader(IDataReader& core, size_t off, IDataWriter* spill=nullptr)
+		: m_core(core), m_spill(spill), m_base(off), m_offset(m_base) {}
 
 	void reset() override {
 		m_core.reset();
@@ -245,33 +645,145 @@ public:
 	}
 	Record read(bool) override {
 		auto rec = m_core.read(false);
-		if (m_offset > MAX_OFFSET || rec.val.len > MAX_VALUE_LEN || (rec.val.len != 0 && rec.val.ptr == nullptr)) {
-			throw BuildException();
-		}
-		WriteOffsetField(m_field, m_offset);
-		m_offset += VarIntSize(rec.val.len) + rec.val.len;
-		rec.val.ptr = m_field;
-		rec.val.len = OFFSET_FIELD_SIZE;
+		replace(rec, m_fields[0]);
 		return rec;
 	}
+	size_t read_batch(Record* out, size_t n, bool) override {
+		n = m_core.read_batch(out, std::min<size_t>(n, READ_BATCH), false);
+		for (size_t i = 0; i < n; i++) {
+			replace(out[i], m_fields[i]);
+		}
+		return n;
+	}
 	size_t offset() const noexcept { return m_offset; }
+	bool fail_to_spill() const noexcept { return m_fail_to_spill; }
 
 private:
 	IDataReader& m_core;
+	IDataWriter* m_spill;
+	bool m_fail_to_spill = false;
 	const size_t m_base;
 	size_t m_offset;
-	uint8_t m_field[OFFSET_FIELD_SIZE];
+	uint8_t m_fields[READ_BATCH][OFFSET_FIELD_SIZE];
+
+	void replace(Record& rec, uint8_t* field) {
+		if (m_offset > MAX_OFFSET || rec.val.len > MAX_VALUE_LEN || (rec.val.len != 0 && rec.val.ptr == nullptr)) {
+			throw BuildException();
+		}
+		if (m_spill != nullptr && !DumpVariedValue(rec.val, *m_spill)) {
+			m_fail_to_spill = true;
+			throw BuildException();
+		}
+		WriteOffsetField(field, m_offset);
+		m_offset += VarIntSize(rec.val.len) + rec.val.len;
+		rec.val.ptr = field;
+		rec.val.len = OFFSET_FIELD_SIZE;
+	}
 };
 
-static FORCE_INLINE bool DumpVariedValue(const Slice& val, IDataWriter& out) {
-	return WriteVarInt(val.len, out) && (val.len == 0 || out.write(val.ptr, val.len));
+static bool CopyFile(int fd, IDataWriter& out) {
+	constexpr size_t BLOCK = 1U << 20U;
+	auto buf = std::make_unique<uint8_t[]>(BLOCK);
+	for (off_t off = 0; ; ) {
+		auto n = pread(fd, buf.get(), BLOCK, off);
+		if (n < 0) {
+			return false;
+		} else if (n == 0) {
+			return true;
+		}
+		if (!out.write(buf.get(), n)) {
+			return false;
+		}
+		off += n;
+	}
 }
 
-BuildStatus BuildDictWithVariedValue(const DataReaders& in, IDataWriter& out) {
-	Header header;
-	if (in.empty() || !(DetectKeyValueLen(*in.front(), &header.key_len, nullptr))) {
-		return BUILD_STATUS_BAD_INPUT;
+//rewrite offset fields to follow order of slots, return old and new offsets of values in old order
+static std::vector<std::pair<size_t,size_t>> ReorderExtend(const uint8_t* guide, uint8_t* space, const Header& header,
+														   size_t size) {
+	const auto slot = header.set_cnt << 6U;
+	const auto line_size = header.key_len + OFFSET_FIELD_SIZE;
+	auto field = [space, line_size, &header](size_t i) { return space + i*line_size + header.key_len; };
+	std::vector<std::pair<size_t,size_t>> moves;
+	moves.reserve(header.item);
+	for (size_t i = 0; i < slot; i++) {
+		if ((guide[i] & 0x80U) == 0) {
+			moves.emplace_back(ReadOffsetField(field(i)), i);
+		}
+	}
+	std::sort(moves.begin(), moves.end());
+	//fields hold lengths for a while
+	for (size_t k = 0; k < moves.size(); k++) {
+		auto end = k+1 < moves.size()? moves[k+1].first : size;
+		WriteOffsetField(field(moves[k].second), end - moves[k].first);
+	}
+	size_t offset = 0;
+	for (size_t i = 0; i < slot; i++) {
+		if ((guide[i] & 0x80U) == 0) {
+			auto len = ReadOffsetField(field(i));
+			WriteOffsetField(field(i), offset);
+			offset += len;
+		}
 	}
+	Assert(offset == size);
+	for (auto& m : moves) {
+		m.second = ReadOffsetField(field(m.second));
+	}
+	return moves;
+}
+
+//values dumped in old order are copied to their new places
+class PermuteWriter : public IDataWriter {
+public:
+	PermuteWriter(std::vector<std::pair<size_t,size_t>>&& moves, size_t size)
+		: m_moves(std::move(moves)), m_buf(size) {}
+
+	bool operator!() const noexcept override { return !m_buf; }
+	bool flush() noexcept override { return true; }
+	bool write(const void* data, size_t n) noexcept override {
+		auto src = (const uint8_t*)data;
+		while (n != 0) {
+			if (m_idx >= m_moves.size()) {
+				return false;
+			}
+			auto& m = m_moves[m_idx];
+			auto end = m_idx+1 < m_moves.size()? m_moves[m_idx+1].first : m_buf.size();
+			auto len = std::min(n, end - m_pos);
+			memcpy(m_buf.addr() + m.second + (m_pos - m.first), src, len);
+			src += len;
+			n -= len;
+			m_pos += len;
+			if (m_pos == end) {
+				m_idx++;
+			}
+		}
+		return true;
+	}
+	const MemBlock& data() const noexcept { return m_buf; }
+
+private:
+	const std::vector<std::pair<size_t,size_t>> m_moves;
+	MemBlock m_buf;
+	size_t m_idx = 0;
+	size_t m_pos = 0;
+};
+
+static std::unique_ptr<PermuteWriter> SlotOrderedExtend(const MemBlock& guide, MemBlock& space, Header& header,
+														size_t size) {
+	auto out = std::make_unique<PermuteWriter>(ReorderExtend(guide.addr(), space.addr(), header, size), size);
+	if (!*out) {
+		throw std::bad_alloc();
+	}
+	header.flags |= FLAG_SLOT_ORDERED;
+	return out;
+}
+
+//a copy of first record of FirstReader is given in spill mode, where readers are not reset
+static BuildStatus BuildWithVariedValue(uint8_t key_len, const DataReaders& in, IDataWriter& out,
+										const BuildOptions& options, const Record* first=nullptr) {
+	Assert(!in.empty() && key_len != 0);
+	Header header;
+	header.key_len = key_len;
 	header.type = Hashtable::KV_SEPARATED;
 	header.val_len = OFFSET_FIELD_SIZE;
 	header.seed = GetSeed();
@@ -280,26 +792,85 @@ BuildStatus BuildDictWithVariedValue(const DataReaders& in, IDataWriter& out) {
 	header.set_cnt = CalcSetCnt(total);
 	const auto slot = header.set_cnt << 6U;
 
-	ALLOC_MEM_BLOCK(guide, slot)
-	memset(guide.addr(), 0xff, slot);
-
 	const auto line_size = header.key_len + OFFSET_FIELD_SIZE;
+	ALLOC_MEM_BLOCK(guide, slot)
 	ALLOC_MEM_BLOCK(space, slot*line_size);
+	InitTable(guide, space, header.set_cnt, options);
 
+	FileWriter spill;
+	if (first != nullptr) {
+		spill = FileWriter::Temporary(options.spill_dir);
+		if (!spill) {
+			return BUILD_STATUS_FAIL_TO_OUTPUT;
+		}
+	}
 	size_t offset = 0;
-	for (auto& reader : in) {
-		reader->reset();
-		KeyOffReader wrapped_reader(*reader, offset);
+	std::unique_ptr<HotRecords> hot;
+	std::vector<size_t> hits(in.size(), 0);
+	if (options.hot_keys != nullptr) {
+		//values of hot keys are placed ahead in rank order, records of them are skipped later,
+		//duplicates are rejected here as they would be by mapping
+		hot = LoadHotKeys(*options.hot_keys, key_len);
+		if (hot == nullptr) {
+			return BUILD_STATUS_BAD_INPUT;
+		}
+		for (unsigned i = 0; i < in.size(); i++) {
+			in[i]->reset();
+			try {
+				hits[i] = CollectHot(*in[i], *hot, false);
+			} catch (const BuildException&) {
+				return BUILD_STATUS_BAD_INPUT;
+			}
+		}
+		const Divisor<uint64_t> set_cnt(header.set_cnt);
+		auto key = hot->keys.get();
+		for (size_t i = 0; i < hot->vals.size(); i++, key += key_len) {
+			auto& val = hot->vals[i];
+			if (!hot->found[i]) {
+				continue;
+			}
+			if (val.size() > MAX_VALUE_LEN || offset > MAX_OFFSET) {
+				return BUILD_STATUS_BAD_INPUT;
+			}
+			if (Mapping(guide.addr(), space.addr(), header, HashKey(key, key_len, header.seed, set_cnt), key,
+						[key, key_len, offset](uint8_t* line) {
+							Assign(line, key, key_len);
+							WriteOffsetField(line+key_len, offset);
+						})) {
+				header.item++;
+			}
+			offset += VarIntSize(val.size()) + val.size();
+		}
+	}
+	for (unsigned i = 0; i < in.size(); i++) {
+		auto& reader = in[i];
+		std::unique_ptr<IDataReader> wrapper;
+		IDataReader* src = reader.get();
+		if (first == nullptr) {
+			reader->reset();
+			if (hot != nullptr) {
+				wrapper = std::make_unique<SkipReader>(*reader, *hot, hits[i]);
+				src = wrapper.get();
+			}
+		} else if (reader.get() == &FirstReader(in)) {
+			wrapper = std::make_unique<ReplayReader>(*reader, *first);
+			src = wrapper.get();
+		}
+		KeyOffReader wrapped_reader(*src, offset, first != nullptr? &spill : nullptr);
 		try {
 			header.item += Mapping(guide.addr(), space.addr(), header, wrapped_reader);
 		} catch (const BuildException&) {
-			return BUILD_STATUS_BAD_INPUT;
+			return wrapped_reader.fail_to_spill()? BUILD_STATUS_FAIL_TO_OUTPUT : BUILD_STATUS_BAD_INPUT;
 		}
 		offset = wrapped_reader.offset();
 	}
-	if (header.item != total) {
+	if (header.item != total || offset > MAX_OFFSET) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
+	std::unique_ptr<PermuteWriter> permute;
+	if (options.slot_order) {
+		permute = SlotOrderedExtend(guide, space, header, offset);
+	}
 	if (!out.write(&header, sizeof(header))
 		|| !out.write(guide.addr(), guide.size())
 		|| !out.write(space.addr(), space.size())
@@ -308,58 +879,126 @@ BuildStatus BuildDictWithVariedValue(const DataReaders& in, IDataWriter& out) {
 	guide = MemBlock{};
 	space = MemBlock{};
 
-	for (auto& reader : in) {
-		reader->reset();
+	if (first != nullptr) {
+		return spill.flush() && CopyFile(spill.fd(), out)? BUILD_STATUS_OK : BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
+	IDataWriter& vout = permute != nullptr? *permute : out;
+	if (hot != nullptr) {
+		for (size_t i = 0; i < hot->vals.size(); i++) {
+			auto& val = hot->vals[i];
+			if (hot->found[i] && !DumpVariedValue({(const uint8_t*)val.data(), val.size()}, vout)) {
+				return BUILD_STATUS_FAIL_TO_OUTPUT;
+			}
+		}
+	}
+	for (unsigned j = 0; j < in.size(); j++) {
+		in[j]->reset();
+		std::unique_ptr<SkipReader> skip;
+		IDataReader* reader = in[j].get();
+		if (hot != nullptr) {
+			skip = std::make_unique<SkipReader>(*reader, *hot, hits[j]);
+			reader = skip.get();
+		}
 		auto cnt = reader->total();
 		for (size_t i = 0; i < cnt; i++) {
-			if (!DumpVariedValue(reader->read(false).val, out)) {
+			if (!DumpVariedValue(reader->read(false).val, vout)) {
 				return BUILD_STATUS_FAIL_TO_OUTPUT;
 			}
 		}
 	}
+	if (permute != nullptr && !out.write(permute->data().addr(), permute->data().size())) {
+		return BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
 	return BUILD_STATUS_OK;
 }
 
+BuildStatus BuildDictWithVariedValue(const DataReaders& in, IDataWriter& out, const BuildOptions& options) {
+	if (options.spill_dir != nullptr) {
+		//both need readers to be read again
+		if (options.hot_keys != nullptr || options.slot_order) {
+			return BUILD_STATUS_BAD_INPUT;
+		}
+		//take the first record without reset, keep a copy for replay
+		if (in.empty() || FirstReader(in).total() == 0) {
+			return BUILD_STATUS_BAD_INPUT;
+		}
+		auto rec = FirstReader(in).read(false);
+		if (rec.key.ptr == nullptr || rec.key.len == 0 || rec.key.len > MAX_KEY_LEN
+			|| (rec.val.len != 0 && rec.val.ptr == nullptr)) {
+			return BUILD_STATUS_BAD_INPUT;
+		}
+		std::string key((const char*)rec.key.ptr, rec.key.len);
+		std::string val;
+		if (rec.val.len != 0) {
+			val.assign((const char*)rec.val.ptr, rec.val.len);
+		}
+		Record first;
+		first.key = {(const uint8_t*)key.data(), key.size()};
+		first.val = {(const uint8_t*)val.data(), val.size()};
+		return WithChecksum(out, [&](IDataWriter& w) {
+			return BuildWithVariedValue(key.size(), in, w, options, &first);
+		});
+	}
+	uint8_t key_len;
+	if (!DetectKeyValueLen(in, &key_len, nullptr)) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	return WithChecksum(out, [&](IDataWriter& w) {
+		return BuildWithVariedValue(key_len, in, w, options);
+	});
+}
+
 
-static size_t CountHit(const Hashtable::View& base, IDataReader& reader) {
+//keys are copied in chunks for pipelined lookup, base slots hit are marked in bitmap
+static size_t CountHit(const Hashtable::View& base, IDataReader& reader, uint8_t* hits) {
+	constexpr unsigned BATCH = 256;
+	const unsigned key_len = base.key_len;
+	auto keys = std::make_unique<uint8_t[]>(BATCH*key_len);
 	size_t hit = 0;
+	unsigned n = 0;
 	auto total = reader.total();
-	for (size_t i = 0; i < total; i++) {
-		auto key = reader.read(true).key;
-		if (key.ptr == nullptr || key.len != base.key_len) {
+	Record recs[READ_BATCH];
+	for (size_t i = 0; i < total; ) {
+		auto m = reader.read_batch(recs, std::min<size_t>(READ_BATCH, total-i), true);
+		if (m == 0 || m > READ_BATCH) {
 			throw BuildException();
 		}
-		if (Search(base, key.ptr) != nullptr) {
-			hit++;
+		for (unsigned j = 0; j < m; j++) {
+			auto& key = recs[j].key;
+			if (key.ptr == nullptr || key.len != key_len) {
+				throw BuildException();
+			}
+			Assign(keys.get()+n*key_len, key.ptr, key_len);
+			if (++n == BATCH) {
+				hit += MarkHitSlots(base, n, keys.get(), hits);
+				n = 0;
+			}
 		}
+		i += m;
 	}
+	hit += MarkHitSlots(base, n, keys.get(), hits);
 	reader.reset();
 	return hit;
 }
 
-static BuildStatus RebuildWithFixedSizeValue(const Hashtable::View& base, const DataReaders& in, IDataWriter& out) {
-	Assert(!in.empty() && (base.type == Hashtable::KEY_SET || base.type == Hashtable::KV_INLINE));
-	std::vector<std::thread> threads;
-	threads.reserve(in.size());
+//parallel hit counting, return false if any input is bad
+static bool CountHit(const Hashtable::View& base, const DataReaders& in, const BuildOptions& options,
+					 uint8_t* hits, size_t& dirty) {
+	dirty = 0;
+	return RunTasks(in, options, [&base, hits, &dirty](IDataReader& reader) {
+		auto hit = CountHit(base, reader, hits);
+		AddRelaxed(dirty, hit);
+	});
+}
 
-	bool fail = false;
+static BuildStatus RebuildWithFixedSizeValue(const Hashtable::View& base, const DataReaders& in, IDataWriter& out,
+											 const BuildOptions& options) {
+	Assert(!in.empty() && (base.type == Hashtable::KEY_SET || base.type == Hashtable::KV_INLINE));
+	const auto base_slot = base.set_cnt.value() << 6U;
+	ALLOC_MEM_BLOCK(hits, (base_slot+7U)/8U)
+	memset(hits.addr(), 0, hits.size());
 	size_t dirty = 0;
-	for (auto& reader : in) {
-		reader->reset();
-		threads.emplace_back([&base, &fail, &dirty](IDataReader* reader){
-			try {
-				auto hit = CountHit(base, *reader);
-				AddRelaxed(dirty, hit);
-			} catch (const BuildException&) {
-				fail = true;
-				return;
-			}
-		}, reader.get());
-	}
-	for (auto& t : threads) {
-		t.join();
-	}
-	if (fail) {
+	if (!CountHit(base, in, options, hits.addr(), dirty)) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
 
@@ -375,50 +1014,33 @@ static BuildStatus RebuildWithFixedSizeValue(const Hashtable::View& base, const
 	const auto slot = header.set_cnt << 6U;
 
 	ALLOC_MEM_BLOCK(guide, slot)
-	memset(guide.addr(), 0xff, slot);
 	ALLOC_MEM_BLOCK(space, slot*base.line_size);
+	InitTable(guide, space, header.set_cnt, options);
 
-	threads.clear();
-	fail = false;
-	for (auto& reader : in) {
-		threads.emplace_back([&fail, &guide, &space, &header](IDataReader* reader){
-			size_t cnt = 0;
-			try {
-				cnt = Mapping(guide.addr(), space.addr(), header, *reader);
-			} catch (const BuildException&) {
-				fail = true;
-				return;
-			}
-			AddRelaxed(header.item, cnt);
-		}, reader.get());
-	}
-	for (auto& t : threads) {
-		t.join();
-	}
-	if (fail) {
+	if (!RunRoutedTasks(in, header.set_cnt, options, [&guide, &space, &header](IDataReader& reader, uint64_t lo, uint64_t hi) {
+		auto cnt = Mapping(guide.addr(), space.addr(), header, reader, lo, hi);
+		AddRelaxed(header.item, cnt);
+	})) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
 
-	threads.clear();
-	const auto piece = (base.set_cnt.value()<<6U) / in.size();
-	const auto remain = (base.set_cnt.value()<<6U) % in.size();
-	size_t off = 0;
-	for (unsigned i = 0; i < in.size(); i++) {
-		size_t begin = off;
-		off += i<remain ? piece+1 : piece;
-		threads.emplace_back([&base, &guide, &space, &header](size_t begin, size_t end){
+	const auto ranges = SplitSlots(base.set_cnt.value());
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < ranges.size(); i++) {
+		threads.emplace_back([&base, &guide, &space, &header, &hits, &options, &ranges, i](size_t begin, size_t end){
+			PinWorker(options, i, ranges.size());
 			size_t cnt = 0;
 			Divisor<uint64_t> set_cnt(header.set_cnt);
 			auto line = base.content + begin*base.line_size;
 			for (size_t i = begin; i < end; i++) {
-				if ((base.guide[i] & 0x80U) == 0
-					&& Mapping(guide.addr(), space.addr(), header, set_cnt, line, [line, &base](uint8_t* out){
+				if ((base.guide[i] & 0x80U) == 0 && !TestBit(hits.addr(), i)
+					&& Mapping(guide.addr(), space.addr(), header, HashKey(line, header.key_len, header.seed, set_cnt), line, [line, &base](uint8_t* out){
 					memcpy(out, line, base.line_size);
 				})) cnt++;
 				line += base.line_size;
 			}
 			AddRelaxed(header.item, cnt);
-		}, begin, off);
+		}, ranges[i].first, ranges[i].second);
 	}
 	for (auto& t : threads) {
 		t.join();
@@ -431,17 +1053,41 @@ static BuildStatus RebuildWithFixedSizeValue(const Hashtable::View& base, const
 	return BUILD_STATUS_OK;
 }
 
-static BuildStatus RebuildDictWithVariedValue(const Hashtable::View& base, const DataReaders& in, IDataWriter& out) {
+//values of slot-ordered table are fetched ahead by windows while slots are scanned in order
+class ExtendReadahead {
+public:
+	explicit ExtendReadahead(const Hashtable::View& view) noexcept : m_view(view) {}
+
+	void touch(size_t offset) noexcept {
+		if (!m_view.slot_ordered || offset < m_next) {
+			return;
+		}
+		static const uintptr_t page = sysconf(_SC_PAGESIZE);
+		auto begin = (uintptr_t)(m_view.extend + offset) & ~(page-1U);
+		auto end = std::min((uintptr_t)m_view.space_end, begin + WINDOW);
+		if (begin < end) {
+			madvise((void*)begin, end - begin, MADV_WILLNEED);
+		}
+		m_next = offset + WINDOW/2;
+	}
+	void reset() noexcept { m_next = 0; }
+
+private:
+	static constexpr size_t WINDOW = 2U << 20U;
+	const Hashtable::View& m_view;
+	size_t m_next = 0;
+};
+
+static BuildStatus RebuildDictWithVariedValue(const Hashtable::View& base, const DataReaders& in, IDataWriter& out,
+											  const BuildOptions& options) {
 	Assert(!in.empty() && (base.type == Hashtable::KV_SEPARATED));
 
+	const auto base_slot = base.set_cnt.value() << 6U;
+	ALLOC_MEM_BLOCK(hits, (base_slot+7U)/8U)
+	memset(hits.addr(), 0, hits.size());
 	size_t dirty = 0;
-	for (auto& reader : in) {
-		reader->reset();
-		try {
-			dirty += CountHit(base, *reader);
-		} catch (const BuildException&) {
-			return BUILD_STATUS_BAD_INPUT;
-		}
+	if (!CountHit(base, in, options, hits.addr(), dirty)) {
+		return BUILD_STATUS_BAD_INPUT;
 	}
 
 	Assert(dirty <= base.item);
@@ -457,8 +1103,8 @@ static BuildStatus RebuildDictWithVariedValue(const Hashtable::View& base, const
 	const auto slot = header.set_cnt << 6U;
 
 	ALLOC_MEM_BLOCK(guide, slot)
-	memset(guide.addr(), 0xff, slot);
 	ALLOC_MEM_BLOCK(space, slot*base.line_size);
+	InitTable(guide, space, header.set_cnt, options);
 
 	size_t offset = 0;
 	for (auto& reader : in) {
@@ -475,15 +1121,15 @@ static BuildStatus RebuildDictWithVariedValue(const Hashtable::View& base, const
 	}
 
 	const Divisor<uint64_t> set_cnt(header.set_cnt);
-	const auto base_slot = base.set_cnt.value() << 6U;
-	ALLOC_MEM_BLOCK(mem, (base_slot+7U)/8U)
-	memset(mem.addr(), 0, mem.size());
-	auto bitmap = mem.addr();
+	//slots hit by input are not needed, reuse the bitmap to mark slots kept
+	auto bitmap = hits.addr();
 
 	auto line = base.content;
 	for (size_t i = 0; i < base_slot; i++) {
-		if ((base.guide[i] & 0x80U) == 0
-			&& Mapping(guide.addr(), space.addr(), header, set_cnt, line,
+		if (TestBit(bitmap, i)) {
+			ClearBit(bitmap, i);
+		} else if ((base.guide[i] & 0x80U) == 0
+			&& Mapping(guide.addr(), space.addr(), header, HashKey(line, header.key_len, header.seed, set_cnt), line,
 					   [line, &base, &offset](uint8_t* out) {
 						   Assign(out, line, base.key_len);
 						   auto val = SeparatedValue(base.extend+ReadOffsetField(line+base.key_len), base.space_end);
@@ -497,6 +1143,13 @@ static BuildStatus RebuildDictWithVariedValue(const Hashtable::View& base, const
 		}
 		line += base.line_size;
 	}
+	if (offset > MAX_OFFSET) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	std::unique_ptr<PermuteWriter> permute;
+	if (options.slot_order) {
+		permute = SlotOrderedExtend(guide, space, header, offset);
+	}
 
 	if (!out.write(&header, sizeof(header))
 		|| !out.write(guide.addr(), guide.size())
@@ -506,39 +1159,213 @@ static BuildStatus RebuildDictWithVariedValue(const Hashtable::View& base, const
 	guide = MemBlock{};
 	space = MemBlock{};
 
+	IDataWriter& vout = permute != nullptr? *permute : out;
 	for (auto& reader : in) {
 		reader->reset();
 		auto cnt = reader->total();
 		for (size_t i = 0; i < cnt; i++) {
-			if (!DumpVariedValue(reader->read(false).val, out)) {
+			if (!DumpVariedValue(reader->read(false).val, vout)) {
 				return BUILD_STATUS_FAIL_TO_OUTPUT;
 			}
 		}
 	}
+	ExtendReadahead ahead(base);
 	auto field = base.content + base.key_len;
 	for (size_t i = 0; i < base_slot; i++) {
-		if (TestBit(bitmap, i)
-			&& !DumpVariedValue(SeparatedValue(base.extend+ReadOffsetField(field), base.space_end), out)) {
-			return BUILD_STATUS_FAIL_TO_OUTPUT;
+		if (TestBit(bitmap, i)) {
+			auto off = ReadOffsetField(field);
+			ahead.touch(off);
+			if (!DumpVariedValue(SeparatedValue(base.extend+off, base.space_end), vout)) {
+				return BUILD_STATUS_FAIL_TO_OUTPUT;
+			}
 		}
 		field += base.line_size;
 	}
+	if (permute != nullptr && !out.write(permute->data().addr(), permute->data().size())) {
+		return BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
 	return BUILD_STATUS_OK;
 }
 
-BuildStatus Hashtable::derive(const DataReaders& in, IDataWriter& out) const {
-	if (!*this || in.empty()) {
+BuildStatus Hashtable::derive(const DataReaders& in, IDataWriter& out, const BuildOptions& options) const {
+	if (!*this || m_tier != nullptr || in.empty()) {
 		return BUILD_STATUS_BAD_INPUT;
 	}
 	switch (m_view.type) {
 		case Hashtable::KEY_SET:
 		case Hashtable::KV_INLINE:
-			return RebuildWithFixedSizeValue(m_view, in, out);
+			return WithChecksum(out, [&](IDataWriter& w) {
+				return RebuildWithFixedSizeValue(m_view, in, w, options);
+			});
 		case Hashtable::KV_SEPARATED:
-			return RebuildDictWithVariedValue(m_view, in, out);
+			return WithChecksum(out, [&](IDataWriter& w) {
+				return RebuildDictWithVariedValue(m_view, in, w, options);
+			});
 		default:
 			return BUILD_STATUS_BAD_INPUT;
 	}
 }
 
+
+static Slice ValueInSlot(const Hashtable::View& view, const uint8_t* line) {
+	auto field = line + view.key_len;
+	switch (view.type) {
+		case Hashtable::KV_INLINE:
+			return {field, view.val_len};
+		case Hashtable::KV_SEPARATED:
+			return SeparatedValue(view.extend+ReadOffsetField(field), view.space_end);
+		default:
+			return {};
+	}
+}
+
+//iterate over marked slots in range
+class SlotReader : public IDataReader {
+public:
+	SlotReader(const Hashtable::View& view, const uint8_t* bitmap, size_t begin, size_t end)
+		: m_view(view), m_bitmap(bitmap), m_begin(begin), m_end(end), m_pos(begin), m_ahead(view) {
+		for (size_t i = begin; i < end; i++) {
+			if (TestBit(bitmap, i)) m_total++;
+		}
+	}
+
+	void reset() override {
+		m_pos = m_begin;
+		m_ahead.reset();
+	}
+	size_t total() override {
+		return m_total;
+	}
+	Record read(bool key_only) override {
+		while (m_pos < m_end && !TestBit(m_bitmap, m_pos)) {
+			m_pos++;
+		}
+		if (m_pos >= m_end) {
+			return {};
+		}
+		auto line = m_view.content + (m_pos++)*m_view.line_size;
+		Record rec;
+		rec.key = {line, m_view.key_len};
+		if (!key_only) {
+			if (m_view.type == Hashtable::KV_SEPARATED) {
+				m_ahead.touch(ReadOffsetField(line+m_view.key_len));
+			}
+			rec.val = ValueInSlot(m_view, line);
+		}
+		return rec;
+	}
+	//records point into table
+	size_t read_batch(Record* out, size_t n, bool key_only) override {
+		for (size_t i = 0; i < n; i++) {
+			out[i] = read(key_only);
+		}
+		return n;
+	}
+
+private:
+	const Hashtable::View& m_view;
+	const uint8_t* m_bitmap;
+	const size_t m_begin;
+	const size_t m_end;
+	size_t m_pos;
+	size_t m_total = 0;
+	ExtendReadahead m_ahead;
+};
+
+std::vector<std::pair<size_t,size_t>> SplitSlots(size_t set_cnt) {
+	size_t n = std::max(std::thread::hardware_concurrency(), 1U);
+	n = std::min(n, set_cnt);
+	const auto piece = set_cnt / n;
+	const auto remain = set_cnt % n;
+	std::vector<std::pair<size_t,size_t>> out;
+	out.reserve(n);
+	size_t off = 0;
+	for (unsigned i = 0; i < n; i++) {
+		size_t begin = off;
+		off += i<remain ? piece+1 : piece;
+		out.emplace_back(begin<<6U, off<<6U);
+	}
+	return out;
+}
+
+//mark occupied slots of a whose key is missing in b, or (if check_val) whose value differs
+static MemBlock MarkDifferent(const Hashtable::View& a, const Hashtable::View& b, bool check_val) {
+	const auto slot = a.set_cnt.value() << 6U;
+	ALLOC_MEM_BLOCK(bitmap, (slot+7U)/8U)
+	memset(bitmap.addr(), 0, bitmap.size());
+
+	std::vector<std::thread> threads;
+	for (auto& range : SplitSlots(a.set_cnt.value())) {
+		threads.emplace_back([&a, &b, check_val, &bitmap](size_t begin, size_t end){
+			auto line = a.content + begin*a.line_size;
+			for (size_t i = begin; i < end; i++, line += a.line_size) {
+				if (a.guide[i] & 0x80U) {
+					continue;
+				}
+				auto field = Search(b, line);
+				if (field == nullptr) {
+					SetBit(bitmap.addr(), i);
+				} else if (check_val) {
+					auto u = ValueInSlot(a, line);
+					auto v = ValueInSlot(b, field-b.key_len);
+					if (u.len != v.len || memcmp(u.ptr, v.ptr, u.len) != 0) {
+						SetBit(bitmap.addr(), i);
+					}
+				}
+			}
+		}, range.first, range.second);
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	return bitmap;
+}
+
+static BuildStatus DiffViews(const Hashtable::View& a, const Hashtable::View& b, IDataWriter& out,
+							 IDataWriter* tombstone) {
+	if (tombstone != nullptr) {
+		auto gone = MarkDifferent(a, b, false);
+		const auto slot = a.set_cnt.value() << 6U;
+		auto line = a.content;
+		for (size_t i = 0; i < slot; i++, line += a.line_size) {
+			if (TestBit(gone.addr(), i) && !tombstone->write(line, a.key_len)) {
+				return BUILD_STATUS_FAIL_TO_OUTPUT;
+			}
+		}
+		if (!tombstone->flush()) {
+			return BUILD_STATUS_FAIL_TO_OUTPUT;
+		}
+	}
+
+	auto dirty = MarkDifferent(b, a, b.type != Hashtable::KEY_SET);
+	DataReaders in;
+	for (auto& range : SplitSlots(b.set_cnt.value())) {
+		in.push_back(std::make_unique<SlotReader>(b, dirty.addr(), range.first, range.second));
+	}
+	return WithChecksum(out, [&](IDataWriter& w) {
+		if (b.type == Hashtable::KV_SEPARATED) {
+			return BuildWithVariedValue(b.key_len, in, w, {});
+		}
+		return BuildWithFixedSizeValue({b.type, b.key_len, b.val_len}, in, w, {});
+	});
+}
+
+//bitmaps and the patch table are allocated on the way, running out of memory fails like writing does
+BuildStatus Diff(const Hashtable& old, const Hashtable& neo, IDataWriter& out, IDataWriter* tombstone) {
+	if (!old || !neo || old.m_tier != nullptr || neo.m_tier != nullptr) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	auto& a = old.m_view;
+	auto& b = neo.m_view;
+	if (a.type != b.type || a.key_len != b.key_len || a.val_len != b.val_len) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	try {
+		return DiffViews(a, b, out, tombstone);
+	} catch (const std::bad_alloc&) {
+		Logger::Printf("fail to allocate memory for diff\n");
+		return BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
+}
+
 } //ssht
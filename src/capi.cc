@@ -0,0 +1,243 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <algorithm>
+#include <new>
+#include <thread>
+#include "ssht.h"
+#include "ssht_c.h"
+
+using namespace ssht;
+
+static_assert(SSHT_MAP_ONLY == (int)Hashtable::MAP_ONLY && SSHT_MAP_FETCH == (int)Hashtable::MAP_FETCH
+	&& SSHT_MAP_OCCUPY == (int)Hashtable::MAP_OCCUPY && SSHT_COPY_DATA == (int)Hashtable::COPY_DATA
+	&& SSHT_TIERED == (int)Hashtable::TIERED, "");
+static_assert(SSHT_KEY_SET == (int)Hashtable::KEY_SET && SSHT_KV_INLINE == (int)Hashtable::KV_INLINE
+	&& SSHT_KV_SEPARATED == (int)Hashtable::KV_SEPARATED, "");
+static_assert(SSHT_BUILD_OK == (int)BUILD_STATUS_OK && SSHT_BUILD_BAD_INPUT == (int)BUILD_STATUS_BAD_INPUT
+	&& SSHT_BUILD_FAIL_TO_OUTPUT == (int)BUILD_STATUS_FAIL_TO_OUTPUT, "");
+
+static inline const Hashtable* Cast(const ssht_table* table) noexcept {
+	return reinterpret_cast<const Hashtable*>(table);
+}
+
+ssht_table* ssht_open(const char* path, int policy) {
+	if (path == nullptr || policy < Hashtable::MAP_ONLY || policy > Hashtable::TIERED) {
+		return nullptr;
+	}
+	auto table = new(std::nothrow) Hashtable(path, (Hashtable::LoadPolicy)policy);
+	if (table != nullptr && !*table) {
+		delete table;
+		return nullptr;
+	}
+	return reinterpret_cast<ssht_table*>(table);
+}
+
+void ssht_close(ssht_table* table) {
+	delete reinterpret_cast<Hashtable*>(table);
+}
+
+int ssht_type(const ssht_table* table) {
+	return Cast(table)->type();
+}
+
+uint8_t ssht_key_len(const ssht_table* table) {
+	return Cast(table)->key_len();
+}
+
+uint16_t ssht_val_len(const ssht_table* table) {
+	return Cast(table)->val_len();
+}
+
+uint64_t ssht_item(const ssht_table* table) {
+	return Cast(table)->item();
+}
+
+const uint8_t* ssht_search(const ssht_table* table, const uint8_t* key, size_t* val_len) {
+	auto val = Cast(table)->search(key);
+	if (val_len != nullptr) {
+		*val_len = val.len;
+	}
+	return val.ptr;
+}
+
+unsigned ssht_batch_search(const ssht_table* table, unsigned batch, const uint8_t* const keys[],
+						   const uint8_t* out[], const ssht_table* patch) {
+	return Cast(table)->batch_search(batch, keys, out, Cast(patch));
+}
+
+unsigned ssht_batch_fetch(const ssht_table* table, unsigned batch, const uint8_t* keys, uint8_t* data,
+						  const uint8_t* dft_val, const ssht_table* patch) {
+	return Cast(table)->batch_fetch(batch, keys, data, dft_val, Cast(patch));
+}
+
+namespace {
+
+class CallbackReader : public IDataReader {
+public:
+	explicit CallbackReader(const ssht_reader& core) : m_core(core) {}
+	void reset() override {
+		m_core.reset(m_core.ctx);
+	}
+	size_t total() override {
+		return m_core.total(m_core.ctx);
+	}
+	Record read(bool key_only) override {
+		ssht_record rec = {nullptr, 0, nullptr, 0};
+		m_core.read(m_core.ctx, key_only, &rec);
+		return {{rec.key, rec.key_len}, {rec.val, rec.val_len}};
+	}
+private:
+	const ssht_reader& m_core;
+};
+
+class ArrayReader : public IDataReader {
+public:
+	ArrayReader(const ssht_array& core, size_t begin, size_t end)
+		: m_core(core), m_begin(begin), m_end(end), m_current(begin) {}
+	void reset() override {
+		m_current = m_begin;
+	}
+	size_t total() override {
+		return m_end - m_begin;
+	}
+	Record read(bool key_only) override {
+		Record rec;
+		rec.key = {m_core.keys + m_current*m_core.key_len, m_core.key_len};
+		if (!key_only && m_core.vals != nullptr) {
+			if (m_core.offsets != nullptr) {
+				auto off = m_core.offsets[m_current];
+				rec.val = {m_core.vals + off, m_core.offsets[m_current+1] - off};
+			} else {
+				rec.val = {m_core.vals + m_current*m_core.val_len, m_core.val_len};
+			}
+		}
+		m_current++;
+		return rec;
+	}
+	//records point into arrays
+	size_t read_batch(Record* out, size_t n, bool key_only) override {
+		n = std::min(n, m_end - m_current);
+		for (size_t i = 0; i < n; i++) {
+			out[i] = read(key_only);
+		}
+		return n;
+	}
+	std::unique_ptr<IDataReader> slice(size_t begin, size_t end) override {
+		if (begin > end || m_begin + end > m_end) {
+			return nullptr;
+		}
+		return std::make_unique<ArrayReader>(m_core, m_begin + begin, m_begin + end);
+	}
+private:
+	const ssht_array& m_core;
+	const size_t m_begin;
+	const size_t m_end;
+	size_t m_current;
+};
+
+} //namespace
+
+template <typename Build>
+static int BuildWithCallback(const ssht_reader* readers, unsigned n, const char* path, const Build& build) {
+	if ((readers == nullptr && n != 0) || path == nullptr) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	try {
+		DataReaders in;
+		in.reserve(n);
+		for (unsigned i = 0; i < n; i++) {
+			if (readers[i].reset == nullptr || readers[i].total == nullptr || readers[i].read == nullptr) {
+				return BUILD_STATUS_BAD_INPUT;
+			}
+			in.push_back(std::make_unique<CallbackReader>(readers[i]));
+		}
+		FileWriter out(path);
+		if (!out) {
+			return BUILD_STATUS_FAIL_TO_OUTPUT;
+		}
+		return build(in, out, BuildOptions{});
+	} catch (const std::exception& e) {
+		Logger::Printf("fail to build: %s\n", e.what());
+		return BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
+}
+
+template <typename Build>
+static int BuildWithArray(const ssht_array* array, unsigned thread, const char* path, const Build& build) {
+	if (array == nullptr || path == nullptr || (array->keys == nullptr && array->item != 0)) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	if (thread == 0) {
+		thread = std::max(std::thread::hardware_concurrency(), 1U);
+	}
+	const size_t n = std::max<size_t>(std::min<size_t>(thread, array->item/1024U), 1U);
+	try {
+		DataReaders in;
+		in.reserve(n);
+		for (size_t i = 0; i < n; i++) {
+			in.push_back(std::make_unique<ArrayReader>(*array, array->item*i/n, array->item*(i+1)/n));
+		}
+		FileWriter out(path);
+		if (!out) {
+			return BUILD_STATUS_FAIL_TO_OUTPUT;
+		}
+		BuildOptions options;
+		options.thread = thread;
+		return build(in, out, options);
+	} catch (const std::exception& e) {
+		Logger::Printf("fail to build: %s\n", e.what());
+		return BUILD_STATUS_FAIL_TO_OUTPUT;
+	}
+}
+
+int ssht_build_set(const ssht_reader* readers, unsigned n, const char* path) {
+	return BuildWithCallback(readers, n, path, BuildSet);
+}
+
+int ssht_build_dict(const ssht_reader* readers, unsigned n, const char* path) {
+	return BuildWithCallback(readers, n, path, BuildDict);
+}
+
+int ssht_build_dict_with_varied_value(const ssht_reader* readers, unsigned n, const char* path) {
+	return BuildWithCallback(readers, n, path, BuildDictWithVariedValue);
+}
+
+int ssht_derive(const ssht_table* base, const ssht_reader* readers, unsigned n, const char* path) {
+	return BuildWithCallback(readers, n, path, [base](const DataReaders& in, IDataWriter& out, const BuildOptions& options) {
+		return Cast(base)->derive(in, out, options);
+	});
+}
+
+int ssht_build_set_from_array(const ssht_array* in, unsigned thread, const char* path) {
+	return BuildWithArray(in, thread, path, BuildSet);
+}
+
+int ssht_build_dict_from_array(const ssht_array* in, unsigned thread, const char* path) {
+	return BuildWithArray(in, thread, path, BuildDict);
+}
+
+int ssht_build_dict_with_varied_value_from_array(const ssht_array* in, unsigned thread, const char* path) {
+	return BuildWithArray(in, thread, path, BuildDictWithVariedValue);
+}
+
+int ssht_derive_from_array(const ssht_table* base, const ssht_array* in, unsigned thread, const char* path) {
+	return BuildWithArray(in, thread, path, [base](const DataReaders& in, IDataWriter& out, const BuildOptions& options) {
+		return Cast(base)->derive(in, out, options);
+	});
+}
@@ -16,7 +16,13 @@
 // along with the This Library; if not, see <https://www.gnu.org/licenses/>.
 //==============================================================================
 
+#include <array>
 #include "internal.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 
 namespace ssht {
 
@@ -125,4 +131,66 @@ uint64_t Hash(const uint8_t* msg, uint8_t len, uint64_t seed) noexcept {
 	return a;
 }
 
-} //ssht
\ No newline at end of file
+static constexpr uint32_t CRC32C_POLY = 0x82f63b78;
+
+static constexpr std::array<uint32_t,256> CreateCrcTable() {
+	std::array<uint32_t,256> table = {};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (unsigned j = 0; j < 8; j++) {
+			crc = (crc >> 1U) ^ ((crc & 1U)? CRC32C_POLY : 0);
+		}
+		table[i] = crc;
+	}
+	return table;
+}
+
+static constexpr auto CRC_TABLE = CreateCrcTable();
+
+static uint32_t SoftCrc32c(uint32_t crc, const uint8_t* data, size_t len) noexcept {
+	for (size_t i = 0; i < len; i++) {
+		crc = (crc >> 8U) ^ CRC_TABLE[(crc ^ data[i]) & 0xffU];
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t HardCrc32c(uint32_t crc, const uint8_t* data, size_t len) noexcept {
+	uint64_t c = crc;
+	for (; len >= 8; len -= 8) {
+		c = _mm_crc32_u64(c, *(const uint64_t*)data);
+		data += 8;
+	}
+	crc = c;
+	for (; len != 0; len--) {
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	return crc;
+}
+static const bool s_hard_crc = __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t HardCrc32c(uint32_t crc, const uint8_t* data, size_t len) noexcept {
+	for (; len >= 8; len -= 8) {
+		crc = __crc32cd(crc, *(const uint64_t*)data);
+		data += 8;
+	}
+	for (; len != 0; len--) {
+		crc = __crc32cb(crc, *data++);
+	}
+	return crc;
+}
+static constexpr bool s_hard_crc = true;
+#else
+static constexpr auto HardCrc32c = SoftCrc32c;
+static constexpr bool s_hard_crc = false;
+#endif
+
+//Castagnoli, use hardware instruction when available
+uint32_t Crc32c(uint32_t crc, const uint8_t* data, size_t len) noexcept {
+	crc = ~crc;
+	crc = s_hard_crc? HardCrc32c(crc, data, len) : SoftCrc32c(crc, data, len);
+	return ~crc;
+}
+
+} //ssht
@@ -0,0 +1,205 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "internal.h"
+
+namespace ssht {
+
+//profile slot is a count followed by a key, the key is replaced when count decays to 0
+struct ProfileSlot {
+	uint32_t count;
+	uint8_t lock;
+	uint8_t _pad[3];
+
+	uint8_t* key() noexcept { return (uint8_t*)(this+1); }
+	bool try_lock() noexcept { return __atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE) == 0; }
+	void lock_slowly() noexcept {
+		while (!try_lock()) {
+			std::this_thread::yield();
+		}
+	}
+	void unlock() noexcept { __atomic_store_n(&lock, 0, __ATOMIC_RELEASE); }
+};
+static_assert(sizeof(ProfileSlot) == 8);
+
+static constexpr uint64_t PROFILE_SEED = 0x9e3779b97f4a7c15ULL;
+
+HotCache::HotCache(const Hashtable& base, unsigned capacity, unsigned rate_shift)
+	: m_base(base), m_capacity(capacity), m_rate_shift(std::min(rate_shift, 31U)),
+	  m_slot_size((sizeof(ProfileSlot) + base.key_len() + 7U) & ~7U) {
+	if (!base || capacity == 0 || base.type() == Hashtable::KV_SEPARATED || base.m_tier != nullptr) {
+		return;
+	}
+	m_profile = MemBlock((size_t)m_capacity * m_slot_size);
+	if (!!m_profile) {
+		memset(m_profile.addr(), 0, m_profile.size());
+	}
+}
+
+HotCache::~HotCache() noexcept = default;
+
+void HotCache::sample(unsigned batch, const uint8_t* keys) noexcept {
+	if (!m_profile) {
+		return;
+	}
+	static thread_local uint32_t countdown = 1;
+	const unsigned key_len = m_base.key_len();
+	for (unsigned i = 0; i < batch; i++) {
+		if (--countdown != 0) {
+			continue;
+		}
+		countdown = 1U << m_rate_shift;
+		auto key = keys + i*key_len;
+		auto idx = Hash(key, key_len, PROFILE_SEED) % m_capacity;
+		auto slot = (ProfileSlot*)(m_profile.addr() + idx*m_slot_size);
+		if (!slot->try_lock()) {
+			continue;
+		}
+		if (slot->count == 0) {
+			memcpy(slot->key(), key, key_len);
+			slot->count = 1;
+		} else if (memcmp(slot->key(), key, key_len) == 0) {
+			if (slot->count != UINT32_MAX) slot->count++;
+		} else {
+			slot->count--;
+		}
+		slot->unlock();
+	}
+}
+
+namespace {
+//keys with values in base
+class HotReader : public IDataReader {
+public:
+	HotReader(const std::vector<const uint8_t*>& keys, const std::vector<Slice>& vals, uint8_t key_len)
+		: m_keys(keys), m_vals(vals), m_key_len(key_len) {}
+	void reset() override { m_current = 0; }
+	size_t total() override { return m_keys.size(); }
+	Record read(bool) override {
+		Record rec;
+		rec.key = {m_keys[m_current], m_key_len};
+		rec.val = m_vals[m_current];
+		m_current++;
+		return rec;
+	}
+private:
+	const std::vector<const uint8_t*>& m_keys;
+	const std::vector<Slice>& m_vals;
+	const uint8_t m_key_len;
+	size_t m_current = 0;
+};
+} //namespace
+
+bool HotCache::refresh(size_t n) {
+	if (!m_profile) {
+		return false;
+	}
+	const unsigned key_len = m_base.key_len();
+	std::vector<std::pair<uint32_t,uint32_t>> ranks;	//count, idx
+	for (unsigned i = 0; i < m_capacity; i++) {
+		auto slot = (ProfileSlot*)(m_profile.addr() + (size_t)i*m_slot_size);
+		slot->lock_slowly();
+		if (slot->count != 0) {
+			ranks.emplace_back(slot->count, i);
+			slot->count >>= 1U;
+		}
+		slot->unlock();
+	}
+	std::sort(ranks.begin(), ranks.end(), std::greater<>());
+	n = std::min(n, ranks.size());
+
+	//keys are copied out as slots may be replaced by samplers
+	auto buf = std::make_unique<uint8_t[]>(n*key_len + 1);
+	std::vector<const uint8_t*> keys;
+	std::vector<Slice> vals;
+	for (unsigned i = 0; i < ranks.size() && keys.size() < n; i++) {
+		auto slot = (ProfileSlot*)(m_profile.addr() + (size_t)ranks[i].second*m_slot_size);
+		auto key = buf.get() + keys.size()*key_len;
+		slot->lock_slowly();
+		memcpy(key, slot->key(), key_len);
+		slot->unlock();
+		//not by search, which samples again
+		auto field = Search(m_base.m_view, key);
+		if (field == nullptr) {
+			continue;	//misses are not cached
+		}
+		keys.push_back(key);
+		vals.push_back({field, m_base.val_len()});
+	}
+	if (keys.empty()) {
+		publish({});
+		return true;
+	}
+
+	DataReaders in;
+	in.push_back(std::make_unique<HotReader>(keys, vals, key_len));
+	MemWriter out;
+	BuildOptions options;
+	options.thread = 1;
+	auto status = m_base.type() == Hashtable::KEY_SET? BuildSet(in, out, options) : BuildDict(in, out, options);
+	if (status != BUILD_STATUS_OK) {
+		return false;
+	}
+	auto table = std::make_shared<const Hashtable>(out.release());
+	if (!*table) {
+		return false;
+	}
+	publish(std::move(table));
+	return true;
+}
+
+//lookups pinned by the old parity may hold the old table, new lookups pin by the new parity
+void HotCache::publish(std::shared_ptr<const Hashtable>&& table) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	auto old = std::move(m_table);
+	m_table = std::move(table);
+	m_current.store(m_table.get(), std::memory_order_seq_cst);
+	const auto epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+	while (m_pins[epoch&1U].val.load(std::memory_order_seq_cst) != 0) {
+		std::this_thread::yield();
+	}
+}
+
+std::shared_ptr<const Hashtable> HotCache::table() const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_table;
+}
+
+const Hashtable* HotCache::pin(unsigned& epoch) const noexcept {
+	while (true) {
+		epoch = m_epoch.load(std::memory_order_seq_cst);
+		auto& pins = m_pins[epoch&1U].val;
+		pins.fetch_add(1, std::memory_order_seq_cst);
+		//a swap in between may not wait for this pin, try again
+		if (m_epoch.load(std::memory_order_seq_cst) == epoch) {
+			break;
+		}
+		pins.fetch_sub(1, std::memory_order_release);
+	}
+	return m_current.load(std::memory_order_seq_cst);
+}
+
+void HotCache::unpin(unsigned epoch) const noexcept {
+	m_pins[epoch&1U].val.fetch_sub(1, std::memory_order_release);
+}
+
+} //ssht
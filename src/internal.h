@@ -24,6 +24,8 @@
 #include <tuple>
 #include <functional>
 #include <type_traits>
+#include <vector>
+#include <sched.h>
 #include <ssht.h>
 
 #define FORCE_INLINE inline __attribute__((always_inline))
@@ -127,6 +129,21 @@ bool FORCE_INLINE UpdateCAS(T& tgt, T old, T val) {
 }
 
 
+#define ENABLE_STEP8
+
+#ifdef ENABLE_STEP8
+//mark bytes which are empty or may match
+static FORCE_INLINE uint64_t CalcHint(uint64_t vec, uint8_t mark) {
+	const uint64_t vone = 0x101010101010101ULL;
+	const uint64_t vsign = 0x8080808080808080ULL;
+	const uint64_t vmark = ~(vone*mark);
+	const uint64_t match = (vec^vsign) & vsign & (((vec^vmark)&~vsign)+vone);
+	const uint64_t empty = vec & vsign;
+	return empty | match;
+}
+#endif
+
+
 static constexpr uint32_t OFFSET_FIELD_SIZE = 6;
 static constexpr uint64_t MAX_OFFSET = (1ULL<<(OFFSET_FIELD_SIZE*8U))-1;
 
@@ -142,6 +159,7 @@ static FORCE_INLINE void WriteOffsetField(uint8_t* field, size_t offset) {
 static constexpr unsigned RESERVE_FACTOR = 16;
 
 static constexpr uint32_t SSHT_MAGIC = 0x54485353;
+static constexpr uint32_t TRAILER_MAGIC = 0x43485353;
 
 struct Header {
 	uint32_t magic = SSHT_MAGIC;
@@ -151,14 +169,110 @@ struct Header {
 	uint64_t seed = 0;
 	uint64_t item = 0;
 	uint64_t set_cnt = 0;
-	uint8_t _pad[32];
+	uint32_t trailer = TRAILER_MAGIC;	//old files may have garbage here
+	uint8_t flags = 0;
+	uint8_t _pad[27] = {};
 };
 
 static_assert(sizeof(Header)==64);
 
+static constexpr uint8_t FLAG_SLOT_ORDERED = 1U;	//values in extend follow order of slots
+
+//data is followed by crc32c of each chunk and this trailer
+struct Trailer {
+	uint64_t data_size = 0;
+	uint32_t chunk_shift = 0;
+	uint32_t magic = TRAILER_MAGIC;
+};
+
+static_assert(sizeof(Trailer)==16);
+
+static constexpr unsigned CHECKSUM_CHUNK_SHIFT = 20U;
+
+static FORCE_INLINE size_t ChunkCount(size_t size, unsigned shift) {
+	return (size + (1ULL<<shift) - 1U) >> shift;
+}
+
+extern uint32_t Crc32c(uint32_t crc, const uint8_t* data, size_t len) noexcept;
+
+#ifdef ENABLE_LOOKUP_COUNTER
+#define COUNT(counter, field, n) ((counter).field += (n))
+#else
+#define COUNT(counter, field, n) ((void)0)
+#endif
+
+//counters of each live thread in its own cache line, written only by that thread,
+//an id of exited thread is reused with its counts, chunks of slots are allocated on first use,
+//threads beyond COUNTER_THREADS or failing to allocate share one slot by atomic adds
+static constexpr unsigned COUNTER_CHUNK = 64;
+static constexpr unsigned COUNTER_CHUNKS = 256;
+static constexpr unsigned COUNTER_THREADS = COUNTER_CHUNK*COUNTER_CHUNKS;
+struct alignas(64) CounterSlot {
+	Hashtable::Counters val;
+};
+struct CounterStore {
+	CounterSlot* chunks[COUNTER_CHUNKS] = {};
+	CounterSlot shared;
+
+	CounterStore() = default;
+	CounterStore(const CounterStore&) = delete;
+	CounterStore& operator=(const CounterStore&) = delete;
+	~CounterStore() noexcept {
+		for (auto chunk : chunks) {
+			delete[] chunk;
+		}
+	}
+};
+
 extern Slice SeparatedValue(const uint8_t* pt, const uint8_t* end) noexcept;
 
+static inline bool WriteVarInt(size_t n, IDataWriter& out) {
+	uint8_t buf[10];
+	unsigned w = 0;
+	while ((n & ~0x7fULL) != 0) {
+		buf[w++] = 0x80ULL | (n & 0x7fULL);
+		n >>= 7U;
+	}
+	buf[w++] = n;
+	return out.write(buf, w);
+}
+
 extern const uint8_t* Search(const Hashtable::View& pack, const uint8_t* key) noexcept;
 
+//pipelined lookup of contiguous keys, set bits of hit slots atomically, return number of hits
+extern unsigned MarkHitSlots(const Hashtable::View& base, unsigned batch, const uint8_t* keys, uint8_t* bitmap) noexcept;
+
+//split slots by set for parallel scanning, no byte of slot bitmap is shared
+extern std::vector<std::pair<size_t,size_t>> SplitSlots(size_t set_cnt);
+
+//content of TIERED table stays in file of fd (owned by tier after call), data ends before trailer
+extern std::shared_ptr<Tier> OpenTier(int fd, size_t content_off, size_t data_end);
+
+//batch_fetch of TIERED table, patch is a normal table
+extern unsigned TieredFetch(const Hashtable::View& base, Tier& tier, const Hashtable::View* patch, unsigned batch,
+							const uint8_t* keys, uint8_t* data, const uint8_t* dft_val,
+							Hashtable::Counters& counters) noexcept;
+
+//cpus of online numa nodes within process affinity, one node if unknown
+extern const std::vector<cpu_set_t>& NumaNodes();
+
+//pin calling worker idx of n to a node according to placement
+extern void PinWorker(const BuildOptions& options, unsigned idx, unsigned n) noexcept;
+
+//pin calling thread to a node, nothing on machine with one node
+extern void PinToNode(unsigned node) noexcept;
+
+//number of parts sets are cut into, one per node under PLACE_PARTITION, otherwise 1
+extern unsigned PartitionCount(const BuildOptions& options) noexcept;
+
+//contiguous range of part out of cnt units, part i belongs to node i
+static inline std::pair<size_t,size_t> PartRange(size_t cnt, unsigned part, unsigned parts) {
+	return {cnt*part/parts, cnt*(part+1U)/parts};
+}
+
+//fill unit_cnt units by pinned threads, so pages are placed as required,
+//under PLACE_PARTITION each part of units is touched by threads of its node
+extern void ParallelFill(uint8_t* addr, uint8_t val, size_t unit_cnt, size_t unit_size, const BuildOptions& options);
+
 } //ssht
 //#endif //SSHT_INTERNAL_H_
@@ -0,0 +1,186 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <dirent.h>
+#include <pthread.h>
+#include "internal.h"
+
+namespace ssht {
+
+//parse list like "0-3,8,10-11"
+static bool ParseCpuList(const char* str, cpu_set_t& out) {
+	CPU_ZERO(&out);
+	while (*str != '\0' && *str != '\n') {
+		char* end;
+		auto a = strtoul(str, &end, 10);
+		if (end == str) {
+			return false;
+		}
+		auto b = a;
+		str = end;
+		if (*str == '-') {
+			b = strtoul(str+1, &end, 10);
+			if (end == str+1 || b < a) {
+				return false;
+			}
+			str = end;
+		}
+		for (auto i = a; i <= b && i < CPU_SETSIZE; i++) {
+			CPU_SET(i, &out);
+		}
+		if (*str == ',') {
+			str++;
+		}
+	}
+	return true;
+}
+
+static std::vector<cpu_set_t> ScanNodes() {
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return {};
+	}
+	std::vector<std::pair<unsigned,cpu_set_t>> nodes;
+	auto dir = opendir("/sys/devices/system/node");
+	if (dir != nullptr) {
+		while (auto ent = readdir(dir)) {
+			unsigned id;
+			if (sscanf(ent->d_name, "node%u", &id) != 1) {
+				continue;
+			}
+			auto path = std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist";
+			auto fp = fopen(path.c_str(), "r");
+			if (fp == nullptr) {
+				continue;
+			}
+			char line[4096];
+			cpu_set_t cpus;
+			if (fgets(line, sizeof(line), fp) != nullptr && ParseCpuList(line, cpus)) {
+				CPU_AND(&cpus, &cpus, &allowed);
+				if (CPU_COUNT(&cpus) != 0) {
+					nodes.emplace_back(id, cpus);
+				}
+			}
+			fclose(fp);
+		}
+		closedir(dir);
+	}
+	std::sort(nodes.begin(), nodes.end(), [](auto& a, auto& b) { return a.first < b.first; });
+	std::vector<cpu_set_t> out;
+	for (auto& node : nodes) {
+		out.push_back(node.second);
+	}
+	if (out.empty()) {
+		out.push_back(allowed);
+	}
+	return out;
+}
+
+const std::vector<cpu_set_t>& NumaNodes() {
+	static const auto nodes = ScanNodes();
+	return nodes;
+}
+
+unsigned PartitionCount(const BuildOptions& options) noexcept {
+	return options.placement == BuildOptions::PLACE_PARTITION? NumaNodes().size() : 1U;
+}
+
+void PinToNode(unsigned node) noexcept {
+	auto& nodes = NumaNodes();
+	if (nodes.size() < 2 || node >= nodes.size()) {
+		return;
+	}
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &nodes[node]) != 0) {
+		Logger::Printf("fail to pin thread to node %u\n", node);
+	}
+}
+
+void PinWorker(const BuildOptions& options, unsigned idx, unsigned n) noexcept {
+	if (options.placement == BuildOptions::PLACE_LOCAL || n == 0) {
+		return;
+	}
+	const auto nodes = NumaNodes().size();
+	//interleave workers over nodes, or give each node a contiguous run of workers
+	PinToNode(options.placement == BuildOptions::PLACE_INTERLEAVE? idx % nodes : idx * nodes / n);
+}
+
+static constexpr size_t FILL_CHUNK = 1U << 21U;	//huge page
+
+void ParallelFill(uint8_t* addr, uint8_t val, size_t unit_cnt, size_t unit_size, const BuildOptions& options) {
+	const size_t size = unit_cnt * unit_size;
+	const size_t chunks = (size + FILL_CHUNK - 1) / FILL_CHUNK;
+	size_t n = options.thread != 0? options.thread : std::max(std::thread::hardware_concurrency(), 1U);
+	const unsigned parts = PartitionCount(options);
+	std::vector<std::thread> threads;
+	if (parts > 1) {
+		//threads of each node touch the units of its part, n/parts threads at least one per node
+		const size_t per_part = std::max<size_t>(n / parts, 1U);
+		threads.reserve(parts * per_part);
+		for (unsigned p = 0; p < parts; p++) {
+			auto range = PartRange(unit_cnt, p, parts);
+			const size_t begin = range.first * unit_size;
+			const size_t len = (range.second - range.first) * unit_size;
+			for (size_t k = 0; k < per_part; k++) {
+				threads.emplace_back([addr, val, begin, len, per_part, p, k]() {
+					PinToNode(p);
+					const auto off = begin + len*k/per_part;
+					memset(addr + off, val, begin + len*(k+1)/per_part - off);
+				});
+			}
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+		return;
+	}
+	n = std::min(n, chunks);
+	if (n < 2) {
+		memset(addr, val, size);
+		return;
+	}
+	auto fill = [addr, val, size](size_t chunk) {
+		auto off = chunk * FILL_CHUNK;
+		memset(addr + off, val, std::min(FILL_CHUNK, size - off));
+	};
+	threads.reserve(n);
+	for (unsigned i = 0; i < n; i++) {
+		threads.emplace_back([&options, &fill, chunks, n, i]() {
+			PinWorker(options, i, n);
+			if (options.placement == BuildOptions::PLACE_INTERLEAVE) {
+				for (size_t j = i; j < chunks; j += n) {
+					fill(j);
+				}
+			} else {
+				for (size_t j = chunks*i/n; j < chunks*(i+1)/n; j++) {
+					fill(j);
+				}
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+} //ssht
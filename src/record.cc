@@ -0,0 +1,323 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "internal.h"
+
+namespace ssht {
+
+//boundary of every STEP records, found by one sequential scan
+static constexpr size_t SCAN_STEP = 4096;
+using Marks = std::vector<const uint8_t*>;
+
+class RecordReader : public IDataReader {
+public:
+	//varied records need marks and the global index of first record, which is aligned to SCAN_STEP
+	RecordReader(std::shared_ptr<const MemMap> file, const uint8_t* begin, const uint8_t* end,
+				 size_t total, uint8_t key_len, uint32_t val_len,
+				 std::shared_ptr<const Marks> marks=nullptr, size_t first=0)
+		: m_file(std::move(file)), m_marks(std::move(marks)), m_begin(begin), m_end(end), m_pos(begin),
+		  m_first(first), m_total(total), m_key_len(key_len), m_val_len(val_len) {}
+
+	void reset() override {
+		m_pos = m_begin;
+		m_done = 0;
+	}
+	size_t total() override {
+		return m_total;
+	}
+	Record read(bool) override {
+		Record rec;
+		if (m_done < m_total) {
+			next(rec);
+		}
+		return rec;
+	}
+	size_t read_batch(Record* out, size_t n, bool) override {
+		n = std::min(n, m_total - m_done);
+		for (size_t i = 0; i < n; i++) {
+			next(out[i]);
+		}
+		return n;
+	}
+	std::unique_ptr<IDataReader> slice(size_t begin, size_t end) override {
+		if (begin > end || end > m_total) {
+			return nullptr;
+		}
+		if (m_val_len != VARIED_VALUE_LEN) {
+			const size_t record_size = m_key_len + (size_t)m_val_len;
+			return std::make_unique<RecordReader>(m_file, m_begin + begin*record_size, m_begin + end*record_size,
+												  end - begin, m_key_len, m_val_len);
+		}
+		if (m_marks == nullptr || (begin % SCAN_STEP) != 0 || (end != m_total && (end % SCAN_STEP) != 0)) {
+			return nullptr;
+		}
+		auto& marks = *m_marks;
+		const auto a = (m_first + begin) / SCAN_STEP;
+		const auto b = (m_first + end) / SCAN_STEP;
+		return std::make_unique<RecordReader>(m_file, marks[a], end == m_total? m_end : marks[b],
+											  end - begin, m_key_len, m_val_len, m_marks, m_first + begin);
+	}
+
+private:
+	std::shared_ptr<const MemMap> m_file;
+	std::shared_ptr<const Marks> m_marks;
+	const uint8_t* const m_begin;
+	const uint8_t* const m_end;
+	const uint8_t* m_pos;
+	size_t m_done = 0;
+	const size_t m_first;
+	const size_t m_total;
+	const uint8_t m_key_len;
+	const uint32_t m_val_len;
+
+	void next(Record& rec) noexcept {
+		m_done++;
+		rec.key = {m_pos, m_key_len};
+		m_pos += m_key_len;
+		if (m_val_len == VARIED_VALUE_LEN) {
+			rec.val = SeparatedValue(m_pos, m_end);
+			m_pos = rec.val.ptr + rec.val.len;
+		} else {
+			rec.val = {m_pos, m_val_len};
+			m_pos += m_val_len;
+		}
+	}
+};
+
+static bool ScanVariedRecords(const uint8_t* pt, const uint8_t* end, uint8_t key_len,
+							  Marks& marks, size_t& total) {
+	total = 0;
+	while (pt < end) {
+		if ((total % SCAN_STEP) == 0) {
+			marks.push_back(pt);
+		}
+		if ((size_t)(end - pt) < key_len) {
+			return false;
+		}
+		auto val = SeparatedValue(pt + key_len, end);
+		if (val.ptr == nullptr) {
+			return false;
+		}
+		pt = val.ptr + val.len;
+		total++;
+	}
+	return true;
+}
+
+DataReaders SplitRecordFile(const char* path, uint8_t key_len, uint32_t val_len, unsigned n) {
+	DataReaders out;
+	if (key_len == 0 || n == 0) {
+		return out;
+	}
+	auto file = std::make_shared<const MemMap>(path);
+	if (!*file) {
+		return out;
+	}
+	const auto begin = file->addr();
+	const auto end = file->end();
+	if (madvise((void*)begin, file->size(), MADV_SEQUENTIAL) != 0) {
+		Logger::Printf("fail to madvise: %s\n", path);
+	}
+	if (val_len != VARIED_VALUE_LEN) {
+		const size_t record_size = key_len + (size_t)val_len;
+		if (file->size() % record_size != 0) {
+			Logger::Printf("broken record file: %s\n", path);
+			return out;
+		}
+		const size_t total = file->size() / record_size;
+		for (unsigned i = 0; i < n; i++) {
+			auto a = total * i / n;
+			auto b = total * (i+1) / n;
+			out.push_back(std::make_unique<RecordReader>(file, begin + a*record_size, begin + b*record_size,
+														 b - a, key_len, val_len));
+		}
+		return out;
+	}
+
+	auto marks = std::make_shared<Marks>();
+	size_t total = 0;
+	if (!ScanVariedRecords(begin, end, key_len, *marks, total)) {
+		Logger::Printf("broken record file: %s\n", path);
+		return out;
+	}
+	marks->push_back(end);
+	const size_t steps = marks->size() - 1;
+	for (unsigned i = 0; i < n; i++) {
+		auto a = steps * i / n;
+		auto b = steps * (i+1) / n;
+		auto first = std::min(a*SCAN_STEP, total);
+		auto cnt = std::min(b*SCAN_STEP, total) - first;
+		out.push_back(std::make_unique<RecordReader>(file, (*marks)[a], (*marks)[b], cnt, key_len, val_len,
+													 marks, first));
+	}
+	return out;
+}
+
+//append log of one stream in record file format
+struct StreamLog {
+	std::string path;
+	uint8_t key_len = 0;
+	uint32_t val_len = 0;
+	size_t item = 0;
+	BuildStatus status = BUILD_STATUS_OK;
+};
+
+static bool WriteRecord(const Record& rec, uint32_t val_len, IDataWriter& out) {
+	if (!out.write(rec.key.ptr, rec.key.len)) {
+		return false;
+	}
+	if (val_len == VARIED_VALUE_LEN && !WriteVarInt(rec.val.len, out)) {
+		return false;
+	}
+	return val_len == 0 || rec.val.len == 0 || out.write(rec.val.ptr, rec.val.len);
+}
+
+static void DumpStream(Hashtable::Type type, IDataReader& reader, StreamLog& log) {
+	FileWriter out(log.path.c_str());
+	if (!out) {
+		log.status = BUILD_STATUS_FAIL_TO_OUTPUT;
+		return;
+	}
+	constexpr size_t BATCH = 32;
+	Record recs[BATCH];
+	while (true) {
+		auto m = reader.read_batch(recs, BATCH, type == Hashtable::KEY_SET);
+		if (m == 0 || m > BATCH) {
+			log.status = BUILD_STATUS_BAD_INPUT;
+			return;
+		}
+		for (size_t i = 0; i < m; i++) {
+			auto& rec = recs[i];
+			if (rec.key.ptr == nullptr) {
+				if (!out.flush()) {
+					log.status = BUILD_STATUS_FAIL_TO_OUTPUT;
+				}
+				return;
+			}
+			if (log.item == 0) {
+				log.key_len = rec.key.len;
+				log.val_len = type == Hashtable::KEY_SET? 0
+					: type == Hashtable::KV_INLINE? rec.val.len : VARIED_VALUE_LEN;
+			}
+			if (rec.key.len == 0 || rec.key.len > MAX_KEY_LEN || rec.key.len != log.key_len
+				|| (type == Hashtable::KV_INLINE && (rec.val.len == 0 || rec.val.len > MAX_INLINE_VALUE_LEN
+													 || rec.val.len != log.val_len))
+				|| (type == Hashtable::KV_SEPARATED && rec.val.len > MAX_VALUE_LEN)
+				|| (type != Hashtable::KEY_SET && rec.val.len != 0 && rec.val.ptr == nullptr)) {
+				log.status = BUILD_STATUS_BAD_INPUT;
+				return;
+			}
+			if (!WriteRecord(rec, log.val_len, out)) {
+				log.status = BUILD_STATUS_FAIL_TO_OUTPUT;
+				return;
+			}
+			log.item++;
+		}
+	}
+}
+
+BuildStatus BuildFromStream(Hashtable::Type type, const DataReaders& in, IDataWriter& out,
+							const BuildOptions& options) {
+	if (in.empty() || (type != Hashtable::KEY_SET && type != Hashtable::KV_INLINE
+					   && type != Hashtable::KV_SEPARATED)) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+	const std::string dir = options.spill_dir != nullptr? options.spill_dir : P_tmpdir;
+	std::vector<StreamLog> logs(in.size());
+	auto cleanup = [&logs]() {
+		for (auto& log : logs) {
+			if (!log.path.empty()) {
+				unlink(log.path.c_str());
+			}
+		}
+	};
+	for (auto& log : logs) {
+		auto path = dir + "/ssht-stream-XXXXXX";
+		int fd = mkstemp(&path[0]);
+		if (fd < 0) {
+			Logger::Printf("fail to create log in: %s\n", dir.c_str());
+			cleanup();
+			return BUILD_STATUS_FAIL_TO_OUTPUT;
+		}
+		close(fd);
+		log.path = std::move(path);
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(in.size());
+	for (unsigned i = 0; i < in.size(); i++) {
+		threads.emplace_back(DumpStream, type, std::ref(*in[i]), std::ref(logs[i]));
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	//logs are mapped, so they can be removed before building
+	DataReaders logged;
+	const StreamLog* first = nullptr;
+	BuildStatus status = BUILD_STATUS_OK;
+	for (auto& log : logs) {
+		if (log.status != BUILD_STATUS_OK) {
+			status = log.status;
+			break;
+		}
+		if (log.item == 0) {
+			continue;
+		}
+		if (first == nullptr) {
+			first = &log;
+		} else if (log.key_len != first->key_len || log.val_len != first->val_len) {
+			status = BUILD_STATUS_BAD_INPUT;
+			break;
+		}
+		auto part = SplitRecordFile(log.path.c_str(), log.key_len, log.val_len, 1);
+		if (part.empty()) {
+			status = BUILD_STATUS_FAIL_TO_OUTPUT;
+			break;
+		}
+		for (auto& reader : part) {
+			logged.push_back(std::move(reader));
+		}
+	}
+	cleanup();
+	if (status != BUILD_STATUS_OK) {
+		return status;
+	}
+	if (logged.empty()) {
+		return BUILD_STATUS_BAD_INPUT;
+	}
+
+	//logs can be read again, no need to spill
+	auto inner = options;
+	inner.spill_dir = nullptr;
+	switch (type) {
+		case Hashtable::KEY_SET:
+			return BuildSet(logged, out, inner);
+		case Hashtable::KV_INLINE:
+			return BuildDict(logged, out, inner);
+		default:
+			return BuildDictWithVariedValue(logged, out, inner);
+	}
+}
+
+} //ssht
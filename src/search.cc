@@ -18,6 +18,7 @@
 
 #include <cassert>
 #include <algorithm>
+#include <new>
 #include "internal.h"
 
 namespace ssht {
@@ -44,34 +45,25 @@ Slice SeparatedValue(const uint8_t* pt, const uint8_t* end) noexcept {
 	return {};
 }
 
-#define ENABLE_STEP8
-
-#ifdef ENABLE_STEP8
-static FORCE_INLINE uint64_t CalcHint(uint64_t vec, uint8_t mark) {
-	const uint64_t vone = 0x101010101010101ULL;
-	const uint64_t vsign = 0x8080808080808080ULL;
-	const uint64_t vmark = ~(vone*mark);
-	const uint64_t match = (vec^vsign) & vsign & (((vec^vmark)&~vsign)+vone);
-	const uint64_t empty = vec & vsign;
-	return empty | match;
-}
-#endif
-
-const uint8_t* Search(const Hashtable::View& pack, const uint8_t* key) noexcept {
+static FORCE_INLINE const uint8_t* Search(const Hashtable::View& pack, const uint8_t* key, Hashtable::Counters& counters) {
 	assert(key != nullptr);
 	auto[set, mark, sft] = HashKey(key, pack.key_len, pack.seed, pack.set_cnt);
+	COUNT(counters, lookup, 1);
 
 #define HANDLE_SLOT(pos) \
 	if (g[pos] == mark) {													\
 		auto line = pack.content + ((set << 6U) + (pos)) * pack.line_size;	\
 		if (Equal(key, line, pack.key_len)) {								\
+			COUNT(counters, hit, 1);										\
 			return line + pack.key_len;										\
 		}																	\
+		COUNT(counters, false_tag, 1);										\
 	} else if (g[pos] & 0x80U) {											\
 		return nullptr;														\
 	}
 
 	while (true) {
+		COUNT(counters, set_probe, 1);
 		auto g = pack.guide + (set << 6U);
 		for (unsigned j = sft; j < sft+64U;) {
 			auto off = j & 63U;
@@ -96,11 +88,130 @@ const uint8_t* Search(const Hashtable::View& pack, const uint8_t* key) noexcept
 #undef HANDLE_SLOT
 }
 
+const uint8_t* Search(const Hashtable::View& pack, const uint8_t* key) noexcept {
+	Hashtable::Counters dummy;
+	return Search(pack, key, dummy);
+}
+
+#ifdef ENABLE_LOOKUP_COUNTER
+static uint8_t s_thread_taken[COUNTER_THREADS] = {};
+
+//dense id of calling thread, released at exit for later threads
+struct CounterOwner {
+	unsigned id = COUNTER_THREADS;
+
+	CounterOwner() noexcept {
+		for (unsigned i = 0; i < COUNTER_THREADS; i++) {
+			if (LoadRelaxed(s_thread_taken[i]) == 0
+				&& __atomic_exchange_n(&s_thread_taken[i], 1, __ATOMIC_ACQUIRE) == 0) {
+				id = i;
+				break;
+			}
+		}
+	}
+	~CounterOwner() noexcept {
+		if (id < COUNTER_THREADS) {
+			StoreRelease(s_thread_taken[id], (uint8_t)0);
+		}
+	}
+};
+
+static CounterSlot* OwnSlot(CounterStore& store, unsigned id) noexcept {
+	if (id >= COUNTER_THREADS) {
+		return nullptr;
+	}
+	auto& chunk = store.chunks[id/COUNTER_CHUNK];
+	auto slots = __atomic_load_n(&chunk, __ATOMIC_ACQUIRE);
+	if (slots == nullptr) {
+		auto fresh = new(std::nothrow) CounterSlot[COUNTER_CHUNK]();
+		if (fresh == nullptr) {
+			return nullptr;
+		}
+		if (UpdateCAS(chunk, (CounterSlot*)nullptr, fresh)) {
+			slots = fresh;
+		} else {
+			delete[] fresh;
+			slots = __atomic_load_n(&chunk, __ATOMIC_ACQUIRE);
+		}
+	}
+	return slots + id%COUNTER_CHUNK;
+}
+
+//only owner writes, no read-modify-write needed
+static FORCE_INLINE void Bump(uint64_t& tgt, uint64_t n) {
+	__atomic_store_n(&tgt, LoadRelaxed(tgt)+n, __ATOMIC_RELAXED);
+}
+
+static void FlushCounters(const std::shared_ptr<CounterStore>& store, const Hashtable::Counters& local) {
+	if (store == nullptr) {
+		return;
+	}
+	static thread_local CounterOwner owner;
+	auto slot = OwnSlot(*store, owner.id);
+	if (slot == nullptr) {
+		auto& shared = store->shared.val;
+		AddRelaxed(shared.lookup, local.lookup);
+		AddRelaxed(shared.hit, local.hit);
+		AddRelaxed(shared.patch_hit, local.patch_hit);
+		AddRelaxed(shared.hot_hit, local.hot_hit);
+		AddRelaxed(shared.set_probe, local.set_probe);
+		AddRelaxed(shared.false_tag, local.false_tag);
+		AddRelaxed(shared.default_fill, local.default_fill);
+		return;
+	}
+	auto& own = slot->val;
+	Bump(own.lookup, local.lookup);
+	Bump(own.hit, local.hit);
+	Bump(own.patch_hit, local.patch_hit);
+	Bump(own.hot_hit, local.hot_hit);
+	Bump(own.set_probe, local.set_probe);
+	Bump(own.false_tag, local.false_tag);
+	Bump(own.default_fill, local.default_fill);
+}
+
+static void SumCounters(const CounterSlot& slot, Hashtable::Counters& out) noexcept {
+	auto& val = slot.val;
+	out.lookup += LoadRelaxed(val.lookup);
+	out.hit += LoadRelaxed(val.hit);
+	out.patch_hit += LoadRelaxed(val.patch_hit);
+	out.hot_hit += LoadRelaxed(val.hot_hit);
+	out.set_probe += LoadRelaxed(val.set_probe);
+	out.false_tag += LoadRelaxed(val.false_tag);
+	out.default_fill += LoadRelaxed(val.default_fill);
+}
+
+Hashtable::Counters Hashtable::counters() const noexcept {
+	Counters out;
+	if (m_counter == nullptr) {
+		return out;
+	}
+	for (auto& chunk : m_counter->chunks) {
+		auto slots = __atomic_load_n(&chunk, __ATOMIC_ACQUIRE);
+		for (unsigned i = 0; slots != nullptr && i < COUNTER_CHUNK; i++) {
+			SumCounters(slots[i], out);
+		}
+	}
+	SumCounters(m_counter->shared, out);
+	return out;
+}
+#else
+static FORCE_INLINE void FlushCounters(const std::shared_ptr<CounterStore>&, const Hashtable::Counters&) {}
+
+Hashtable::Counters Hashtable::counters() const noexcept {
+	return {};
+}
+#endif
+
 Slice Hashtable::search(const uint8_t* key) const noexcept {
-	if (!*this || key == nullptr) {
+	if (!*this || key == nullptr || m_tier != nullptr) {
 		return {};
 	}
-	auto field = Search(m_view, key);
+	if (m_hot != nullptr) {
+		m_hot->sample(1, key);
+	}
+	Counters counters;
+	auto field = Search(m_view, key, counters);
+	FlushCounters(m_counter, counters);
 	if (field == nullptr) {
 		return {};
 	}
@@ -118,16 +229,25 @@ Slice Hashtable::search(const uint8_t* key) const noexcept {
 static_assert(CACHE_BLOCK_SIZE >= 64U && (CACHE_BLOCK_SIZE&(CACHE_BLOCK_SIZE-1)) == 0);
 
 
+static FORCE_INLINE bool SameShape(const Hashtable::View& a, const Hashtable::View& b) noexcept {
+	return a.type == b.type && a.key_len == b.key_len && a.val_len == b.val_len;
+}
+
+//tables are searched in order of patch, hot and base
 template <typename GetKey, typename FillVal>
 static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View& base, const Hashtable::View* patch,
-										  const GetKey& get_key, const FillVal& fill_val, const uint8_t* dft_val=nullptr) noexcept {
-	if ((base.type == Hashtable::KV_SEPARATED) || (patch != nullptr &&
-		(patch->type != base.type || patch->key_len != base.key_len || patch->val_len != base.val_len))) {
+										  Hashtable::Counters& counters, const GetKey& get_key,
+										  const FillVal& fill_val, const uint8_t* dft_val=nullptr,
+										  const Hashtable::View* hot=nullptr) noexcept {
+	if (patch != nullptr && !SameShape(*patch, base)) {
 		return 0;
 	}
 	if (patch == &base) {
 		patch = nullptr;
 	}
+	if (hot != nullptr && !SameShape(*hot, base)) {
+		hot = nullptr;
+	}
 
 	constexpr unsigned WINDOW_SIZE = 16;
 	struct State {
@@ -142,8 +262,10 @@ static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View&
 
 	unsigned hit = 0;
 	auto window = std::min(batch, WINDOW_SIZE);
+	COUNT(counters, lookup, batch);
 
-	auto bind_pipeline = [&get_key](const Hashtable::View* pack, State& state) {
+	auto bind_pipeline = [&get_key, &counters](const Hashtable::View* pack, State& state) {
+		COUNT(counters, set_probe, 1);
 		state.pack = pack;
 		auto [set, mark, sft] = HashKey(get_key(state.idx), state.pack->key_len, state.pack->seed, state.pack->set_cnt);
 		state.set = set;
@@ -153,9 +275,15 @@ static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View&
 		state.line = nullptr;
 		PrefetchForNext(state.pack->guide + (state.set << 6U));
 	};
-	auto init_pipeline = [&base, patch, &bind_pipeline](State& state, unsigned idx) {
+	auto init_pipeline = [&base, patch, hot, &bind_pipeline](State& state, unsigned idx) {
 		state.idx = idx;
-		bind_pipeline(patch==nullptr? &base : patch, state);
+		bind_pipeline(patch!=nullptr? patch : hot!=nullptr? hot : &base, state);
+	};
+	auto next_pack = [&base, patch, hot](const Hashtable::View* pack)->const Hashtable::View* {
+		if (pack == patch && hot != nullptr) {
+			return hot;
+		}
+		return pack != &base? &base : nullptr;
 	};
 
 	const auto key_len = base.key_len;
@@ -181,9 +309,12 @@ static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View&
 			if (st.line != nullptr) {
 				if (Equal(get_key(st.idx), st.line, key_len)) {
 					hit++;
+					COUNT(counters, patch_hit, st.pack==patch);
+					COUNT(counters, hot_hit, st.pack==hot);
 					fill_val(st.idx, st.line+key_len);
 					goto reload;
 				}
+				COUNT(counters, false_tag, 1);
 				st.line = nullptr;
 			} else {
 				auto g = st.pack->guide + (st.set<<6U);
@@ -208,10 +339,11 @@ static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View&
 						prefetch_line(st.line);
 						goto next;
 					} else if (g[off] & 0x80U) {
-						if (st.pack == patch) {
-							bind_pipeline(&base, st);
+						if (auto pack = next_pack(st.pack); pack != nullptr) {
+							bind_pipeline(pack, st);
 							goto next;
 						} else {
+							COUNT(counters, default_fill, dft_val!=nullptr);
 							fill_val(st.idx, dft_val);
 						}
 						goto reload;
@@ -222,6 +354,7 @@ static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View&
 				if (++st.set >= st.pack->set_cnt.value()) {
 					st.set = 0;
 				}
+				COUNT(counters, set_probe, 1);
 				PrefetchForNext(st.pack->guide + (st.set<<6U));
 			}
 		next:
@@ -237,22 +370,27 @@ static FORCE_INLINE unsigned BatchProcess(unsigned batch, const Hashtable::View&
 			}
 		}
 	}
+	COUNT(counters, hit, hit);
 	return hit;
 }
 
 
 unsigned Hashtable::batch_search(unsigned batch, const uint8_t* const keys[], const uint8_t* out[],
 								 const Hashtable* patch) const noexcept {
-	if (!*this || keys == nullptr || out == nullptr) {
+	if (!*this || keys == nullptr || out == nullptr || m_tier != nullptr || m_view.type == Hashtable::KV_SEPARATED
+		|| (patch != nullptr && patch->m_tier != nullptr)) {
 		return 0;
 	}
-	return BatchProcess(batch, m_view, patch==nullptr? nullptr : &patch->m_view,
+	Counters counters;
+	auto hit = BatchProcess(batch, m_view, patch==nullptr? nullptr : &patch->m_view, counters,
 						[keys](unsigned idx)->const uint8_t*{
 							return keys[idx];
 						},
 						[out](unsigned idx, const uint8_t* val) {
 							out[idx] = val;
 						});
+	FlushCounters(m_counter, counters);
+	return hit;
 }
 
 unsigned Hashtable::batch_fetch(unsigned batch, const uint8_t* __restrict__ keys, uint8_t* __restrict__ data,
@@ -260,9 +398,30 @@ unsigned Hashtable::batch_fetch(unsigned batch, const uint8_t* __restrict__ keys
 	if (!*this || keys == nullptr || data == nullptr || m_view.type != Hashtable::KV_INLINE) {
 		return 0;
 	}
+	if (patch != nullptr && patch->m_tier != nullptr) {
+		return 0;	//patch should be searched in place
+	}
+	if (m_tier != nullptr) {
+		if (patch != nullptr && !SameShape(patch->m_view, m_view)) {
+			return 0;
+		}
+		Counters counters;
+		auto hit = TieredFetch(m_view, *m_tier, patch==nullptr? nullptr : &patch->m_view, batch, keys, data, dft_val,
+							   counters);
+		FlushCounters(m_counter, counters);
+		return hit;
+	}
 	const unsigned key_len = m_view.key_len;
 	const unsigned val_len = m_view.val_len;
-	return BatchProcess(batch, m_view, patch==nullptr? nullptr : &patch->m_view,
+	HotCache* cache = m_hot;
+	const Hashtable* hot = nullptr;
+	unsigned epoch = 0;
+	if (cache != nullptr) {
+		cache->sample(batch, keys);
+		hot = cache->pin(epoch);
+	}
+	Counters counters;
+	auto hit = BatchProcess(batch, m_view, patch==nullptr? nullptr : &patch->m_view, counters,
 						[keys, key_len](unsigned idx)->const uint8_t*{
 							return keys + idx*key_len;
 						},
@@ -271,7 +430,118 @@ unsigned Hashtable::batch_fetch(unsigned batch, const uint8_t* __restrict__ keys
 							if (val != nullptr) {
 								memcpy(out, val, val_len);
 							}
-						}, dft_val);
+						}, dft_val, hot!=nullptr? &hot->m_view : nullptr);
+	if (cache != nullptr) {
+		cache->unpin(epoch);
+	}
+	FlushCounters(m_counter, counters);
+	return hit;
+}
+
+void LookupProbe::bind(const Hashtable::View& pack) noexcept {
+	COUNT(m_counters, set_probe, 1);
+	m_pack = &pack;
+	auto [set, mark, sft] = HashKey(m_key, pack.key_len, pack.seed, pack.set_cnt);
+	m_set = set;
+	m_mark = mark;
+	m_sft = sft;
+	m_cur = sft;
+	m_stage = STAGE_SCAN;
+	PrefetchForNext(pack.guide + (set << 6U));
+}
+
+bool LookupProbe::finish() noexcept {
+	m_stage = STAGE_DONE;
+	FlushCounters(m_table->m_counter, m_counters);
+	return true;
+}
+
+bool LookupProbe::start(const Hashtable& table, const uint8_t* key, const Hashtable* patch) noexcept {
+	m_result = {};
+	m_stage = STAGE_DONE;
+	if (!table || key == nullptr || table.m_tier != nullptr
+		|| (patch != nullptr && (patch->m_tier != nullptr || !SameShape(patch->m_view, table.m_view)))) {
+		return true;
+	}
+	if (table.m_hot != nullptr) {
+		table.m_hot->sample(1, key);
+	}
+	m_table = &table;
+	m_patch = patch==nullptr || patch == &table? nullptr : &patch->m_view;
+	m_key = key;
+	m_counters = {};
+	COUNT(m_counters, lookup, 1);
+	bind(m_patch != nullptr? *m_patch : table.m_view);
+	return false;
+}
+
+bool LookupProbe::step() noexcept {
+	auto& pack = *m_pack;
+	switch (m_stage) {
+		case STAGE_DONE:
+			return true;
+		case STAGE_VALUE:
+			m_result = SeparatedValue(pack.extend+ReadOffsetField(m_line+pack.key_len), pack.space_end);
+			return finish();
+		case STAGE_LINE:
+			if (Equal(m_key, m_line, pack.key_len)) {
+				COUNT(m_counters, hit, 1);
+				COUNT(m_counters, patch_hit, m_pack==m_patch);
+				if (pack.type == Hashtable::KV_SEPARATED) {
+					PrefetchForNext(pack.extend+ReadOffsetField(m_line+pack.key_len));
+					m_stage = STAGE_VALUE;
+					return false;
+				}
+				m_result = {m_line+pack.key_len, pack.val_len};
+				return finish();
+			}
+			COUNT(m_counters, false_tag, 1);
+			m_stage = STAGE_SCAN;
+			break;
+		case STAGE_SCAN:
+			break;
+	}
+	//guide of set is in cache now
+	auto g = pack.guide + (m_set << 6U);
+	while (m_cur < m_sft+64U) {
+		auto off = (m_cur++) & 63U;
+		if (g[off] == m_mark) {
+			m_line = pack.content + ((m_set<<6U)+off)*pack.line_size;
+			PrefetchForNext(m_line);
+			PrefetchForNext(m_line+pack.line_size-1U);
+			m_stage = STAGE_LINE;
+			return false;
+		} else if (g[off] & 0x80U) {
+			if (m_pack == m_patch) {
+				bind(m_table->m_view);
+				return false;
+			}
+			return finish();
+		}
+	}
+	//miss in set
+	m_cur = m_sft;
+	if (++m_set >= pack.set_cnt.value()) {
+		m_set = 0;
+	}
+	COUNT(m_counters, set_probe, 1);
+	PrefetchForNext(pack.guide + (m_set<<6U));
+	return false;
+}
+
+unsigned MarkHitSlots(const Hashtable::View& base, unsigned batch, const uint8_t* keys, uint8_t* bitmap) noexcept {
+	const unsigned key_len = base.key_len;
+	Hashtable::Counters counters;
+	return BatchProcess(batch, base, nullptr, counters,
+						[keys, key_len](unsigned idx)->const uint8_t*{
+							return keys + idx*key_len;
+						},
+						[&base, bitmap](unsigned, const uint8_t* val) {
+							if (val != nullptr) {
+								size_t slot = (val - base.key_len - base.content) / base.line_size;
+								__atomic_fetch_or(&bitmap[slot>>3U], (uint8_t)(1U<<(slot&7U)), __ATOMIC_RELAXED);
+							}
+						});
 }
 
 } //ssht
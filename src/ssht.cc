@@ -17,15 +17,167 @@
 //==============================================================================
 
 
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "internal.h"
 
 namespace ssht {
 
-static bool CreateView(const uint8_t* addr, size_t size, Hashtable::View& out) {
+static bool ValidTrailer(const Trailer& trailer, size_t size) {
+	return trailer.magic == TRAILER_MAGIC && trailer.chunk_shift >= 12U && trailer.chunk_shift < 40U
+		&& trailer.data_size >= sizeof(Header) && trailer.data_size <= size
+		&& trailer.data_size + ChunkCount(trailer.data_size, trailer.chunk_shift)*sizeof(uint32_t)
+			+ sizeof(Trailer) == size;
+}
+
+//size without checksum trailer, 0 if trailer is broken or lost
+static size_t DataSize(const uint8_t* addr, size_t size) {
+	if (((const Header*)addr)->trailer != TRAILER_MAGIC) {
+		return size;
+	}
+	Trailer trailer;
+	if (size < sizeof(Header) + sizeof(trailer)) {
+		return 0;
+	}
+	memcpy(&trailer, addr + size - sizeof(trailer), sizeof(trailer));
+	return ValidTrailer(trailer, size)? trailer.data_size : 0;
+}
+
+//run fn for each chunk with all cores, stop once any fails
+template <typename Fn>
+static bool ForEachChunk(size_t cnt, const Fn& fn) {
+	std::atomic<size_t> next(0);
+	std::atomic<bool> ok(true);
+	auto work = [&]() {
+		while (ok.load(std::memory_order_relaxed)) {
+			auto i = next.fetch_add(1, std::memory_order_relaxed);
+			if (i >= cnt) break;
+			if (!fn(i)) {
+				ok.store(false, std::memory_order_relaxed);
+			}
+		}
+	};
+	size_t n = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1U), cnt);
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < n; i++) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (auto& t : threads) {
+		t.join();
+	}
+	return ok.load();
+}
+
+static bool VerifyChunk(const uint8_t* addr, size_t data_size, unsigned shift, const uint8_t* sums, size_t idx) {
+	const size_t off = idx << shift;
+	const size_t len = std::min(data_size - off, (size_t)1 << shift);
+	uint32_t sum;
+	memcpy(&sum, sums + idx*sizeof(uint32_t), sizeof(sum));
+	return Crc32c(0, addr + off, len) == sum;
+}
+
+//pages of mapped file are fetched by verifying threads
+static bool VerifyMapped(const uint8_t* addr, size_t size) {
+	if (((const Header*)addr)->trailer != TRAILER_MAGIC) {
+		Logger::Printf("no checksum to verify\n");
+		return true;
+	}
+	Trailer trailer;
+	memcpy(&trailer, addr + size - sizeof(trailer), sizeof(trailer));
+	const auto sums = addr + trailer.data_size;
+	return ForEachChunk(ChunkCount(trailer.data_size, trailer.chunk_shift), [&](size_t i) {
+		return VerifyChunk(addr, trailer.data_size, trailer.chunk_shift, sums, i);
+	});
+}
+
+static bool ReadAll(int fd, uint8_t* data, size_t len, size_t off) {
+	while (len != 0) {
+		auto n = pread(fd, data, len, off);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) continue;
+			return false;
+		}
+		data += n;
+		off += n;
+		len -= n;
+	}
+	return true;
+}
+
+//read chunks in parallel and verify each one while it is hot in cache
+static MemBlock LoadAndVerify(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		Logger::Printf("fail to open file: %s\n", path);
+		return {};
+	}
+	struct stat stat;
+	Header header;
+	if (fstat(fd, &stat) != 0 || (size_t)stat.st_size < sizeof(header)
+		|| !ReadAll(fd, (uint8_t*)&header, sizeof(header), 0)) {
+		close(fd);
+		return {};
+	}
+	const size_t size = stat.st_size;
+	const bool verify = header.trailer == TRAILER_MAGIC;
+	Trailer trailer;
+	std::vector<uint8_t> sums;
+	if (verify) {
+		if (size < sizeof(header) + sizeof(trailer)
+			|| !ReadAll(fd, (uint8_t*)&trailer, sizeof(trailer), size - sizeof(trailer))
+			|| !ValidTrailer(trailer, size)) {
+			close(fd);
+			return {};
+		}
+		sums.resize(size - sizeof(trailer) - trailer.data_size);
+		if (!ReadAll(fd, sums.data(), sums.size(), trailer.data_size)) {
+			close(fd);
+			return {};
+		}
+	} else {
+		Logger::Printf("no checksum to verify\n");
+		trailer.chunk_shift = CHECKSUM_CHUNK_SHIFT;
+	}
+	MemBlock mem(size);
+	if (!mem) {
+		close(fd);
+		return {};
+	}
+	const unsigned shift = trailer.chunk_shift;
+	bool ok = ForEachChunk(ChunkCount(size, shift), [&](size_t i) {
+		const size_t off = i << shift;
+		if (!ReadAll(fd, mem.addr() + off, std::min(size - off, (size_t)1 << shift), off)) {
+			return false;
+		}
+		return !verify || off >= trailer.data_size
+			|| VerifyChunk(mem.addr(), trailer.data_size, shift, sums.data(), i);
+	});
+	close(fd);
+	if (!ok) {
+		return {};
+	}
+	return mem;
+}
+
+//offsets of regions in file
+struct Layout {
+	size_t guide = 0;
+	size_t content = 0;
+	size_t extend = 0;
+};
+
+//check header against size of data, fill view except addresses
+static bool ParseHeader(const Header* header, size_t size, Hashtable::View& out, Layout& layout) {
 	const size_t guide_off = sizeof(Header);
 	if (size < guide_off) return false;
-
-	auto header = (const Header*)addr;
 	if (header->magic != SSHT_MAGIC || header->set_cnt == 0) {
 		return false;
 	}
@@ -55,24 +207,117 @@ static bool CreateView(const uint8_t* addr, size_t size, Hashtable::View& out) {
 	out.seed = header->seed;
 	out.item = header->item;
 	out.set_cnt = header->set_cnt;
-	out.guide = addr + guide_off;
-	out.content = addr + content_off;
-	out.extend = addr + extend_off;
+	out.slot_ordered = header->type == Hashtable::KV_SEPARATED && (header->flags & FLAG_SLOT_ORDERED) != 0;
+	layout.guide = guide_off;
+	layout.content = content_off;
+	layout.extend = extend_off;
+	return true;
+}
+
+static bool CreateView(const uint8_t* addr, size_t size, Hashtable::View& out) {
+	if (size < sizeof(Header)) return false;
+	size = DataSize(addr, size);
+	Layout layout;
+	if (!ParseHeader((const Header*)addr, size, out, layout)) {
+		return false;
+	}
+	out.guide = addr + layout.guide;
+	out.content = addr + layout.content;
+	out.extend = addr + layout.extend;
 	out.space_end = addr + size;
 	return true;
 }
 
-Hashtable::Hashtable(const std::string& path, LoadPolicy load_policy) {
-	if (load_policy == COPY_DATA) {
-		auto mem = MemBlock::LoadFile(path.c_str());
+//point lookups of slot-ordered table fault single pages of extend, while slot scans read ahead
+//by explicit windows, other tables keep default readahead
+static void AdviseExtend(const Hashtable::View& view) {
+	if (!view.slot_ordered) {
+		return;
+	}
+	static const uintptr_t page = sysconf(_SC_PAGESIZE);
+	auto begin = ((uintptr_t)view.extend + page - 1U) & ~(page-1U);
+	auto end = (uintptr_t)view.space_end & ~(page-1U);
+	if (begin < end && madvise((void*)begin, end - begin, MADV_RANDOM) != 0) {
+		Logger::Printf("fail to madvise extend\n");
+	}
+}
+
+//header and guide are read into memory, content is left in file
+static MemBlock LoadTiered(const char* path, Hashtable::View& view, std::shared_ptr<Tier>& tier) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		Logger::Printf("fail to open file: %s\n", path);
+		return {};
+	}
+	struct stat st;
+	Header header;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)
+		|| pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		close(fd);
+		return {};
+	}
+	size_t size = st.st_size;
+	if (header.trailer == TRAILER_MAGIC) {
+		Trailer trailer;
+		if (size < sizeof(Header) + sizeof(trailer)
+			|| pread(fd, &trailer, sizeof(trailer), size - sizeof(trailer)) != sizeof(trailer)
+			|| !ValidTrailer(trailer, size)) {
+			close(fd);
+			return {};
+		}
+		size = trailer.data_size;
+	}
+	Layout layout;
+	if (!ParseHeader(&header, size, view, layout) || view.type != Hashtable::KV_INLINE) {
+		close(fd);
+		return {};
+	}
+	MemBlock mem(layout.content);
+	if (!mem || !ReadAll(fd, mem.addr(), mem.size(), 0)) {
+		close(fd);
+		return {};
+	}
+	tier = OpenTier(fd, layout.content, size);
+	if (tier == nullptr) {
+		return {};
+	}
+	view.guide = mem.addr() + layout.guide;
+	view.content = nullptr;
+	view.extend = nullptr;
+	view.space_end = nullptr;
+	return mem;
+}
+
+void Hashtable::InitCounter() noexcept {
+#ifdef ENABLE_LOOKUP_COUNTER
+	try {
+		m_counter = std::make_shared<CounterStore>();
+	} catch (const std::bad_alloc&) {
+		m_res = MemMap{};
+		m_mem = MemBlock{};
+		m_view = View{};
+	}
+#endif
+}
+
+Hashtable::Hashtable(const std::string& path, LoadPolicy load_policy, bool verify) {
+	if (load_policy == TIERED) {
+		m_mem = LoadTiered(path.c_str(), m_view, m_tier);
+		if (!m_mem) {
+			m_view = View{};
+			return;
+		}
+	} else if (load_policy == COPY_DATA) {
+		auto mem = verify? LoadAndVerify(path.c_str()) : MemBlock::LoadFile(path.c_str());
 		if (!mem || !CreateView(mem.addr(), mem.size(), m_view)) {
+			if (verify) Logger::Printf("fail to verify: %s\n", path.c_str());
 			return;
 		}
 		m_mem = std::move(mem);
 	} else {
 		MemMap::Policy policy = MemMap::MAP_ONLY;
-		if (load_policy == MAP_FETCH) {
-			policy = MemMap::FETCH;
+		if (load_policy == MAP_FETCH && !verify) {
+			policy = MemMap::FETCH;		//verifying threads will fetch instead
 		} else if (load_policy == MAP_OCCUPY) {
 			policy = MemMap::OCCUPY;
 		}
@@ -80,8 +325,25 @@ Hashtable::Hashtable(const std::string& path, LoadPolicy load_policy) {
 		if (!res || !CreateView(res.addr(), res.size(), m_view)) {
 			return;
 		}
+		if (verify && !VerifyMapped(res.addr(), res.size())) {
+			Logger::Printf("fail to verify: %s\n", path.c_str());
+			m_view = View{};
+			return;
+		}
+		if (policy == MemMap::MAP_ONLY) {
+			AdviseExtend(m_view);
+		}
 		m_res = std::move(res);
 	}
+	InitCounter();
+}
+
+Hashtable::Hashtable(MemBlock&& data) {
+	if (!data || !CreateView(data.addr(), data.size(), m_view)) {
+		return;
+	}
+	m_mem = std::move(data);
+	InitCounter();
 }
 
 } //ssht
\ No newline at end of file
@@ -0,0 +1,157 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <thread>
+#include <algorithm>
+#include "internal.h"
+
+namespace ssht {
+
+namespace {
+struct Counter {
+	Hashtable::Stats stats;
+	uint64_t item = 0;
+	uint64_t hit_probe = 0;
+	uint64_t false_tag = 0;
+	uint64_t miss_scan = 0;
+};
+} //namespace
+
+//tags scanned till empty one (inclusive) from every start position of the set
+static void MissScan(const uint8_t* g, unsigned out[64]) {
+	unsigned dist = 64;
+	for (unsigned i = 128; i-- > 0;) {
+		if (g[i&63U] & 0x80U) {
+			dist = 0;
+		} else if (dist < 64) {
+			dist++;
+		}
+		if (i < 64) {
+			out[i] = dist + 1;
+		}
+	}
+}
+
+static void ScanSets(const Hashtable::View& view, size_t begin, size_t end, Counter& cnt) {
+	const auto set_cnt = view.set_cnt.value();
+	auto& stats = cnt.stats;
+	unsigned scan[64];
+	for (size_t set = begin; set < end; set++) {
+		auto g = view.guide + (set << 6U);
+		unsigned used = 0;
+		for (unsigned i = 0; i < 64; i++) {
+			if (g[i] & 0x80U) {
+				continue;
+			}
+			used++;
+			auto line = view.content + ((set << 6U) + i) * view.line_size;
+			auto [home, mark, sft] = HashKey(line, view.key_len, view.seed, view.set_cnt);
+			const auto dist = (set + set_cnt - home) % set_cnt;
+			if (dist != 0) {
+				stats.overflow++;
+			}
+			const uint64_t probe = dist*64U + ((i - sft) & 63U) + 1U;
+			for (uint64_t j = 0, s = home; j < probe-1; j++) {
+				auto t = view.guide + (s << 6U);
+				if (t[(sft+j) & 63U] == mark) {
+					cnt.false_tag++;
+				}
+				if (((j+1) & 63U) == 0 && ++s >= set_cnt) {
+					s = 0;
+				}
+			}
+			stats.hit_probe[std::min(63U-__builtin_clzll(probe), 15U)]++;
+			stats.max_hit_probe = std::max(stats.max_hit_probe, probe);
+			cnt.hit_probe += probe;
+		}
+		cnt.item += used;
+		stats.occupancy[used]++;
+
+		//full sets lead the scan to following ones
+		uint64_t skip = 0;
+		auto s = set;
+		while (true) {
+			auto t = view.guide + (s << 6U);
+			MissScan(t, scan);
+			if (scan[0] <= 64) break;
+			skip += 64;
+			if (++s >= set_cnt) {
+				s = 0;
+			}
+			if (s == set) return;	//no empty slot at all
+		}
+		for (unsigned i = 0; i < 64; i++) {
+			const uint64_t len = skip + scan[i];
+			stats.max_miss_scan = std::max(stats.max_miss_scan, len);
+			cnt.miss_scan += len;
+		}
+	}
+}
+
+Hashtable::Stats Hashtable::stats() const {
+	if (!*this || m_tier != nullptr) {
+		return {};
+	}
+	const auto set_cnt = m_view.set_cnt.value();
+	const auto ranges = SplitSlots(set_cnt);
+	std::vector<Counter> parts(ranges.size());
+	std::vector<std::thread> threads;
+	threads.reserve(ranges.size());
+	for (unsigned i = 0; i < ranges.size(); i++) {
+		threads.emplace_back([this](size_t begin, size_t end, Counter* cnt){
+			ScanSets(m_view, begin, end, *cnt);
+		}, ranges[i].first>>6U, ranges[i].second>>6U, &parts[i]);
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	Counter sum;
+	auto& out = sum.stats;
+	for (auto& part : parts) {
+		auto& in = part.stats;
+		for (unsigned i = 0; i < 65; i++) {
+			out.occupancy[i] += in.occupancy[i];
+		}
+		for (unsigned i = 0; i < 16; i++) {
+			out.hit_probe[i] += in.hit_probe[i];
+		}
+		out.overflow += in.overflow;
+		out.max_hit_probe = std::max(out.max_hit_probe, in.max_hit_probe);
+		out.max_miss_scan = std::max(out.max_miss_scan, in.max_miss_scan);
+		sum.item += part.item;
+		sum.hit_probe += part.hit_probe;
+		sum.false_tag += part.false_tag;
+		sum.miss_scan += part.miss_scan;
+	}
+
+	const auto slot = set_cnt << 6U;
+	out.guide_size = slot;
+	out.content_size = slot * m_view.line_size;
+	out.extend_size = m_view.space_end - m_view.extend;
+	if (sum.item != 0) {
+		out.avg_hit_probe = sum.hit_probe / (double)sum.item;
+		out.hit_false_tag = sum.false_tag / (double)sum.item;
+	}
+	out.avg_miss_scan = sum.miss_scan / (double)slot;
+	//every tag scanned before the empty one matches by chance of 1/128
+	out.miss_false_tag = (out.avg_miss_scan - 1) / 128;
+	return out;
+}
+
+} //ssht
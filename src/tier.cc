@@ -0,0 +1,418 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+#include <cerrno>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAS_IO_URING
+#endif
+#include "internal.h"
+
+namespace ssht {
+
+#ifndef TIERED_CACHE_SIZE
+#define TIERED_CACHE_SIZE (256U << 20U)
+#endif
+
+static constexpr unsigned READ_BLOCK_SHIFT = 12U;
+static constexpr size_t READ_BLOCK_SIZE = 1U << READ_BLOCK_SHIFT;
+
+//blocks are copied in and out under lock of shard, frames are evicted by clock
+class BlockCache {
+public:
+	bool init(size_t capacity) {
+		const size_t frames = std::max<size_t>(capacity / READ_BLOCK_SIZE / SHARDS, 1U);
+		m_arena = MemBlock(frames * SHARDS * READ_BLOCK_SIZE);
+		if (!m_arena) {
+			return false;
+		}
+		for (unsigned i = 0; i < SHARDS; i++) {
+			auto& shard = m_shards[i];
+			shard.frames = m_arena.addr() + i * frames * READ_BLOCK_SIZE;
+			shard.owner.assign(frames, UINT64_MAX);
+			shard.ref.assign(frames, 0);
+			shard.index.reserve(frames);
+		}
+		return true;
+	}
+
+	bool get(uint64_t block, uint8_t* out) {
+		auto& shard = ShardOf(block);
+		std::lock_guard<std::mutex> guard(shard.lock);
+		auto it = shard.index.find(block);
+		if (it == shard.index.end()) {
+			return false;
+		}
+		shard.ref[it->second] = 1;
+		memcpy(out, shard.frames + (size_t)it->second*READ_BLOCK_SIZE, READ_BLOCK_SIZE);
+		return true;
+	}
+
+	void put(uint64_t block, const uint8_t* in) {
+		auto& shard = ShardOf(block);
+		std::lock_guard<std::mutex> guard(shard.lock);
+		if (shard.index.count(block) != 0) {
+			return;
+		}
+		const auto n = shard.owner.size();
+		while (shard.ref[shard.hand] != 0) {
+			shard.ref[shard.hand] = 0;
+			shard.hand = (shard.hand + 1) % n;
+		}
+		auto frame = shard.hand;
+		shard.hand = (shard.hand + 1) % n;
+		if (shard.owner[frame] != UINT64_MAX) {
+			shard.index.erase(shard.owner[frame]);
+		}
+		shard.owner[frame] = block;
+		shard.index.emplace(block, frame);
+		memcpy(shard.frames + (size_t)frame*READ_BLOCK_SIZE, in, READ_BLOCK_SIZE);
+	}
+
+private:
+	static constexpr unsigned SHARDS = 16;		//top 4 bits of hash
+	struct Shard {
+		std::mutex lock;
+		std::unordered_map<uint64_t,uint32_t> index;
+		std::vector<uint64_t> owner;
+		std::vector<uint8_t> ref;
+		uint32_t hand = 0;
+		uint8_t* frames = nullptr;
+	};
+	Shard m_shards[SHARDS];
+	MemBlock m_arena;
+
+	Shard& ShardOf(uint64_t block) noexcept {
+		return m_shards[(block * 0x9e3779b97f4a7c15ULL) >> 60U];
+	}
+};
+
+struct Tier {
+	int fd = -1;
+	size_t content_off = 0;
+	size_t data_end = 0;
+	BlockCache cache;
+
+	~Tier() noexcept {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+};
+
+std::shared_ptr<Tier> OpenTier(int fd, size_t content_off, size_t data_end) {
+	auto tier = std::make_shared<Tier>();
+	tier->fd = fd;
+	tier->content_off = content_off;
+	tier->data_end = data_end;
+	//slack for uneven shards when whole content fits
+	if (!tier->cache.init(std::min<size_t>(TIERED_CACHE_SIZE, (data_end - content_off)*2 + (READ_BLOCK_SIZE << 5U)))) {
+		return nullptr;
+	}
+	if (posix_fadvise(fd, content_off, data_end - content_off, POSIX_FADV_RANDOM) != 0) {
+		Logger::Printf("fail to fadvise for tiered content\n");
+	}
+	return tier;
+}
+
+//read whole block by pread, bytes beyond file are zero
+static bool ReadBlock(int fd, uint64_t block, uint8_t* buf) {
+	size_t done = 0;
+	while (done < READ_BLOCK_SIZE) {
+		auto n = pread(fd, buf + done, READ_BLOCK_SIZE - done, (block << READ_BLOCK_SHIFT) + done);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		if (n == 0) {
+			memset(buf + done, 0, READ_BLOCK_SIZE - done);
+			break;
+		}
+		done += n;
+	}
+	return true;
+}
+
+#ifdef HAS_IO_URING
+//ring of one thread, set up by raw syscalls, reads of a batch are submitted together
+class Uring {
+public:
+	Uring() noexcept {
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		m_fd = syscall(__NR_io_uring_setup, ENTRIES, &params);
+		if (m_fd < 0) {
+			return;
+		}
+		m_sq_len = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+		m_cq_len = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			m_sq_len = m_cq_len = std::max(m_sq_len, m_cq_len);
+		}
+		m_sqe_len = params.sq_entries*sizeof(io_uring_sqe);
+		m_sq = (uint8_t*)mmap(nullptr, m_sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+							  m_fd, IORING_OFF_SQ_RING);
+		m_cq = (params.features & IORING_FEAT_SINGLE_MMAP)? m_sq
+			: (uint8_t*)mmap(nullptr, m_cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+							 m_fd, IORING_OFF_CQ_RING);
+		m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqe_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+									 m_fd, IORING_OFF_SQES);
+		if (m_sq == MAP_FAILED || m_cq == MAP_FAILED || (void*)m_sqes == MAP_FAILED) {
+			release();
+			return;
+		}
+		m_sq_tail = (unsigned*)(m_sq + params.sq_off.tail);
+		m_sq_mask = *(unsigned*)(m_sq + params.sq_off.ring_mask);
+		m_sq_array = (unsigned*)(m_sq + params.sq_off.array);
+		m_cq_head = (unsigned*)(m_cq + params.cq_off.head);
+		m_cq_tail = (unsigned*)(m_cq + params.cq_off.tail);
+		m_cq_mask = *(unsigned*)(m_cq + params.cq_off.ring_mask);
+		m_cqes = (io_uring_cqe*)(m_cq + params.cq_off.cqes);
+		m_ready = true;
+	}
+	~Uring() noexcept { release(); }
+
+	bool operator!() const noexcept { return !m_ready; }
+
+	//read n blocks, result of each is bytes read or -errno
+	bool read(int fd, unsigned n, const uint64_t* blocks, uint8_t* const* bufs, int* res) noexcept {
+		for (unsigned begin = 0; begin < n; begin += ENTRIES) {
+			const unsigned m = std::min(n - begin, ENTRIES);
+			auto tail = *m_sq_tail;
+			for (unsigned i = 0; i < m; i++, tail++) {
+				auto idx = tail & m_sq_mask;
+				auto& sqe = m_sqes[idx];
+				memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = IORING_OP_READ;
+				sqe.fd = fd;
+				sqe.addr = (uintptr_t)bufs[begin+i];
+				sqe.len = READ_BLOCK_SIZE;
+				sqe.off = blocks[begin+i] << READ_BLOCK_SHIFT;
+				sqe.user_data = begin + i;
+				m_sq_array[idx] = idx;
+			}
+			__atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+			unsigned submitted = 0;
+			unsigned reaped = 0;
+			while (reaped < m) {
+				auto ret = syscall(__NR_io_uring_enter, m_fd, m - submitted, m - reaped, IORING_ENTER_GETEVENTS,
+								   nullptr, 0);
+				if (ret < 0) {
+					if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+					m_ready = false;	//ring is in unknown state
+					return false;
+				}
+				submitted += ret;
+				auto head = *m_cq_head;
+				for (; head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE); head++, reaped++) {
+					auto& cqe = m_cqes[head & m_cq_mask];
+					res[cqe.user_data] = cqe.res;
+				}
+				__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+			}
+		}
+		return true;
+	}
+
+private:
+	static constexpr unsigned ENTRIES = 64;
+	int m_fd = -1;
+	bool m_ready = false;
+	uint8_t* m_sq = (uint8_t*)MAP_FAILED;
+	uint8_t* m_cq = (uint8_t*)MAP_FAILED;
+	io_uring_sqe* m_sqes = (io_uring_sqe*)MAP_FAILED;
+	size_t m_sq_len = 0;
+	size_t m_cq_len = 0;
+	size_t m_sqe_len = 0;
+	unsigned* m_sq_tail = nullptr;
+	unsigned m_sq_mask = 0;
+	unsigned* m_sq_array = nullptr;
+	unsigned* m_cq_head = nullptr;
+	unsigned* m_cq_tail = nullptr;
+	unsigned m_cq_mask = 0;
+	io_uring_cqe* m_cqes = nullptr;
+
+	void release() noexcept {
+		if ((void*)m_sqes != MAP_FAILED) munmap(m_sqes, m_sqe_len);
+		if (m_cq != m_sq && m_cq != (uint8_t*)MAP_FAILED) munmap(m_cq, m_cq_len);
+		if (m_sq != (uint8_t*)MAP_FAILED) munmap(m_sq, m_sq_len);
+		m_sqes = (io_uring_sqe*)MAP_FAILED;
+		m_sq = m_cq = (uint8_t*)MAP_FAILED;
+		if (m_fd >= 0) close(m_fd);
+		m_fd = -1;
+		m_ready = false;
+	}
+};
+#endif
+
+//blocks missing in cache are read together, by io_uring if possible
+static bool ReadBlocks(int fd, unsigned n, const uint64_t* blocks, uint8_t* const* bufs) {
+#ifdef HAS_IO_URING
+	static thread_local Uring ring;
+	if (!!ring) {
+		std::vector<int> res(n);
+		if (ring.read(fd, n, blocks, bufs, res.data())) {
+			for (unsigned i = 0; i < n; i++) {
+				if (res[i] < 0) {
+					return false;
+				}
+				if ((size_t)res[i] < READ_BLOCK_SIZE && !ReadBlock(fd, blocks[i], bufs[i])) {
+					return false;	//short read near end of file, or interrupted
+				}
+			}
+			return true;
+		}
+	}
+#endif
+	for (unsigned i = 0; i < n; i++) {
+		if (!ReadBlock(fd, blocks[i], bufs[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+unsigned TieredFetch(const Hashtable::View& base, Tier& tier, const Hashtable::View* patch, unsigned batch,
+					 const uint8_t* keys, uint8_t* data, const uint8_t* dft_val,
+					 Hashtable::Counters& counters) noexcept {
+	const unsigned key_len = base.key_len;
+	const unsigned val_len = base.val_len;
+	const unsigned line_size = base.line_size;
+	struct Scratch {
+		std::vector<uint8_t> done;
+		std::vector<uint32_t> begin;		//candidates of key i are [begin[i], begin[i+1])
+		std::vector<uint64_t> slots;
+		std::vector<uint64_t> blocks;
+		std::vector<uint8_t> bufs;
+		std::vector<uint64_t> missing;
+		std::vector<uint8_t*> missing_bufs;
+	};
+	static thread_local Scratch s;
+	unsigned hit = 0;
+	COUNT(counters, lookup, batch);
+	try {
+		s.done.assign(batch, 0);
+		s.begin.resize(batch + 1);
+		s.slots.clear();
+		s.blocks.clear();
+		s.missing.clear();
+		s.missing_bufs.clear();
+		//guide in memory tells candidates of each key
+		for (unsigned i = 0; i < batch; i++) {
+			s.begin[i] = s.slots.size();
+			auto key = keys + i*key_len;
+			if (patch != nullptr) {
+				auto field = Search(*patch, key);
+				if (field != nullptr) {
+					memcpy(data + i*val_len, field, val_len);
+					s.done[i] = 1;
+					hit++;
+					COUNT(counters, patch_hit, 1);
+					continue;
+				}
+			}
+			auto [set, mark, sft] = HashKey(key, key_len, base.seed, base.set_cnt);
+			while (true) {
+				COUNT(counters, set_probe, 1);
+				auto g = base.guide + (set << 6U);
+				bool end = false;
+				for (unsigned j = sft; j < sft+64U; j++) {
+					auto off = j & 63U;
+					if (g[off] == mark) {
+						s.slots.push_back((set << 6U) + off);
+					} else if (g[off] & 0x80U) {
+						end = true;
+						break;
+					}
+				}
+				if (end) break;
+				if (++set >= base.set_cnt.value()) {
+					set = 0;
+				}
+			}
+		}
+		s.begin[batch] = s.slots.size();
+
+		for (auto slot : s.slots) {
+			auto off = tier.content_off + slot*line_size;
+			for (auto b = off >> READ_BLOCK_SHIFT; b <= (off + line_size - 1) >> READ_BLOCK_SHIFT; b++) {
+				s.blocks.push_back(b);
+			}
+		}
+		std::sort(s.blocks.begin(), s.blocks.end());
+		s.blocks.erase(std::unique(s.blocks.begin(), s.blocks.end()), s.blocks.end());
+		s.bufs.resize(s.blocks.size() * READ_BLOCK_SIZE);
+		for (unsigned i = 0; i < s.blocks.size(); i++) {
+			auto buf = s.bufs.data() + i*READ_BLOCK_SIZE;
+			if (!tier.cache.get(s.blocks[i], buf)) {
+				s.missing.push_back(s.blocks[i]);
+				s.missing_bufs.push_back(buf);
+			}
+		}
+		if (!s.missing.empty()) {
+			if (!ReadBlocks(tier.fd, s.missing.size(), s.missing.data(), s.missing_bufs.data())) {
+				Logger::Printf("fail to read tiered content\n");
+				return 0;
+			}
+			for (unsigned i = 0; i < s.missing.size(); i++) {
+				tier.cache.put(s.missing[i], s.missing_bufs[i]);
+			}
+		}
+	} catch (const std::bad_alloc&) {
+		return 0;
+	}
+
+	//blocks of one line are adjacent in sorted buffer
+	for (unsigned i = 0; i < batch; i++) {
+		if (s.done[i]) {
+			continue;
+		}
+		auto key = keys + i*key_len;
+		const uint8_t* val = dft_val;
+		for (auto k = s.begin[i]; k < s.begin[i+1]; k++) {
+			auto off = tier.content_off + s.slots[k]*line_size;
+			auto pos = std::lower_bound(s.blocks.begin(), s.blocks.end(), off >> READ_BLOCK_SHIFT) - s.blocks.begin();
+			auto line = s.bufs.data() + pos*READ_BLOCK_SIZE + (off & (READ_BLOCK_SIZE-1));
+			if (Equal(key, line, key_len)) {
+				val = line + key_len;
+				hit++;
+				break;
+			}
+			COUNT(counters, false_tag, 1);
+		}
+		if (val == dft_val) {
+			COUNT(counters, default_fill, dft_val!=nullptr);
+		}
+		if (val != nullptr) {
+			memcpy(data + i*val_len, val, val_len);
+		}
+	}
+	COUNT(counters, hit, hit);
+	return hit;
+}
+
+} //ssht
@@ -20,6 +20,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -178,6 +179,38 @@ FileWriter::FileWriter(const char* path) {
 	}
 	m_buf = std::make_unique<uint8_t[]>(BUFSZ);
 }
+bool MemWriter::write(const void* data, size_t n) noexcept {
+	try {
+		m_buf.append((const char*)data, n);
+	} catch (const std::bad_alloc&) {
+		return false;
+	}
+	return true;
+}
+
+MemBlock MemWriter::release() noexcept {
+	MemBlock out(m_buf.size());
+	if (!out) {
+		return out;
+	}
+	memcpy(out.addr(), m_buf.data(), m_buf.size());
+	m_buf = std::string();
+	return out;
+}
+
+FileWriter FileWriter::Temporary(const char* dir) {
+	FileWriter out;
+	auto path = std::string(dir) + "/ssht-spill-XXXXXX";
+	out.m_fd = mkstemp(&path[0]);
+	if (out.m_fd < 0) {
+		Logger::Printf("fail to create temporary file in: %s\n", dir);
+		return out;
+	}
+	unlink(path.c_str());
+	out.m_buf = std::make_unique<uint8_t[]>(BUFSZ);
+	return out;
+}
+
 FileWriter::~FileWriter() noexcept {
 	if (m_fd >= 0) {
 		_flush();
@@ -93,12 +93,12 @@ public:
 	bool write(const void*, size_t) noexcept override;
 };
 
-bool FakeWriter::operator!() const noexcept {
+inline bool FakeWriter::operator!() const noexcept {
 	return false;
 }
-bool FakeWriter::flush() noexcept {
+inline bool FakeWriter::flush() noexcept {
 	return true;
 }
-bool FakeWriter::write(const void *, size_t) noexcept {
+inline bool FakeWriter::write(const void *, size_t) noexcept {
 	return true;
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstring>
+#include <vector>
+#include <gtest/gtest.h>
+#include <ssht_c.h>
+
+static constexpr unsigned ITEM = 2000;
+
+struct Counter {
+	uint64_t begin;
+	uint64_t current;
+	uint64_t end;
+	uint64_t key;
+	uint32_t val;
+};
+
+static ssht_reader CounterReader(Counter& counter) {
+	ssht_reader reader;
+	reader.ctx = &counter;
+	reader.reset = [](void* ctx) {
+		auto c = (Counter*)ctx;
+		c->current = c->begin;
+	};
+	reader.total = [](void* ctx) -> size_t {
+		auto c = (Counter*)ctx;
+		return c->end - c->begin;
+	};
+	reader.read = [](void* ctx, int, ssht_record* out) {
+		auto c = (Counter*)ctx;
+		c->key = c->current++;
+		c->val = c->key * 3;
+		out->key = (const uint8_t*)&c->key;
+		out->key_len = sizeof(c->key);
+		out->val = (const uint8_t*)&c->val;
+		out->val_len = sizeof(c->val);
+	};
+	return reader;
+}
+
+TEST(CAPI, Callback) {
+	const char* path = "capi-dict.ssht";
+	Counter counters[2] = {{0, 0, ITEM/2, 0, 0}, {ITEM/2, ITEM/2, ITEM, 0, 0}};
+	ssht_reader readers[2] = {CounterReader(counters[0]), CounterReader(counters[1])};
+	ASSERT_EQ(ssht_build_dict(readers, 2, path), SSHT_BUILD_OK);
+	ASSERT_EQ(ssht_build_dict(readers, 0, path), SSHT_BUILD_BAD_INPUT);
+	ASSERT_EQ(ssht_build_dict(readers, 2, path), SSHT_BUILD_OK);
+
+	ASSERT_EQ(ssht_open("not-exist.ssht", SSHT_MAP_ONLY), nullptr);
+	ASSERT_EQ(ssht_open(path, 7), nullptr);
+	for (int policy : {SSHT_MAP_ONLY, SSHT_MAP_FETCH, SSHT_MAP_OCCUPY, SSHT_COPY_DATA}) {
+		auto table = ssht_open(path, policy);
+		ASSERT_NE(table, nullptr);
+		ASSERT_EQ(ssht_type(table), SSHT_KV_INLINE);
+		ASSERT_EQ(ssht_key_len(table), sizeof(uint64_t));
+		ASSERT_EQ(ssht_val_len(table), sizeof(uint32_t));
+		ASSERT_EQ(ssht_item(table), ITEM);
+		for (uint64_t key = 0; key < ITEM+10; key++) {
+			size_t len = 0;
+			auto val = ssht_search(table, (const uint8_t*)&key, &len);
+			if (key < ITEM) {
+				ASSERT_NE(val, nullptr);
+				ASSERT_EQ(len, sizeof(uint32_t));
+				uint32_t v;
+				memcpy(&v, val, sizeof(v));
+				ASSERT_EQ(v, key*3);
+			} else {
+				ASSERT_EQ(val, nullptr);
+			}
+		}
+		ssht_close(table);
+	}
+}
+
+TEST(CAPI, Array) {
+	std::vector<uint64_t> keys(ITEM);
+	std::vector<uint32_t> vals(ITEM);
+	for (unsigned i = 0; i < ITEM; i++) {
+		keys[i] = i;
+		vals[i] = i * 3;
+	}
+	ssht_array in;
+	memset(&in, 0, sizeof(in));
+	in.keys = (const uint8_t*)keys.data();
+	in.key_len = sizeof(uint64_t);
+	in.item = ITEM;
+	in.vals = (const uint8_t*)vals.data();
+	in.val_len = sizeof(uint32_t);
+	ASSERT_EQ(ssht_build_dict_from_array(&in, 3, "capi-base.ssht"), SSHT_BUILD_OK);
+	auto base = ssht_open("capi-base.ssht", SSHT_MAP_ONLY);
+	ASSERT_NE(base, nullptr);
+
+	//patch changes the first half and adds some new keys
+	for (unsigned i = 0; i < ITEM; i++) {
+		keys[i] = i + ITEM/2;
+		vals[i] = i + 1;
+	}
+	ASSERT_EQ(ssht_derive_from_array(base, &in, 0, "capi-patch.ssht"), SSHT_BUILD_OK);
+	auto patch = ssht_open("capi-patch.ssht", SSHT_MAP_ONLY);
+	ASSERT_NE(patch, nullptr);
+
+	std::vector<uint64_t> query(ITEM*2);
+	for (unsigned i = 0; i < query.size(); i++) {
+		query[i] = i;
+	}
+	std::vector<uint32_t> out(query.size());
+	const uint32_t dft = UINT32_MAX;
+	ASSERT_EQ(ssht_batch_fetch(base, query.size(), (const uint8_t*)query.data(), (uint8_t*)out.data(),
+							   (const uint8_t*)&dft, nullptr), ITEM);
+	ASSERT_EQ(out[ITEM-1], (ITEM-1)*3);
+	ASSERT_EQ(out[ITEM], dft);
+	ASSERT_EQ(ssht_batch_fetch(base, query.size(), (const uint8_t*)query.data(), (uint8_t*)out.data(),
+							   (const uint8_t*)&dft, patch), ITEM*3/2);
+	ASSERT_EQ(out[ITEM/2-1], (ITEM/2-1)*3);
+	ASSERT_EQ(out[ITEM/2], 1U);
+	ASSERT_EQ(out[ITEM*3/2-1], ITEM);
+	ASSERT_EQ(out[ITEM*3/2], dft);
+
+	std::vector<const uint8_t*> ptrs(query.size());
+	for (unsigned i = 0; i < query.size(); i++) {
+		ptrs[i] = (const uint8_t*)&query[i];
+	}
+	ASSERT_EQ(ssht_batch_search(base, ptrs.size(), ptrs.data(), ptrs.data(), patch), ITEM*3/2);
+
+	ssht_close(patch);
+	ssht_close(base);
+
+	std::vector<uint64_t> offsets(ITEM+1);
+	for (unsigned i = 0; i < ITEM; i++) {
+		offsets[i+1] = offsets[i] + i%4;
+	}
+	in.offsets = offsets.data();
+	ASSERT_EQ(ssht_build_dict_with_varied_value_from_array(&in, 2, "capi-varied.ssht"), SSHT_BUILD_OK);
+	auto varied = ssht_open("capi-varied.ssht", SSHT_COPY_DATA);
+	ASSERT_NE(varied, nullptr);
+	ASSERT_EQ(ssht_type(varied), SSHT_KV_SEPARATED);
+	size_t len = 0;
+	ASSERT_NE(ssht_search(varied, (const uint8_t*)&keys[7], &len), nullptr);
+	ASSERT_EQ(len, 3U);
+	ssht_close(varied);
+
+	in.vals = nullptr;
+	ASSERT_EQ(ssht_build_set_from_array(&in, 1, "capi-set.ssht"), SSHT_BUILD_OK);
+	auto set = ssht_open("capi-set.ssht", SSHT_MAP_FETCH);
+	ASSERT_NE(set, nullptr);
+	ASSERT_EQ(ssht_type(set), SSHT_KEY_SET);
+	ASSERT_EQ(ssht_item(set), ITEM);
+	ssht_close(set);
+}
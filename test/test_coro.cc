@@ -0,0 +1,127 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <gtest/gtest.h>
+#include <ssht_coro.h>
+#include "test.h"
+
+static constexpr unsigned PIECE = 1000;
+
+//starts eagerly and frees itself at the end
+struct Task {
+	struct promise_type {
+		Task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+static Task FetchRange(ssht::LookupScheduler& scheduler, const ssht::Hashtable& base, const ssht::Hashtable* patch,
+					   uint64_t begin, uint64_t end, unsigned& hit, unsigned& match) {
+	for (uint64_t key = begin; key < end; key++) {
+		auto val = co_await scheduler.search(base, (const uint8_t*)&key, patch);
+		if (val.ptr == nullptr) {
+			continue;
+		}
+		hit++;
+		auto mask = patch != nullptr && key < PIECE? EmbeddingGenerator::MASK0 : EmbeddingGenerator::MASK1;
+		uint64_t expect = key ^ mask;
+		if (val.len == EmbeddingGenerator::VALUE_SIZE && memcmp(val.ptr, &expect, sizeof(expect)) == 0) {
+			match++;
+		}
+	}
+}
+
+TEST(Coroutine, SearchWithPatch) {
+	const std::string base_filename = "coro-base.ssht";
+	const std::string patch_filename = "coro-patch.ssht";
+	{
+		ssht::FileWriter base_output(base_filename.c_str());
+		ssht::DataReaders base_input;
+		base_input.push_back(std::make_unique<EmbeddingGenerator>(0, PIECE*2, EmbeddingGenerator::MASK1));
+		ASSERT_EQ(ssht::BuildDict(base_input, base_output), ssht::BUILD_STATUS_OK);
+		ssht::FileWriter patch_output(patch_filename.c_str());
+		ssht::DataReaders patch_input;
+		patch_input.push_back(std::make_unique<EmbeddingGenerator>(0, PIECE, EmbeddingGenerator::MASK0));
+		ASSERT_EQ(ssht::BuildDict(patch_input, patch_output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable base(base_filename);
+	ASSERT_FALSE(!base);
+	ssht::Hashtable patch(patch_filename);
+	ASSERT_FALSE(!patch);
+
+	ssht::LookupScheduler scheduler;
+	unsigned hit = 0;
+	unsigned match = 0;
+	for (unsigned i = 0; i < 30; i++) {
+		FetchRange(scheduler, base, &patch, i*100, (i+1)*100, hit, match);
+	}
+	ASSERT_EQ(scheduler.pending(), 30);
+	scheduler.run();
+	ASSERT_EQ(scheduler.pending(), 0);
+	ASSERT_EQ(hit, PIECE*2);
+	ASSERT_EQ(match, PIECE*2);
+
+	//bad patch finishes without suspending
+	hit = 0;
+	match = 0;
+	ssht::Hashtable bad("not-exist.ssht");
+	FetchRange(scheduler, base, &bad, 0, 10, hit, match);
+	ASSERT_EQ(scheduler.pending(), 0);
+	ASSERT_EQ(hit, 0);
+}
+
+static Task SearchAll(ssht::LookupScheduler& scheduler, const ssht::Hashtable& dict, uint64_t begin, uint64_t end,
+					  unsigned& match) {
+	VariedValueGenerator checker(begin, end-begin);
+	for (uint64_t i = begin; i < end; i++) {
+		auto rec = checker.read(false);
+		auto val = co_await scheduler.search(dict, rec.key.ptr);
+		auto expect = dict.search(rec.key.ptr);
+		if (val.ptr == expect.ptr && val.len == expect.len && (i >= PIECE) == (val.ptr == nullptr)) {
+			match++;
+		}
+	}
+}
+
+TEST(Coroutine, SearchVariedDict) {
+	const std::string filename = "coro-varied.ssht";
+	{
+		ssht::FileWriter output(filename.c_str());
+		ssht::DataReaders input;
+		input.push_back(std::make_unique<VariedValueGenerator>(0, PIECE));
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable dict(filename);
+	ASSERT_FALSE(!dict);
+
+	ssht::LookupScheduler scheduler;
+	unsigned match = 0;
+	for (unsigned i = 0; i < 20; i++) {
+		SearchAll(scheduler, dict, i*100, (i+1)*100, match);
+	}
+	scheduler.run();
+	ASSERT_EQ(match, PIECE*2);
+}
@@ -17,7 +17,10 @@
 //==============================================================================
 
 #include <cstring>
+#include <algorithm>
 #include <memory>
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <string>
 #include <gtest/gtest.h>
@@ -210,6 +213,235 @@ TEST(SSHT, VariedDict) {
 }
 
 
+class OnceReader : public VariedValueGenerator {
+public:
+	OnceReader(uint64_t begin, uint64_t total) : VariedValueGenerator(begin, total) {}
+	void reset() override {
+		resets++;
+		VariedValueGenerator::reset();
+	}
+	unsigned resets = 0;
+};
+
+TEST(SSHT, SpilledVariedDict) {
+	const std::string filename = "spill-dict.ssht";
+	std::vector<OnceReader*> readers;
+	ssht::DataReaders input;
+	for (unsigned i = 0; i < 2; i++) {
+		auto reader = std::make_unique<OnceReader>(PIECE*i, PIECE);
+		readers.push_back(reader.get());
+		input.push_back(std::move(reader));
+	}
+	ssht::BuildOptions options;
+	options.spill_dir = ".";
+	{
+		ssht::FileWriter output(filename.c_str());
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, output, options), ssht::BUILD_STATUS_OK);
+	}
+	for (auto reader : readers) {
+		ASSERT_EQ(reader->resets, 0U);
+	}
+	ssht::Hashtable dict(filename);
+	ASSERT_FALSE(!dict);
+	ASSERT_EQ(dict.item(), PIECE*2);
+
+	VariedValueGenerator checker(0, PIECE*2);
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		auto rec = checker.read(false);
+		auto val = dict.search(rec.key.ptr);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(val.len, rec.val.len);
+		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+	}
+
+	options.spill_dir = "/not-exist";
+	FakeWriter fake_output;
+	ASSERT_EQ(ssht::BuildDictWithVariedValue(input, fake_output, options), ssht::BUILD_STATUS_FAIL_TO_OUTPUT);
+
+	//leading empty reader is skipped as without spill
+	ssht::DataReaders sparse;
+	sparse.push_back(std::make_unique<OnceReader>(0, 0));
+	sparse.push_back(std::make_unique<OnceReader>(0, PIECE));
+	options.spill_dir = ".";
+	{
+		ssht::FileWriter output(filename.c_str());
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(sparse, output, options), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable part(filename);
+	ASSERT_FALSE(!part);
+	ASSERT_EQ(part.item(), PIECE);
+	VariedValueGenerator first(0, 1);
+	ASSERT_NE(part.search(first.read(true).key.ptr).ptr, nullptr);
+
+	//options which read input again conflict with spill
+	options.slot_order = true;
+	ASSERT_EQ(ssht::BuildDictWithVariedValue(sparse, fake_output, options), ssht::BUILD_STATUS_BAD_INPUT);
+	options.slot_order = false;
+	OnceReader hot_keys(0, 1);
+	options.hot_keys = &hot_keys;
+	ASSERT_EQ(ssht::BuildDictWithVariedValue(sparse, fake_output, options), ssht::BUILD_STATUS_BAD_INPUT);
+}
+
+//total is unknown, ends with a record of null key
+template <typename Generator>
+class StreamReader : public ssht::IDataReader {
+public:
+	StreamReader(uint64_t begin, uint64_t total) : m_core(begin, total), m_left(total) {}
+	void reset() override {}
+	size_t total() override { return 0; }
+	ssht::Record read(bool key_only) override {
+		if (m_left == 0) {
+			return {};
+		}
+		m_left--;
+		return m_core.read(key_only);
+	}
+private:
+	Generator m_core;
+	uint64_t m_left;
+};
+
+TEST(SSHT, StreamBuild) {
+	const std::string filename = "stream.ssht";
+	auto create_input = [](auto* dummy) {
+		using Reader = std::remove_pointer_t<decltype(dummy)>;
+		ssht::DataReaders input;
+		input.push_back(std::make_unique<Reader>(0, PIECE));
+		input.push_back(std::make_unique<Reader>(PIECE, 0));
+		input.push_back(std::make_unique<Reader>(PIECE, PIECE*2));
+		return input;
+	};
+	ssht::BuildOptions options;
+	options.spill_dir = ".";
+	{
+		ssht::FileWriter output(filename.c_str());
+		auto input = create_input((StreamReader<EmbeddingGenerator>*)nullptr);
+		ASSERT_EQ(ssht::BuildFromStream(ssht::Hashtable::KV_INLINE, input, output, options), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable dict(filename);
+	ASSERT_FALSE(!dict);
+	ASSERT_EQ(dict.type(), ssht::Hashtable::KV_INLINE);
+	ASSERT_EQ(dict.item(), PIECE*3);
+	EmbeddingGenerator checker(0, PIECE*3);
+	for (unsigned i = 0; i < PIECE*3; i++) {
+		auto rec = checker.read(false);
+		auto val = dict.search(rec.key.ptr);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+	}
+
+	{
+		ssht::FileWriter output(filename.c_str());
+		auto input = create_input((StreamReader<VariedValueGenerator>*)nullptr);
+		ASSERT_EQ(ssht::BuildFromStream(ssht::Hashtable::KV_SEPARATED, input, output, options), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable varied(filename);
+	ASSERT_FALSE(!varied);
+	ASSERT_EQ(varied.type(), ssht::Hashtable::KV_SEPARATED);
+	ASSERT_EQ(varied.item(), PIECE*3);
+	VariedValueGenerator varied_checker(0, PIECE*3);
+	for (unsigned i = 0; i < PIECE*3; i++) {
+		auto rec = varied_checker.read(false);
+		auto val = varied.search(rec.key.ptr);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(val.len, rec.val.len);
+		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+	}
+
+	FakeWriter fake_output;
+	auto input = create_input((StreamReader<EmbeddingGenerator>*)nullptr);
+	ASSERT_EQ(ssht::BuildFromStream(ssht::Hashtable::KEY_SET, input, fake_output, options), ssht::BUILD_STATUS_OK);
+	//varied values are not accepted by inline dict
+	input = create_input((StreamReader<VariedValueGenerator>*)nullptr);
+	ASSERT_EQ(ssht::BuildFromStream(ssht::Hashtable::KV_INLINE, input, fake_output, options), ssht::BUILD_STATUS_BAD_INPUT);
+	input.clear();
+	input.push_back(std::make_unique<StreamReader<EmbeddingGenerator>>(0, 0));
+	ASSERT_EQ(ssht::BuildFromStream(ssht::Hashtable::KEY_SET, input, fake_output, options), ssht::BUILD_STATUS_BAD_INPUT);
+}
+
+class KeyListReader : public ssht::IDataReader {
+public:
+	explicit KeyListReader(std::vector<uint64_t> keys) : m_keys(std::move(keys)) {}
+	void reset() override { m_current = 0; }
+	size_t total() override { return m_keys.size(); }
+	ssht::Record read(bool) override {
+		return {{(const uint8_t*)&m_keys[m_current++], sizeof(uint64_t)}, {}};
+	}
+private:
+	std::vector<uint64_t> m_keys;
+	size_t m_current = 0;
+};
+
+TEST(SSHT, HotFirstLayout) {
+	KeyListReader hot_keys({PIECE+500, 7, 42, PIECE*5});	//the last one is absent
+	ssht::BuildOptions options;
+	options.hot_keys = &hot_keys;
+
+	const std::string filename = "hot-first.ssht";
+	{
+		ssht::FileWriter output(filename.c_str());
+		auto input = CreateReaders<EmbeddingGenerator>(2, EmbeddingGenerator::MASK0);
+		ASSERT_EQ(ssht::BuildDict(input, output, options), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable dict(filename);
+	ASSERT_FALSE(!dict);
+	ASSERT_EQ(dict.item(), PIECE*2);
+	EmbeddingGenerator checker(0, PIECE*2);
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		auto rec = checker.read(false);
+		auto val = dict.search(rec.key.ptr);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+	}
+
+	{
+		ssht::FileWriter output(filename.c_str());
+		auto input = CreateReaders<VariedValueGenerator>(2, 5U);
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, output, options), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable varied(filename);
+	ASSERT_FALSE(!varied);
+	ASSERT_EQ(varied.item(), PIECE*2);
+	VariedValueGenerator varied_checker(0, PIECE*2);
+	const uint8_t* last = nullptr;
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		auto rec = varied_checker.read(false);
+		auto val = varied.search(rec.key.ptr);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(val.len, rec.val.len);
+		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+		last = std::max(last, val.ptr);
+	}
+	//values of hot keys are clustered ahead in rank order
+	std::vector<const uint8_t*> hot_vals;
+	for (uint64_t key : std::vector<uint64_t>{PIECE+500, 7, 42, 0, PIECE*2-1}) {
+		hot_vals.push_back(varied.search((const uint8_t*)&key).ptr);
+	}
+	ASSERT_LT(hot_vals[0], hot_vals[1]);
+	ASSERT_LT(hot_vals[1], hot_vals[2]);
+	ASSERT_LT(hot_vals[2], hot_vals[3]);
+	ASSERT_EQ(hot_vals[4], last);
+
+	//hot keys appearing twice in input are rejected by every build
+	FakeWriter fake_output;
+	for (uint64_t dup : {7UL, 8UL}) {
+		ssht::DataReaders input;
+		input.push_back(std::make_unique<VariedValueGenerator>(0, PIECE));
+		input.push_back(std::make_unique<VariedValueGenerator>(dup, 1));
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, fake_output, options), ssht::BUILD_STATUS_BAD_INPUT);
+	}
+	for (bool key_only : {false, true}) {
+		ssht::DataReaders input;
+		input.push_back(std::make_unique<EmbeddingGenerator>(0, PIECE));
+		input.push_back(std::make_unique<EmbeddingGenerator>(7, 1));
+		auto build = key_only? ssht::BuildSet : ssht::BuildDict;
+		ASSERT_EQ(build(input, fake_output, options), ssht::BUILD_STATUS_BAD_INPUT);
+		//other duplicates are still dropped by fixed-size builds
+		input[1] = std::make_unique<EmbeddingGenerator>(8, 1);
+		ASSERT_EQ(build(input, fake_output, options), ssht::BUILD_STATUS_OK);
+	}
+}
+
 TEST(SSHT, FetchWithPatch) {
 	const std::string base_filename = "base.ssht";
 	const std::string patch_filename = "patch.ssht";
@@ -261,6 +493,148 @@ TEST(SSHT, FetchWithPatch) {
 	}
 }
 
+TEST(SSHT, TieredFetch) {
+	const std::string base_filename = "base.ssht";
+	const std::string patch_filename = "patch.ssht";
+	{
+		ssht::FileWriter base_output(base_filename.c_str());
+		auto base_input = CreateReaders<EmbeddingGenerator>(2, EmbeddingGenerator::MASK1);
+		ASSERT_EQ(ssht::BuildDict(base_input, base_output), ssht::BUILD_STATUS_OK);
+		ssht::FileWriter patch_output(patch_filename.c_str());
+		auto patch_input = CreateReaders<EmbeddingGenerator>(1, EmbeddingGenerator::MASK0);
+		ASSERT_EQ(ssht::BuildDict(patch_input, patch_output), ssht::BUILD_STATUS_OK);
+	}
+
+	ssht::Hashtable base(base_filename, ssht::Hashtable::TIERED);
+	ASSERT_FALSE(!base);
+	ASSERT_EQ(base.item(), PIECE*2);
+	ssht::Hashtable patch(patch_filename);
+	ASSERT_FALSE(!patch);
+
+	uint64_t key = 1;
+	ASSERT_EQ(base.search((const uint8_t*)&key).ptr, nullptr);
+	ASSERT_EQ(patch.batch_fetch(1, (const uint8_t*)&key, nullptr, nullptr, &base), 0);
+
+	std::vector<uint64_t> keys(PIECE*3);
+	for (unsigned i = 0; i < keys.size(); i++) {
+		keys[i] = i;
+	}
+	uint8_t dft_val[EmbeddingGenerator::VALUE_SIZE];
+	memset(dft_val, 0xff, sizeof(dft_val));
+	auto buf_sz = keys.size()*EmbeddingGenerator::VALUE_SIZE;
+	auto buf = std::make_unique<uint8_t[]>(buf_sz);
+
+	//second round hits block cache
+	for (unsigned round = 0; round < 2; round++) {
+		memset(buf.get(), 0, buf_sz);
+		ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), buf.get(), dft_val, &patch), PIECE*2);
+
+		EmbeddingGenerator checker0(0, PIECE, EmbeddingGenerator::MASK0);
+		EmbeddingGenerator checker1(PIECE, PIECE, EmbeddingGenerator::MASK1);
+		auto line = buf.get();
+		for (unsigned i = 0; i < PIECE*3; i++) {
+			const uint8_t* val = dft_val;
+			if (i < PIECE) {
+				val = checker0.read(false).val.ptr;
+			} else if (i < PIECE*2) {
+				val = checker1.read(false).val.ptr;
+			}
+			ASSERT_EQ(memcmp(val, line, EmbeddingGenerator::VALUE_SIZE), 0);
+			line += EmbeddingGenerator::VALUE_SIZE;
+		}
+	}
+}
+
+TEST(SSHT, HotCache) {
+	const std::string base_filename = "hot-base.ssht";
+	const std::string patch_filename = "hot-patch.ssht";
+	{
+		ssht::FileWriter base_output(base_filename.c_str());
+		auto base_input = CreateReaders<EmbeddingGenerator>(2, EmbeddingGenerator::MASK1);
+		ASSERT_EQ(ssht::BuildDict(base_input, base_output), ssht::BUILD_STATUS_OK);
+		ssht::FileWriter patch_output(patch_filename.c_str());
+		auto patch_input = CreateReaders<EmbeddingGenerator>(1, EmbeddingGenerator::MASK0);
+		ASSERT_EQ(ssht::BuildDict(patch_input, patch_output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable base(base_filename);
+	ASSERT_FALSE(!base);
+	ssht::Hashtable patch(patch_filename);
+	ASSERT_FALSE(!patch);
+
+	ssht::HotCache cache(base, 1024, 0);
+	ASSERT_FALSE(!cache);
+	ASSERT_EQ(cache.table(), nullptr);
+	base.attach(&cache);
+
+	//keys over 2*PIECE are missing, they should not be cached
+	std::vector<uint64_t> hot_keys = {5, 6, 7, PIECE+5, PIECE+6, PIECE+7, PIECE*3, PIECE*3+1};
+	std::vector<uint8_t> buf(hot_keys.size()*EmbeddingGenerator::VALUE_SIZE);
+	for (unsigned i = 0; i < 100; i++) {
+		base.batch_fetch(hot_keys.size(), (const uint8_t*)hot_keys.data(), buf.data());
+	}
+	std::vector<uint64_t> keys(PIECE*2);
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		keys[i] = i;
+	}
+	buf.resize(keys.size()*EmbeddingGenerator::VALUE_SIZE);
+	ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), buf.data()), PIECE*2);
+
+	ASSERT_TRUE(cache.refresh(6));
+	auto hot = cache.table();
+	ASSERT_NE(hot, nullptr);
+	ASSERT_EQ(hot->item(), 6U);
+	for (unsigned i = 0; i < 6; i++) {
+		ASSERT_NE(hot->search((const uint8_t*)&hot_keys[i]).ptr, nullptr);
+	}
+
+	//patch is still preferred to hot table
+	memset(buf.data(), 0, buf.size());
+	ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), buf.data(), nullptr, &patch), PIECE*2);
+	EmbeddingGenerator checker0(0, PIECE, EmbeddingGenerator::MASK0);
+	EmbeddingGenerator checker1(PIECE, PIECE, EmbeddingGenerator::MASK1);
+	auto line = buf.data();
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		auto val = i < PIECE? checker0.read(false).val : checker1.read(false).val;
+		ASSERT_EQ(memcmp(val.ptr, line, EmbeddingGenerator::VALUE_SIZE), 0);
+		line += EmbeddingGenerator::VALUE_SIZE;
+	}
+	memset(buf.data(), 0, buf.size());
+	ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), buf.data()), PIECE*2);
+	EmbeddingGenerator checker(0, PIECE*2, EmbeddingGenerator::MASK1);
+	line = buf.data();
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		ASSERT_EQ(memcmp(checker.read(false).val.ptr, line, EmbeddingGenerator::VALUE_SIZE), 0);
+		line += EmbeddingGenerator::VALUE_SIZE;
+	}
+
+	//lookups only pin the table, so the retired one is released by refresh at once
+	ASSERT_EQ(hot.use_count(), 2);
+	ASSERT_TRUE(cache.refresh(3));
+	ASSERT_EQ(hot.use_count(), 1);
+	ASSERT_EQ(cache.table()->item(), 3U);
+
+	//tables are swapped under running lookups
+	std::atomic<bool> stop{false};
+	std::thread worker([&base, &keys, &stop]() {
+		std::vector<uint8_t> out(keys.size()*EmbeddingGenerator::VALUE_SIZE);
+		while (!stop.load()) {
+			ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), out.data()), PIECE*2);
+			EmbeddingGenerator checker(0, PIECE*2, EmbeddingGenerator::MASK1);
+			for (unsigned i = 0; i < PIECE*2; i++) {
+				ASSERT_EQ(memcmp(checker.read(false).val.ptr, out.data()+i*EmbeddingGenerator::VALUE_SIZE,
+								 EmbeddingGenerator::VALUE_SIZE), 0);
+			}
+		}
+	});
+	for (unsigned i = 0; i < 20; i++) {
+		ASSERT_TRUE(cache.refresh(i%2 == 0? 6 : 0));
+		std::this_thread::yield();
+	}
+	stop.store(true);
+	worker.join();
+	base.attach(nullptr);
+}
+
 TEST(SSHT, RebuildInlinedDict) {
 	std::string filename = "dict-old.ssht";
 	{
@@ -351,3 +725,441 @@ TEST(SSHT, RebuildVariedDict) {
 		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
 	}
 }
+
+TEST(SSHT, Diff) {
+	const std::string old_filename = "diff-old.ssht";
+	const std::string new_filename = "diff-new.ssht";
+	const std::string patch_filename = "diff-patch.ssht";
+	const std::string tombstone_filename = "diff-tombstone.bin";
+	{
+		ssht::FileWriter old_output(old_filename.c_str());
+		auto old_input = CreateReaders<EmbeddingGenerator>(2, EmbeddingGenerator::MASK1);
+		ASSERT_EQ(ssht::BuildDict(old_input, old_output), ssht::BUILD_STATUS_OK);
+		ssht::FileWriter new_output(new_filename.c_str());
+		ssht::DataReaders new_input;
+		new_input.push_back(std::make_unique<EmbeddingGenerator>(PIECE/2, PIECE/2, EmbeddingGenerator::MASK0));
+		new_input.push_back(std::make_unique<EmbeddingGenerator>(PIECE, PIECE*2, EmbeddingGenerator::MASK1));
+		ASSERT_EQ(ssht::BuildDict(new_input, new_output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable base(old_filename);
+	ASSERT_FALSE(!base);
+	{
+		ssht::Hashtable neo(new_filename);
+		ASSERT_FALSE(!neo);
+		ssht::FileWriter patch_output(patch_filename.c_str());
+		ssht::FileWriter tombstone_output(tombstone_filename.c_str());
+		ASSERT_EQ(ssht::Diff(base, neo, patch_output, &tombstone_output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable patch(patch_filename);
+	ASSERT_FALSE(!patch);
+	ASSERT_EQ(patch.item(), PIECE/2+PIECE);
+
+	auto tombstone = ssht::MemBlock::LoadFile(tombstone_filename.c_str());
+	ASSERT_EQ(tombstone.size(), (PIECE/2)*sizeof(uint64_t));
+	auto gone = (const uint64_t*)tombstone.addr();
+	for (unsigned i = 0; i < PIECE/2; i++) {
+		ASSERT_LT(gone[i], PIECE/2);
+	}
+
+	std::vector<uint64_t> keys(PIECE*5/2);
+	for (unsigned i = 0; i < keys.size(); i++) {
+		keys[i] = PIECE/2 + i;
+	}
+	auto buf_sz = keys.size()*EmbeddingGenerator::VALUE_SIZE;
+	auto buf = std::make_unique<uint8_t[]>(buf_sz);
+	ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), buf.get(), nullptr, &patch), keys.size());
+
+	EmbeddingGenerator checker0(PIECE/2, PIECE/2, EmbeddingGenerator::MASK0);
+	EmbeddingGenerator checker1(PIECE, PIECE*2, EmbeddingGenerator::MASK1);
+	auto line = buf.get();
+	for (unsigned i = 0; i < keys.size(); i++) {
+		auto val = (i < PIECE/2 ? checker0 : checker1).read(false).val;
+		ASSERT_EQ(memcmp(val.ptr, line, EmbeddingGenerator::VALUE_SIZE), 0);
+		line += EmbeddingGenerator::VALUE_SIZE;
+	}
+}
+
+TEST(SSHT, Stats) {
+	const std::string filename = "stats.ssht";
+	{
+		ssht::FileWriter output(filename.c_str());
+		auto input = CreateReaders<VariedValueGenerator>(2, 5U);
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable dict(filename);
+	ASSERT_FALSE(!dict);
+	auto stats = dict.stats();
+	ASSERT_EQ(stats.guide_size % 64U, 0);
+	ASSERT_EQ(stats.content_size, stats.guide_size*(dict.key_len()+dict.val_len()));
+	ASSERT_GT(stats.extend_size, 0);
+
+	uint64_t sets = 0, items = 0;
+	for (unsigned i = 0; i <= 64; i++) {
+		sets += stats.occupancy[i];
+		items += stats.occupancy[i] * i;
+	}
+	ASSERT_EQ(sets, stats.guide_size / 64U);
+	ASSERT_EQ(items, dict.item());
+	items = 0;
+	for (unsigned i = 0; i < 16; i++) {
+		items += stats.hit_probe[i];
+	}
+	ASSERT_EQ(items, dict.item());
+	ASSERT_LE(stats.overflow, dict.item());
+	ASSERT_GE(stats.avg_hit_probe, 1.0);
+	ASSERT_GE(stats.max_hit_probe, stats.avg_hit_probe);
+	ASSERT_GE(stats.avg_miss_scan, 1.0);
+	ASSERT_GE(stats.max_miss_scan, stats.avg_miss_scan);
+}
+
+TEST(SSHT, Counters) {
+	const std::string base_filename = "base.ssht";
+	const std::string patch_filename = "patch.ssht";
+	{
+		ssht::FileWriter base_output(base_filename.c_str());
+		auto base_input = CreateReaders<EmbeddingGenerator>(2, EmbeddingGenerator::MASK1);
+		ASSERT_EQ(ssht::BuildDict(base_input, base_output), ssht::BUILD_STATUS_OK);
+		ssht::FileWriter patch_output(patch_filename.c_str());
+		auto patch_input = CreateReaders<EmbeddingGenerator>(1, EmbeddingGenerator::MASK0);
+		ASSERT_EQ(ssht::BuildDict(patch_input, patch_output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable base(base_filename);
+	ASSERT_FALSE(!base);
+	ssht::Hashtable patch(patch_filename);
+	ASSERT_FALSE(!patch);
+
+	std::vector<uint64_t> keys(PIECE*3);
+	for (unsigned i = 0; i < keys.size(); i++) {
+		keys[i] = i;
+	}
+	auto buf = std::make_unique<uint8_t[]>(keys.size()*EmbeddingGenerator::VALUE_SIZE);
+	auto dft_val = std::make_unique<uint8_t[]>(EmbeddingGenerator::VALUE_SIZE);
+	ASSERT_EQ(base.batch_fetch(keys.size(), (const uint8_t*)keys.data(), buf.get(), dft_val.get(), &patch), PIECE*2);
+	ASSERT_NE(base.search((const uint8_t*)&keys[0]).ptr, nullptr);
+
+	auto counters = base.counters();
+#ifdef ENABLE_LOOKUP_COUNTER
+	ASSERT_EQ(counters.lookup, PIECE*3+1);
+	ASSERT_EQ(counters.hit, PIECE*2+1);
+	ASSERT_EQ(counters.patch_hit, PIECE);
+	ASSERT_EQ(counters.default_fill, PIECE);
+	ASSERT_GE(counters.set_probe, PIECE*5+1);
+#else
+	ASSERT_EQ(counters.lookup, 0);
+	ASSERT_EQ(counters.hit, 0);
+	ASSERT_EQ(counters.set_probe, 0);
+#endif
+	ASSERT_EQ(patch.counters().lookup, 0);
+
+	//each thread counts in its own slot, slots of exited threads are kept
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < 4; i++) {
+		workers.emplace_back([&base, &keys]() {
+			for (unsigned j = 0; j < PIECE; j++) {
+				base.search((const uint8_t*)&keys[j]);
+			}
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+#ifdef ENABLE_LOOKUP_COUNTER
+	ASSERT_EQ(base.counters().lookup, PIECE*7+1);
+	ASSERT_EQ(base.counters().hit, PIECE*6+1);
+#else
+	ASSERT_EQ(base.counters().lookup, 0);
+#endif
+}
+
+static std::string ReadFile(const std::string& path) {
+	std::string out;
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (fp == nullptr) {
+		return out;
+	}
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+		out.append(buf, n);
+	}
+	fclose(fp);
+	return out;
+}
+
+static void WriteFile(const std::string& path, const std::string& data) {
+	FILE* fp = fopen(path.c_str(), "wb");
+	ASSERT_NE(fp, nullptr);
+	ASSERT_EQ(fwrite(data.data(), 1, data.size(), fp), data.size());
+	fclose(fp);
+}
+
+//flags byte of header and value offsets of used slots in slot order, read from raw file of KV_SEPARATED:
+//64 bytes header, guide of one byte per slot, then lines of key and 6 bytes offset
+static std::vector<uint64_t> ExtendOffsets(const std::string& data, uint8_t& flags) {
+	const auto key_len = (uint8_t)data[5];
+	uint64_t set_cnt;
+	memcpy(&set_cnt, data.data()+24, sizeof(set_cnt));
+	flags = data[36];
+	const size_t slot = set_cnt << 6U;
+	auto guide = (const uint8_t*)data.data() + 64;
+	auto line = guide + slot;
+	std::vector<uint64_t> out;
+	for (size_t i = 0; i < slot; i++, line += key_len + 6U) {
+		if ((guide[i] & 0x80U) == 0) {
+			uint64_t off = 0;
+			memcpy(&off, line + key_len, 6);
+			out.push_back(off);
+		}
+	}
+	return out;
+}
+
+TEST(SSHT, SlotOrderedExtend) {
+	ssht::BuildOptions options;
+	options.slot_order = true;
+	std::string filename = "ordered-old.ssht";
+	{
+		ssht::FileWriter output(filename.c_str());
+		auto input = CreateReaders<VariedValueGenerator>(2, 2U);
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, output, options), ssht::BUILD_STATUS_OK);
+		ssht::FileWriter plain_output("plain.ssht");
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, plain_output), ssht::BUILD_STATUS_OK);
+	}
+	ASSERT_EQ(ReadFile(filename).size(), ReadFile("plain.ssht").size());
+	uint8_t flags = 0;
+	auto offsets = ExtendOffsets(ReadFile("plain.ssht"), flags);
+	ASSERT_EQ(flags, 0);
+	ASSERT_EQ(offsets.size(), PIECE*2);
+	ASSERT_FALSE(std::is_sorted(offsets.begin(), offsets.end()));
+	offsets = ExtendOffsets(ReadFile(filename), flags);
+	ASSERT_EQ(flags, 1);
+	ASSERT_EQ(offsets.size(), PIECE*2);
+	ASSERT_EQ(offsets.front(), 0);
+	ASSERT_TRUE(std::is_sorted(offsets.begin(), offsets.end()));
+	ASSERT_EQ(std::adjacent_find(offsets.begin(), offsets.end()), offsets.end());
+	{
+		ssht::Hashtable dict(filename);
+		ASSERT_FALSE(!dict);
+		VariedValueGenerator checker(0, PIECE*2, 2U);
+		for (unsigned i = 0; i < PIECE*2; i++) {
+			auto rec = checker.read(false);
+			auto val = dict.search(rec.key.ptr);
+			ASSERT_NE(val.ptr, nullptr);
+			ASSERT_EQ(val.len, rec.val.len);
+			ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+		}
+		filename = "ordered-new.ssht";
+		ssht::FileWriter output(filename.c_str());
+		auto input = CreateReaders<VariedValueGenerator>(1, 32U);
+		ASSERT_EQ(dict.derive(input, output, options), ssht::BUILD_STATUS_OK);
+	}
+
+	offsets = ExtendOffsets(ReadFile(filename), flags);
+	ASSERT_EQ(flags, 1);
+	ASSERT_EQ(offsets.size(), PIECE*2);
+	ASSERT_TRUE(std::is_sorted(offsets.begin(), offsets.end()));
+
+	//verified load then advice of ordered extend
+	ssht::Hashtable dict(filename, ssht::Hashtable::MAP_ONLY, true);
+	ASSERT_FALSE(!dict);
+	VariedValueGenerator checker0(0, PIECE, 32U);
+	VariedValueGenerator checker1(PIECE, PIECE, 2U);
+	for (unsigned i = 0; i < PIECE*2; i++) {
+		auto rec = i < PIECE? checker0.read(false) : checker1.read(false);
+		auto val = dict.search(rec.key.ptr);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(val.len, rec.val.len);
+		ASSERT_EQ(memcmp(val.ptr, rec.val.ptr, rec.val.len), 0);
+	}
+}
+
+TEST(SSHT, Checksum) {
+	const std::string filename = "checksum.ssht";
+	const std::string broken = "checksum-broken.ssht";
+	constexpr unsigned N = 40000;	//more than one chunk
+	{
+		ssht::FileWriter output(filename.c_str());
+		ssht::DataReaders input;
+		input.push_back(std::make_unique<EmbeddingGenerator>(0, N/2));
+		input.push_back(std::make_unique<EmbeddingGenerator>(N/2, N/2));
+		ASSERT_EQ(ssht::BuildDict(input, output), ssht::BUILD_STATUS_OK);
+	}
+	for (auto policy : {ssht::Hashtable::MAP_ONLY, ssht::Hashtable::MAP_FETCH,
+						ssht::Hashtable::MAP_OCCUPY, ssht::Hashtable::COPY_DATA}) {
+		ssht::Hashtable dict(filename, policy, true);
+		ASSERT_FALSE(!dict);
+		ASSERT_EQ(dict.item(), N);
+		uint64_t key = N-1;
+		ASSERT_NE(dict.search((const uint8_t*)&key).ptr, nullptr);
+	}
+
+	auto data = ReadFile(filename);
+	ASSERT_GT(data.size(), 1U<<20U);
+	for (size_t off : {data.size()/2, data.size()-100}) {
+		auto copy = data;
+		copy[off] ^= 1;
+		WriteFile(broken, copy);
+		ASSERT_TRUE(!ssht::Hashtable(broken, ssht::Hashtable::COPY_DATA, true));
+		ASSERT_TRUE(!ssht::Hashtable(broken, ssht::Hashtable::MAP_FETCH, true));
+	}
+	auto copy = data;
+	copy[data.size()/2] ^= 1;
+	WriteFile(broken, copy);
+	ASSERT_FALSE(!ssht::Hashtable(broken, ssht::Hashtable::COPY_DATA));
+
+	//truncated file is refused without verifying
+	WriteFile(broken, data.substr(0, data.size()-100));
+	ASSERT_TRUE(!ssht::Hashtable(broken));
+	ASSERT_TRUE(!ssht::Hashtable(broken, ssht::Hashtable::COPY_DATA, true));
+}
+
+TEST(SSHT, RecordFile) {
+	const std::string fixed_filename = "fixed.rec";
+	const std::string varied_filename = "varied.rec";
+	constexpr unsigned N = 10000;
+	std::string fixed, varied;
+	for (uint64_t i = 0; i < N; i++) {
+		uint32_t val = i * 3;
+		fixed.append((const char*)&i, sizeof(i));
+		fixed.append((const char*)&val, sizeof(val));
+		varied.append((const char*)&i, sizeof(i));
+		varied.push_back(char(i % 100));		//one byte varint
+		varied.append(i % 100, char(i));
+	}
+	WriteFile(fixed_filename, fixed);
+	WriteFile(varied_filename, varied.substr(0, varied.size()-1));
+	ASSERT_TRUE(ssht::SplitRecordFile(fixed_filename.c_str(), 8, 5, 3).empty());
+	ASSERT_TRUE(ssht::SplitRecordFile(varied_filename.c_str(), 8, ssht::VARIED_VALUE_LEN, 3).empty());
+	WriteFile(varied_filename, varied);
+
+	auto input = ssht::SplitRecordFile(fixed_filename.c_str(), 8, 4, 3);
+	ASSERT_EQ(input.size(), 3U);
+	ASSERT_EQ(input[0]->total() + input[1]->total() + input[2]->total(), N);
+	{
+		ssht::FileWriter output("fixed.ssht");
+		ASSERT_EQ(ssht::BuildDict(input, output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable dict("fixed.ssht");
+	ASSERT_FALSE(!dict);
+	ASSERT_EQ(dict.item(), N);
+	for (uint64_t i = 0; i < N; i++) {
+		auto val = dict.search((const uint8_t*)&i);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(*(const uint32_t*)val.ptr, i*3);
+	}
+
+	input = ssht::SplitRecordFile(varied_filename.c_str(), 8, ssht::VARIED_VALUE_LEN, 4);
+	ASSERT_EQ(input.size(), 4U);
+	size_t total = 0;
+	for (auto& reader : input) {
+		total += reader->total();
+	}
+	ASSERT_EQ(total, N);
+
+	//batch is cut at the end of reader
+	std::vector<ssht::Record> recs(N);
+	for (auto& reader : input) {
+		auto part = reader->slice(0, reader->total());
+		ASSERT_NE(part, nullptr);
+		for (auto r : {reader.get(), part.get()}) {
+			const size_t head = std::min<size_t>(3, r->total());
+			ASSERT_EQ(r->read_batch(recs.data(), 3, false), head);
+			ASSERT_EQ(r->read_batch(recs.data(), recs.size(), false), r->total() - head);
+			ASSERT_EQ(r->read_batch(recs.data(), recs.size(), false), 0U);
+			ASSERT_EQ(r->read(false).key.ptr, nullptr);
+			r->reset();
+		}
+	}
+	{
+		ssht::FileWriter output("varied.ssht");
+		ASSERT_EQ(ssht::BuildDictWithVariedValue(input, output), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable varied_dict("varied.ssht");
+	ASSERT_FALSE(!varied_dict);
+	ASSERT_EQ(varied_dict.item(), N);
+	for (uint64_t i = 0; i < N; i++) {
+		auto val = varied_dict.search((const uint8_t*)&i);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(val.len, i % 100);
+	}
+}
+
+TEST(SSHT, SlicedBuild) {
+	const std::string filename = "sliced.rec";
+	constexpr unsigned N = 200000;
+	std::string content;
+	for (uint64_t i = 0; i < N; i++) {
+		uint32_t val = i * 3;
+		content.append((const char*)&i, sizeof(i));
+		content.append((const char*)&val, sizeof(val));
+	}
+	WriteFile(filename, content);
+
+	//one huge reader is split into tasks for a pool
+	auto input = ssht::SplitRecordFile(filename.c_str(), 8, 4, 1);
+	ASSERT_EQ(input.size(), 1U);
+	auto part = input[0]->slice(N-10, N);
+	ASSERT_NE(part, nullptr);
+	ASSERT_EQ(part->total(), 10U);
+	ASSERT_EQ(*(const uint64_t*)part->read(true).key.ptr, N-10);
+	ASSERT_EQ(input[0]->slice(1, N+1), nullptr);
+
+	ssht::BuildOptions options;
+	options.thread = 3;
+	for (auto placement : {ssht::BuildOptions::PLACE_INTERLEAVE, ssht::BuildOptions::PLACE_PARTITION,
+						   ssht::BuildOptions::PLACE_LOCAL}) {
+		options.placement = placement;
+		{
+			ssht::FileWriter output("sliced.ssht");
+			ASSERT_EQ(ssht::BuildDict(input, output, options), ssht::BUILD_STATUS_OK);
+		}
+		ssht::Hashtable dict("sliced.ssht");
+		ASSERT_FALSE(!dict);
+		ASSERT_EQ(dict.item(), N);
+		for (uint64_t i = 0; i < N; i++) {
+			auto val = dict.search((const uint8_t*)&i);
+			ASSERT_NE(val.ptr, nullptr);
+			ASSERT_EQ(*(const uint32_t*)val.ptr, i*3);
+		}
+	}
+	ssht::Hashtable dict("sliced.ssht");
+	ASSERT_FALSE(!dict);
+
+	content.clear();
+	for (uint64_t i = N/2; i < N+N/2; i++) {
+		uint32_t val = i * 5;
+		content.append((const char*)&i, sizeof(i));
+		content.append((const char*)&val, sizeof(val));
+	}
+	WriteFile(filename, content);
+	input = ssht::SplitRecordFile(filename.c_str(), 8, 4, 1);
+	ASSERT_EQ(input.size(), 1U);
+	{
+		ssht::FileWriter output("sliced-patch.ssht");
+		ASSERT_EQ(dict.derive(input, output, options), ssht::BUILD_STATUS_OK);
+	}
+	ssht::Hashtable patched("sliced-patch.ssht");
+	ASSERT_FALSE(!patched);
+	ASSERT_EQ(patched.item(), N+N/2);
+	for (uint64_t i = 0; i < N+N/2; i++) {
+		auto val = patched.search((const uint8_t*)&i);
+		ASSERT_NE(val.ptr, nullptr);
+		ASSERT_EQ(*(const uint32_t*)val.ptr, i < N/2? i*3 : i*5);
+	}
+
+	std::string varied;
+	for (uint64_t i = 0; i < N/10; i++) {
+		varied.append((const char*)&i, sizeof(i));
+		varied.push_back(char(i % 100));
+		varied.append(i % 100, char(i));
+	}
+	WriteFile(filename, varied);
+	input = ssht::SplitRecordFile(filename.c_str(), 8, ssht::VARIED_VALUE_LEN, 1);
+	ASSERT_EQ(input.size(), 1U);
+	ASSERT_EQ(input[0]->slice(1, 4096), nullptr);
+	part = input[0]->slice(4096, N/10);
+	ASSERT_NE(part, nullptr);
+	auto rec = part->read(false);
+	ASSERT_EQ(*(const uint64_t*)rec.key.ptr, 4096U);
+	ASSERT_EQ(rec.val.len, 4096U % 100);
+}
@@ -0,0 +1,152 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//request:  RequestHeader + keys (batch * key_len)
+//response: ResponseHeader + payload (size)
+//  OP_FETCH:  values (batch * val_len), missing ones are zero, only for KV_INLINE
+//  OP_SEARCH: hit bitmap ((batch+7)/8 bytes), bit i is for key i
+//  OP_INFO:   TableInfo, no key needed
+namespace ssht {
+namespace proto {
+
+static constexpr uint32_t REQUEST_MAGIC = 0x51485353;	//SSHQ
+static constexpr uint32_t RESPONSE_MAGIC = 0x52485353;	//SSHR
+static constexpr uint32_t MAX_BATCH = 1U << 20U;
+static constexpr uint64_t MAX_PAYLOAD = 64U << 20U;	//keys or values of one request, STATUS_BAD_REQUEST beyond
+
+enum Op : uint8_t {
+	OP_FETCH = 1,
+	OP_SEARCH = 2,
+	OP_INFO = 3,
+};
+
+enum Status : uint8_t {
+	STATUS_OK = 0,
+	STATUS_BAD_REQUEST = 1,
+	STATUS_NO_TABLE = 2,
+	STATUS_UNSUPPORTED = 3,
+};
+
+struct RequestHeader {
+	uint32_t magic = REQUEST_MAGIC;
+	uint8_t op = 0;
+	uint8_t table = 0;
+	uint16_t _pad = 0;
+	uint32_t batch = 0;
+	uint32_t id = 0;		//echoed in response
+};
+static_assert(sizeof(RequestHeader) == 16);
+
+struct ResponseHeader {
+	uint32_t magic = RESPONSE_MAGIC;
+	uint8_t status = STATUS_OK;
+	uint8_t _pad[3] = {};
+	uint32_t id = 0;
+	uint32_t hit = 0;
+	uint64_t size = 0;
+};
+static_assert(sizeof(ResponseHeader) == 24);
+
+struct TableInfo {
+	uint8_t type = 0;
+	uint8_t key_len = 0;
+	uint16_t val_len = 0;
+	uint32_t _pad = 0;
+	uint64_t item = 0;
+};
+static_assert(sizeof(TableInfo) == 16);
+
+//address is a unix socket path, or host:port for tcp
+static inline int Connect(const std::string& address) {
+	int fd;
+	auto pos = address.rfind(':');
+	if (pos == std::string::npos) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (address.size() >= sizeof(addr.sun_path)) {
+			return -1;
+		}
+		memcpy(addr.sun_path, address.data(), address.size());
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			close(fd);
+			return -1;
+		}
+	} else {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(address.c_str()+pos+1));
+		if (inet_pton(AF_INET, address.substr(0, pos).c_str(), &addr.sin_addr) != 1) {
+			return -1;
+		}
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			close(fd);
+			return -1;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+static inline bool SendAll(int fd, const void* data, size_t n) {
+	auto pt = (const uint8_t*)data;
+	while (n != 0) {
+		auto ret = send(fd, pt, n, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		pt += ret;
+		n -= ret;
+	}
+	return true;
+}
+
+static inline bool RecvAll(int fd, void* data, size_t n) {
+	auto pt = (uint8_t*)data;
+	while (n != 0) {
+		auto ret = recv(fd, pt, n, 0);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR) continue;
+			return false;
+		}
+		pt += ret;
+		n -= ret;
+	}
+	return true;
+}
+
+} //proto
+} //ssht
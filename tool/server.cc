@@ -0,0 +1,688 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <csignal>
+#include <cstdio>
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/sysinfo.h>
+#include <ssht.h>
+#include <gflags/gflags.h>
+#include "protocol.h"
+#include "shm.h"
+
+DEFINE_string(listen, "ssht.sock", "unix socket path, or host:port for tcp, empty to disable");
+DEFINE_string(tables, "", "comma separated table files, table id is the index");
+DEFINE_string(policy, "map_fetch", "map_only, map_fetch, map_occupy, copy_data or tiered");
+DEFINE_uint32(thread, 4, "number of worker threads");
+DEFINE_bool(verify, false, "verify checksums of tables while loading");
+DEFINE_string(shm, "", "shared memory name for co-located clients, empty to disable");
+DEFINE_uint32(shm_channel, 16, "max number of shared memory clients");
+DEFINE_uint32(shm_depth, 2, "requests in flight per shared memory client, power of 2");
+DEFINE_uint32(shm_batch, 4096, "max keys per shared memory request");
+DEFINE_uint32(shm_thread, 1, "number of threads serving shared memory");
+DEFINE_uint32(shm_spin, 100000, "idle polls before sleeping");
+
+using namespace ssht;
+using namespace ssht::proto;
+
+//reload all tables on SIGHUP, requests in flight keep the old ones
+struct Table {
+	std::unique_ptr<Hashtable> dict;
+	std::unique_ptr<uint8_t[]> dft_val;
+	bool fetch_only = false;	//TIERED table serves OP_FETCH only
+};
+using TableSet = std::vector<Table>;
+
+static std::shared_ptr<const TableSet> g_tables;
+static volatile sig_atomic_t g_reload = 0;
+static volatile sig_atomic_t g_stop = 0;
+
+static std::vector<std::string> SplitList(const std::string& str) {
+	std::vector<std::string> out;
+	size_t pos = 0;
+	while (pos <= str.size()) {
+		auto end = str.find(',', pos);
+		if (end == std::string::npos) end = str.size();
+		if (end > pos) out.push_back(str.substr(pos, end-pos));
+		pos = end + 1;
+	}
+	return out;
+}
+
+static std::shared_ptr<const TableSet> LoadTables(Hashtable::LoadPolicy policy) {
+	auto out = std::make_shared<TableSet>();
+	for (auto& path : SplitList(FLAGS_tables)) {
+		Table table;
+		table.dict = std::make_unique<Hashtable>(path, policy, FLAGS_verify);
+		if (!*table.dict) {
+			Logger::Printf("fail to load: %s\n", path.c_str());
+			return nullptr;
+		}
+		table.fetch_only = policy == Hashtable::TIERED;
+		table.dft_val = std::make_unique<uint8_t[]>(table.dict->val_len()+1U);
+		memset(table.dft_val.get(), 0, table.dict->val_len()+1U);
+		out->push_back(std::move(table));
+	}
+	if (out->empty() || out->size() > UINT8_MAX+1U) {
+		Logger::Printf("need 1 to 256 tables\n");
+		return nullptr;
+	}
+	return out;
+}
+
+//fill hit bitmap, return hit count
+static uint32_t SearchBitmap(const Hashtable& dict, uint32_t batch, const uint8_t* keys, uint8_t* bitmap,
+							 std::vector<const uint8_t*>& key_ptrs, std::vector<const uint8_t*>& val_ptrs) {
+	memset(bitmap, 0, (batch+7U)/8U);
+	key_ptrs.resize(batch);
+	val_ptrs.resize(batch);
+	for (unsigned i = 0; i < batch; i++) {
+		key_ptrs[i] = keys + i*(size_t)dict.key_len();
+	}
+	if (dict.type() == Hashtable::KV_SEPARATED) {
+		for (unsigned i = 0; i < batch; i++) {
+			val_ptrs[i] = dict.search(key_ptrs[i]).ptr;
+		}
+	} else {
+		dict.batch_search(batch, key_ptrs.data(), val_ptrs.data());
+	}
+	uint32_t hit = 0;
+	for (unsigned i = 0; i < batch; i++) {
+		if (val_ptrs[i] != nullptr) {
+			bitmap[i>>3U] |= 1U << (i&7U);
+			hit++;
+		}
+	}
+	return hit;
+}
+
+class Connection {
+public:
+	explicit Connection(int fd) : m_fd(fd), m_in(INITIAL_BUFSZ) {}
+	~Connection() { close(m_fd); }
+	int fd() const noexcept { return m_fd; }
+	bool blocked() const noexcept { return m_sent < m_out.size(); }
+
+	//false means connection should be closed
+	bool on_readable(const TableSet& tables) {
+		while (!blocked()) {
+			if (m_in.size() - m_end < MIN_READ) {
+				std::copy(m_in.begin()+m_begin, m_in.begin()+m_end, m_in.begin());
+				m_end -= m_begin;
+				m_begin = 0;
+				if (m_in.size() - m_end < MIN_READ) {
+					m_in.resize(m_in.size()*2);
+				}
+			}
+			auto n = recv(m_fd, m_in.data()+m_end, m_in.size()-m_end, 0);
+			if (n == 0) {
+				return false;
+			} else if (n < 0) {
+				if (errno == EINTR) continue;
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+			m_end += n;
+			if (!drain(tables)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool on_writable(const TableSet& tables) {
+		return flush() && (blocked() || drain(tables));
+	}
+
+private:
+	static constexpr size_t INITIAL_BUFSZ = 64*1024;
+	static constexpr size_t MIN_READ = 16*1024;
+	static constexpr size_t MAX_PENDING_OUT = 4*1024*1024;	//stop taking requests until flushed
+	int m_fd;
+	std::vector<uint8_t> m_in;
+	size_t m_begin = 0;
+	size_t m_end = 0;
+	std::vector<uint8_t> m_out;
+	size_t m_sent = 0;
+	std::vector<const uint8_t*> m_keys;
+	std::vector<const uint8_t*> m_vals;
+	size_t m_skip = 0;	//keys of refused request yet to be dropped
+	bool m_throttled = false;
+
+	//reply all complete requests in buffer, unless socket is full
+	bool drain(const TableSet& tables) {
+		do {
+			if (!process(tables) || !flush()) {
+				return false;
+			}
+		} while (m_throttled && !blocked());
+		return true;
+	}
+
+	bool flush() {
+		while (m_sent < m_out.size()) {
+			auto n = send(m_fd, m_out.data()+m_sent, m_out.size()-m_sent, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+			m_sent += n;
+		}
+		m_out.clear();
+		m_sent = 0;
+		return true;
+	}
+
+	uint8_t* reply(const RequestHeader& req, Status status, size_t size) {
+		auto off = m_out.size();
+		m_out.resize(off + sizeof(ResponseHeader) + size);
+		auto rsp = (ResponseHeader*)(m_out.data() + off);
+		*rsp = ResponseHeader();
+		rsp->status = status;
+		rsp->id = req.id;
+		rsp->size = size;
+		return m_out.data() + off + sizeof(ResponseHeader);
+	}
+
+	//handle complete requests in buffer, keys are used in place and values go to output buffer directly
+	bool process(const TableSet& tables) {
+		m_throttled = false;
+		while (true) {
+			if (m_skip != 0) {
+				auto n = std::min(m_skip, m_end - m_begin);
+				m_begin += n;
+				m_skip -= n;
+				if (m_skip != 0) {
+					break;
+				}
+			}
+			if (m_end - m_begin < sizeof(RequestHeader)) {
+				break;
+			}
+			if (m_out.size() - m_sent >= MAX_PENDING_OUT) {
+				m_throttled = true;
+				break;
+			}
+			RequestHeader req;
+			memcpy(&req, m_in.data()+m_begin, sizeof(req));
+			if (req.magic != REQUEST_MAGIC || req.batch > MAX_BATCH) {
+				return false;
+			}
+			if (req.table >= tables.size()) {
+				if (req.op != OP_INFO && req.batch != 0) {
+					return false;	//key size is unknown
+				}
+				reply(req, STATUS_NO_TABLE, 0);
+				m_begin += sizeof(req);
+				continue;
+			}
+			auto& table = tables[req.table];
+			auto& dict = *table.dict;
+			const size_t key_size = req.op == OP_INFO? 0 : req.batch * (size_t)dict.key_len();
+			const size_t val_size = req.op == OP_FETCH? req.batch * (size_t)dict.val_len() : 0;
+			if (key_size > MAX_PAYLOAD || val_size > MAX_PAYLOAD) {
+				reply(req, STATUS_BAD_REQUEST, 0);
+				m_begin += sizeof(req);
+				m_skip = key_size;
+				continue;
+			}
+			const size_t need = sizeof(req) + key_size;
+			if (m_end - m_begin < need) {
+				if (m_in.size() - m_begin < need) {
+					m_in.resize(m_begin + need);
+				}
+				break;
+			}
+			auto keys = m_in.data() + m_begin + sizeof(req);
+			m_begin += need;
+
+			switch (req.op) {
+				case OP_INFO: {
+					TableInfo info;
+					info.type = dict.type();
+					info.key_len = dict.key_len();
+					info.val_len = dict.val_len();
+					info.item = dict.item();
+					memcpy(reply(req, STATUS_OK, sizeof(info)), &info, sizeof(info));
+					break;
+				}
+				case OP_FETCH: {
+					if (dict.type() != Hashtable::KV_INLINE) {
+						reply(req, STATUS_UNSUPPORTED, 0);
+						break;
+					}
+					auto off = m_out.size();
+					auto data = reply(req, STATUS_OK, val_size);
+					auto hit = dict.batch_fetch(req.batch, keys, data, table.dft_val.get());
+					((ResponseHeader*)(m_out.data()+off))->hit = hit;
+					break;
+				}
+				case OP_SEARCH: {
+					if (table.fetch_only) {
+						reply(req, STATUS_UNSUPPORTED, 0);
+						break;
+					}
+					auto off = m_out.size();
+					auto bitmap = reply(req, STATUS_OK, (req.batch+7U)/8U);
+					auto hit = SearchBitmap(dict, req.batch, keys, bitmap, m_keys, m_vals);
+					((ResponseHeader*)(m_out.data()+off))->hit = hit;
+					break;
+				}
+				default:
+					reply(req, STATUS_BAD_REQUEST, 0);
+					break;
+			}
+		}
+		if (m_begin == m_end) {
+			m_begin = m_end = 0;
+		}
+		return true;
+	}
+};
+
+static void Serve(int listener) {
+	int epfd = epoll_create1(0);
+	if (epfd < 0) {
+		Logger::Printf("fail to create epoll\n");
+		g_stop = 1;
+		return;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = nullptr;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) != 0) {
+		Logger::Printf("fail to watch listener\n");
+		close(epfd);
+		g_stop = 1;
+		return;
+	}
+
+	std::vector<std::unique_ptr<Connection>> conns;
+	auto drop = [&conns, epfd](Connection* conn) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd(), nullptr);
+		for (auto& p : conns) {
+			if (p.get() == conn) {
+				p = std::move(conns.back());
+				conns.pop_back();
+				break;
+			}
+		}
+	};
+	auto watch = [epfd](Connection* conn, int op) {
+		struct epoll_event ev;
+		ev.events = conn->blocked()? EPOLLOUT : EPOLLIN;
+		ev.data.ptr = conn;
+		return epoll_ctl(epfd, op, conn->fd(), &ev) == 0;
+	};
+
+	constexpr int MAX_EVENTS = 64;
+	struct epoll_event events[MAX_EVENTS];
+	while (!g_stop) {
+		int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+		if (n <= 0) continue;
+		auto tables = std::atomic_load(&g_tables);
+		for (int i = 0; i < n; i++) {
+			auto conn = (Connection*)events[i].data.ptr;
+			if (conn == nullptr) {
+				while (true) {
+					int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					if (fd < 0) break;
+					int one = 1;
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+					std::unique_ptr<Connection> conn;
+					try {
+						conn = std::make_unique<Connection>(fd);
+						conns.push_back(std::move(conn));
+					} catch (const std::bad_alloc&) {
+						if (conn == nullptr) {
+							close(fd);
+						}
+						Logger::Printf("fail to allocate memory for connection\n");
+						break;
+					}
+					if (!watch(conns.back().get(), EPOLL_CTL_ADD)) {
+						conns.pop_back();
+					}
+				}
+				continue;
+			}
+			const bool was_blocked = conn->blocked();
+			bool ok = false;
+			//running out of memory costs only this connection
+			try {
+				if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+					ok = false;
+				} else if (was_blocked) {
+					ok = conn->on_writable(*tables) && (conn->blocked() || conn->on_readable(*tables));
+				} else {
+					ok = conn->on_readable(*tables);
+				}
+			} catch (const std::bad_alloc&) {
+				Logger::Printf("fail to allocate memory for request\n");
+			}
+			if (!ok || (was_blocked != conn->blocked() && !watch(conn, EPOLL_CTL_MOD))) {
+				drop(conn);
+			}
+		}
+	}
+	close(epfd);
+}
+
+//slots are sized by the largest tables at startup, bigger tables loaded later are refused,
+//layout keeps a private copy of header as clients can write the shared one
+static ShmHeader* CreateShm(const TableSet& tables, size_t& size, ShmHeader& layout) {
+	if (FLAGS_shm_channel == 0 || FLAGS_shm_depth == 0 || (FLAGS_shm_depth & (FLAGS_shm_depth-1U)) != 0
+		|| FLAGS_shm_batch == 0 || FLAGS_shm_batch > MAX_BATCH) {
+		return nullptr;
+	}
+	size_t key_len = 0, val_len = 0;
+	for (auto& table : tables) {
+		key_len = std::max<size_t>(key_len, table.dict->key_len());
+		val_len = std::max<size_t>(val_len, table.dict->val_len());
+	}
+	ShmHeader header;
+	header.channel_cnt = FLAGS_shm_channel;
+	header.depth = FLAGS_shm_depth;
+	header.max_batch = FLAGS_shm_batch;
+	header.key_space = AlignCacheLine(FLAGS_shm_batch * key_len);
+	header.val_space = AlignCacheLine(std::max<size_t>(FLAGS_shm_batch*val_len, (FLAGS_shm_batch+7U)/8U));
+	header.slot_size = sizeof(ShmSlot) + header.key_space + header.val_space;
+	header.channel_size = AlignCacheLine(sizeof(ShmChannel)) + header.slot_size * header.depth;
+	size = AlignCacheLine(sizeof(ShmHeader)) + header.channel_size * header.channel_cnt;
+
+	shm_unlink(FLAGS_shm.c_str());
+	int fd = shm_open(FLAGS_shm.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+	if (fd < 0) {
+		return nullptr;
+	}
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		shm_unlink(FLAGS_shm.c_str());
+		return nullptr;
+	}
+	auto addr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		shm_unlink(FLAGS_shm.c_str());
+		return nullptr;
+	}
+	auto out = new(addr) ShmHeader(header);
+	for (unsigned i = 0; i < header.channel_cnt; i++) {
+		new(ChannelOf(out, header, i)) ShmChannel();
+	}
+	layout = header;
+	return out;
+}
+
+static void PublishTables(ShmHeader* header, const TableSet& tables) {
+	unsigned cnt = std::min<size_t>(tables.size(), SHM_MAX_TABLES);
+	BeginTableUpdate(header);
+	for (unsigned i = 0; i < cnt; i++) {
+		auto& dict = *tables[i].dict;
+		auto& info = header->tables[i];
+		info.type = dict.type();
+		info.key_len = dict.key_len();
+		info.val_len = dict.val_len();
+		info.item = dict.item();
+	}
+	header->table_cnt = cnt;
+	EndTableUpdate(header);
+}
+
+struct ShmWorker {
+	std::vector<ShmChannel*> channels;
+	std::vector<const uint8_t*> keys;
+	std::vector<const uint8_t*> vals;
+};
+
+//keys are read from the slot and values are written back into it,
+//client may rewrite the slot at any time, so its fields are read once and only checked copies are used
+static void HandleSlot(const ShmHeader& layout, ShmSlot* slot, const TableSet& tables, ShmWorker& worker) {
+	const uint8_t op = __atomic_load_n(&slot->op, __ATOMIC_RELAXED);
+	const uint8_t table_id = __atomic_load_n(&slot->table, __ATOMIC_RELAXED);
+	const uint32_t batch = __atomic_load_n(&slot->batch, __ATOMIC_RELAXED);
+	slot->hit = 0;
+	if (batch > layout.max_batch) {
+		slot->status = STATUS_BAD_REQUEST;
+		return;
+	}
+	if (table_id >= tables.size()) {
+		slot->status = STATUS_NO_TABLE;
+		return;
+	}
+	auto& table = tables[table_id];
+	auto& dict = *table.dict;
+	const size_t key_len = dict.key_len();
+	const size_t val_len = dict.val_len();
+	if (batch * key_len > layout.key_space) {
+		slot->status = STATUS_UNSUPPORTED;
+		return;
+	}
+	slot->status = STATUS_OK;
+	switch (op) {
+		case OP_FETCH:
+			if (dict.type() != Hashtable::KV_INLINE || batch * val_len > layout.val_space) {
+				slot->status = STATUS_UNSUPPORTED;
+				break;
+			}
+			slot->hit = dict.batch_fetch(batch, slot->keys(), slot->vals(layout), table.dft_val.get());
+			break;
+		case OP_SEARCH:
+			if (table.fetch_only) {
+				slot->status = STATUS_UNSUPPORTED;
+				break;
+			}
+			slot->hit = SearchBitmap(dict, batch, slot->keys(), slot->vals(layout), worker.keys, worker.vals);
+			break;
+		default:
+			slot->status = STATUS_BAD_REQUEST;
+			break;
+	}
+}
+
+static bool Pending(const std::vector<ShmChannel*>& channels) {
+	for (auto channel : channels) {
+		if (__atomic_load_n(&channel->head, __ATOMIC_SEQ_CST) != channel->done) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//poll owned channels, sleep on doorbell after a period of idle
+static void ServeShm(ShmHeader* header, const ShmHeader& layout, unsigned id) {
+	ShmWorker worker;
+	for (unsigned i = id; i < layout.channel_cnt; i += FLAGS_shm_thread) {
+		worker.channels.push_back(ChannelOf(header, layout, i));
+	}
+	unsigned idle = 0;
+	while (!g_stop) {
+		if (!Pending(worker.channels)) {
+			if (++idle < FLAGS_shm_spin) {
+				CpuRelax();
+				continue;
+			}
+			idle = 0;
+			__atomic_fetch_add(&header->sleeping, 1U, __ATOMIC_SEQ_CST);
+			auto bell = __atomic_load_n(&header->doorbell, __ATOMIC_SEQ_CST);
+			if (!Pending(worker.channels)) {
+				FutexWait(&header->doorbell, bell, 100);
+			}
+			__atomic_fetch_sub(&header->sleeping, 1U, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		idle = 0;
+		auto tables = std::atomic_load(&g_tables);
+		for (auto channel : worker.channels) {
+			auto head = __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE);
+			auto done = channel->done;
+			while (done != head) {
+				HandleSlot(layout, SlotOf(layout, channel, done), *tables, worker);
+				__atomic_store_n(&channel->done, ++done, __ATOMIC_SEQ_CST);
+				if (__atomic_load_n(&channel->waiting, __ATOMIC_SEQ_CST) != 0) {
+					FutexWake(&channel->done);
+				}
+			}
+		}
+	}
+}
+
+static int Listen(const std::string& address) {
+	int fd;
+	auto pos = address.rfind(':');
+	if (pos == std::string::npos) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (address.size() >= sizeof(addr.sun_path)) {
+			return -1;
+		}
+		memcpy(addr.sun_path, address.data(), address.size());
+		unlink(address.c_str());
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+	} else {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(address.c_str()+pos+1));
+		if (inet_pton(AF_INET, address.substr(0, pos).c_str(), &addr.sin_addr) != 1) {
+			return -1;
+		}
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		int one = 1;
+		if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+			|| bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+	}
+	if (listen(fd, 1024) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char* argv[]) {
+	google::ParseCommandLineFlags(&argc, &argv, true);
+
+	Hashtable::LoadPolicy policy;
+	if (FLAGS_policy == "map_only") {
+		policy = Hashtable::MAP_ONLY;
+	} else if (FLAGS_policy == "map_fetch") {
+		policy = Hashtable::MAP_FETCH;
+	} else if (FLAGS_policy == "map_occupy") {
+		policy = Hashtable::MAP_OCCUPY;
+	} else if (FLAGS_policy == "copy_data") {
+		policy = Hashtable::COPY_DATA;
+	} else if (FLAGS_policy == "tiered") {
+		policy = Hashtable::TIERED;
+	} else {
+		Logger::Printf("unknown policy: %s\n", FLAGS_policy.c_str());
+		return 1;
+	}
+	auto cpus = get_nprocs();
+	if (cpus <= 0) cpus = 1;
+	if (FLAGS_thread == 0 || FLAGS_thread > (unsigned)cpus) {
+		FLAGS_thread = cpus;
+	}
+
+	g_tables = LoadTables(policy);
+	if (g_tables == nullptr) {
+		return 1;
+	}
+	if (FLAGS_listen.empty() && FLAGS_shm.empty()) {
+		Logger::Printf("no transport is enabled\n");
+		return 1;
+	}
+	int listener = -1;
+	if (!FLAGS_listen.empty()) {
+		listener = Listen(FLAGS_listen);
+		if (listener < 0) {
+			Logger::Printf("fail to listen on: %s\n", FLAGS_listen.c_str());
+			return 1;
+		}
+	}
+	ShmHeader* shm = nullptr;
+	ShmHeader shm_layout;
+	size_t shm_size = 0;
+	if (!FLAGS_shm.empty()) {
+		shm = CreateShm(*g_tables, shm_size, shm_layout);
+		if (shm == nullptr) {
+			Logger::Printf("fail to create shared memory: %s\n", FLAGS_shm.c_str());
+			return 1;
+		}
+		PublishTables(shm, *g_tables);
+		if (FLAGS_shm_thread == 0 || FLAGS_shm_thread > shm_layout.channel_cnt) {
+			FLAGS_shm_thread = 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGHUP, [](int) { g_reload = 1; });
+	signal(SIGINT, [](int) { g_stop = 1; });
+	signal(SIGTERM, [](int) { g_stop = 1; });
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; listener >= 0 && i < FLAGS_thread; i++) {
+		workers.emplace_back(Serve, listener);
+	}
+	for (unsigned i = 0; shm != nullptr && i < FLAGS_shm_thread; i++) {
+		workers.emplace_back(ServeShm, shm, std::cref(shm_layout), i);
+	}
+	while (!g_stop) {
+		usleep(100*1000);
+		if (g_reload) {
+			g_reload = 0;
+			auto tables = LoadTables(policy);
+			if (tables != nullptr) {
+				std::atomic_store(&g_tables, tables);
+				if (shm != nullptr) {
+					PublishTables(shm, *tables);
+				}
+				Logger::Printf("tables reloaded\n");
+			}
+		}
+	}
+	for (auto& t : workers) {
+		t.join();
+	}
+	if (listener >= 0) {
+		close(listener);
+		if (FLAGS_listen.find(':') == std::string::npos) {
+			unlink(FLAGS_listen.c_str());
+		}
+	}
+	if (shm != nullptr) {
+		munmap(shm, shm_size);
+		shm_unlink(FLAGS_shm.c_str());
+	}
+	return 0;
+}
@@ -0,0 +1,250 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "protocol.h"
+
+//Shared memory is created by server and split into channels. Each channel is owned by one client
+//and holds a ring of request slots. Client writes keys into slot and bumps head, server writes
+//values (or hit bitmap) into the same slot and bumps done. Both sides busy-poll for a while
+//before sleeping on futex.
+namespace ssht {
+namespace proto {
+
+static constexpr uint32_t SHM_MAGIC = 0x4d485353;	//SSHM
+static constexpr unsigned SHM_MAX_TABLES = 64;
+
+struct alignas(64) ShmHeader {
+	uint32_t magic = SHM_MAGIC;
+	uint32_t channel_cnt = 0;
+	uint32_t depth = 0;			//slots per channel, power of 2
+	uint32_t max_batch = 0;
+	uint32_t key_space = 0;		//bytes for keys in slot
+	uint32_t val_space = 0;		//bytes for values in slot
+	uint64_t slot_size = 0;
+	uint64_t channel_size = 0;
+	uint32_t generation = 0;	//odd while tables are being rewritten
+	uint32_t table_cnt = 0;
+	TableInfo tables[SHM_MAX_TABLES];
+	alignas(64) uint32_t doorbell = 0;
+	uint32_t sleeping = 0;		//number of sleeping server threads
+};
+
+struct alignas(64) ShmChannel {
+	int32_t owner = 0;			//pid of client
+	alignas(64) uint32_t head = 0;
+	uint32_t waiting = 0;		//client is sleeping
+	alignas(64) uint32_t done = 0;
+};
+
+struct alignas(64) ShmSlot {
+	uint8_t op = 0;
+	uint8_t table = 0;
+	uint8_t status = 0;
+	uint32_t batch = 0;
+	uint32_t hit = 0;
+	//keys and values follow
+	uint8_t* keys() noexcept { return (uint8_t*)(this+1); }
+	uint8_t* vals(const ShmHeader& header) noexcept { return keys() + header.key_space; }
+};
+
+static inline size_t AlignCacheLine(size_t n) {
+	return (n + 63U) & ~(size_t)63U;
+}
+
+//layout is a private copy of header when the other side can not be trusted
+static inline ShmChannel* ChannelOf(ShmHeader* header, const ShmHeader& layout, unsigned idx) {
+	return (ShmChannel*)((uint8_t*)header + AlignCacheLine(sizeof(ShmHeader)) + layout.channel_size*idx);
+}
+
+static inline ShmSlot* SlotOf(const ShmHeader& layout, ShmChannel* channel, uint32_t seq) {
+	return (ShmSlot*)((uint8_t*)channel + AlignCacheLine(sizeof(ShmChannel)) + layout.slot_size*(seq&(layout.depth-1U)));
+}
+
+static inline long FutexWait(uint32_t* addr, uint32_t val, long timeout_ms) {
+	struct timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, nullptr, 0);
+}
+
+static inline long FutexWake(uint32_t* addr) {
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static inline void CpuRelax() {
+#if defined(__amd64__) || defined(__i386__)
+	__asm__ volatile ("pause");
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ volatile ("yield");
+#endif
+}
+
+//writer of table infos, readers retry while generation is odd or changed
+static inline void BeginTableUpdate(ShmHeader* header) {
+	__atomic_store_n(&header->generation, header->generation+1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void EndTableUpdate(ShmHeader* header) {
+	__atomic_store_n(&header->generation, header->generation+1U, __ATOMIC_RELEASE);
+}
+
+//copy info of table, false if there is no such table
+static inline bool ReadTableInfo(const ShmHeader& header, unsigned idx, TableInfo& out) {
+	while (true) {
+		auto gen = __atomic_load_n(&header.generation, __ATOMIC_ACQUIRE);
+		if (gen & 1U) {
+			CpuRelax();
+			continue;
+		}
+		auto cnt = __atomic_load_n(&header.table_cnt, __ATOMIC_RELAXED);
+		if (idx < cnt && idx < SHM_MAX_TABLES) {
+			memcpy(&out, (const void*)&header.tables[idx], sizeof(out));
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&header.generation, __ATOMIC_RELAXED) == gen) {
+			return idx < cnt && idx < SHM_MAX_TABLES;
+		}
+	}
+}
+
+class ShmClient {
+public:
+	explicit ShmClient(const std::string& name, unsigned spin=100000) : m_spin(spin) {
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0) {
+			return;
+		}
+		struct stat stat;
+		if (fstat(fd, &stat) != 0 || (size_t)stat.st_size < sizeof(ShmHeader)) {
+			close(fd);
+			return;
+		}
+		auto addr = mmap(nullptr, stat.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED) {
+			return;
+		}
+		m_header = (ShmHeader*)addr;
+		m_size = stat.st_size;
+		if (m_header->magic != SHM_MAGIC || m_header->depth == 0 || (m_header->depth & (m_header->depth-1U)) != 0) {
+			return;
+		}
+		//claim a free channel, or one whose owner is dead
+		const int32_t pid = getpid();
+		for (unsigned i = 0; i < m_header->channel_cnt && m_channel == nullptr; i++) {
+			auto channel = ChannelOf(m_header, *m_header, i);
+			auto owner = __atomic_load_n(&channel->owner, __ATOMIC_ACQUIRE);
+			if ((owner == 0 || (kill(owner, 0) != 0 && errno == ESRCH))
+				&& __atomic_compare_exchange_n(&channel->owner, &owner, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				m_channel = channel;
+			}
+		}
+		if (m_channel == nullptr) {
+			return;
+		}
+		//wait for requests left by former owner
+		m_head = __atomic_load_n(&m_channel->head, __ATOMIC_ACQUIRE);
+		while (__atomic_load_n(&m_channel->done, __ATOMIC_ACQUIRE) != m_head) {
+			wait_for(m_head-1);
+		}
+	}
+	~ShmClient() {
+		if (m_channel != nullptr) {
+			__atomic_store_n(&m_channel->owner, 0, __ATOMIC_RELEASE);
+		}
+		if (m_header != nullptr) {
+			munmap(m_header, m_size);
+		}
+	}
+	ShmClient(const ShmClient&) = delete;
+	ShmClient& operator=(const ShmClient&) = delete;
+
+	bool operator!() const noexcept { return m_channel == nullptr; }
+	const ShmHeader& header() const noexcept { return *m_header; }
+
+	//slot for next request, no more than depth requests should be in flight
+	ShmSlot* next() noexcept {
+		return SlotOf(*m_header, m_channel, m_head);
+	}
+	//submit the slot returned by next(), return sequence to wait
+	uint32_t submit(Op op, uint8_t table, uint32_t batch) noexcept {
+		auto slot = next();
+		slot->op = op;
+		slot->table = table;
+		slot->batch = batch;
+		auto seq = m_head++;
+		__atomic_store_n(&m_channel->head, m_head, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&m_header->sleeping, __ATOMIC_SEQ_CST) != 0) {
+			__atomic_fetch_add(&m_header->doorbell, 1U, __ATOMIC_SEQ_CST);
+			FutexWake(&m_header->doorbell);
+		}
+		return seq;
+	}
+	//result is in the slot
+	ShmSlot* wait(uint32_t seq) noexcept {
+		for (unsigned i = 0; !finished(seq); i++) {
+			if (i < m_spin) {
+				CpuRelax();
+			} else {
+				wait_for(seq);
+			}
+		}
+		return SlotOf(*m_header, m_channel, seq);
+	}
+	//submit and wait, keys should be written into next()->keys() before
+	ShmSlot* call(Op op, uint8_t table, uint32_t batch) noexcept {
+		return wait(submit(op, table, batch));
+	}
+
+private:
+	ShmHeader* m_header = nullptr;
+	size_t m_size = 0;
+	ShmChannel* m_channel = nullptr;
+	uint32_t m_head = 0;
+	const unsigned m_spin;
+
+	bool finished(uint32_t seq) const noexcept {
+		return (int32_t)(__atomic_load_n(&m_channel->done, __ATOMIC_ACQUIRE) - seq) > 0;
+	}
+	void wait_for(uint32_t seq) noexcept {
+		__atomic_store_n(&m_channel->waiting, 1U, __ATOMIC_SEQ_CST);
+		auto done = __atomic_load_n(&m_channel->done, __ATOMIC_SEQ_CST);
+		if ((int32_t)(done - seq) <= 0) {
+			FutexWait(&m_channel->done, done, 100);
+		}
+		__atomic_store_n(&m_channel->waiting, 0U, __ATOMIC_RELAXED);
+	}
+};
+
+} //proto
+} //ssht
@@ -0,0 +1,80 @@
+//==============================================================================
+// A static set-associative hashtable.
+// Copyright (C) 2020  Ruan Kunliang
+//
+// This library is free software; you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation; either version 2.1 of the License, or (at your option)
+// any later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the This Library; if not, see <https://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <cstdio>
+#include <ssht.h>
+
+static const char* TypeName(ssht::Hashtable::Type type) {
+	switch (type) {
+		case ssht::Hashtable::KEY_SET: return "key set";
+		case ssht::Hashtable::KV_INLINE: return "inlined dict";
+		case ssht::Hashtable::KV_SEPARATED: return "varied dict";
+		default: return "illegal";
+	}
+}
+
+//0 for empty whole, such as a table without items
+static double Ratio(uint64_t part, uint64_t whole) {
+	return whole == 0? 0.0 : part / (double)whole;
+}
+
+static int Print(const char* path) {
+	ssht::Hashtable table(path);
+	if (!table) {
+		printf("fail to load: %s\n", path);
+		return 1;
+	}
+	auto stats = table.stats();
+	const auto set_cnt = stats.guide_size / 64U;
+	printf("%s\n", path);
+	printf("type: %s, key: %u, value: %u, item: %lu, set: %lu\n", TypeName(table.type()),
+		   table.key_len(), table.val_len(), table.item(), set_cnt);
+	printf("load factor: %.4f, overflow: %lu (%.4f%%)\n",
+		   Ratio(table.item(), stats.guide_size), stats.overflow, Ratio(stats.overflow, table.item()) * 100.0);
+	printf("memory: guide %lu, content %lu, extend %lu\n",
+		   stats.guide_size, stats.content_size, stats.extend_size);
+	printf("hit probe: avg %.3f, max %lu, false tag %.5f\n",
+		   stats.avg_hit_probe, stats.max_hit_probe, stats.hit_false_tag);
+	printf("miss scan: avg %.3f, max %lu, false tag %.5f\n",
+		   stats.avg_miss_scan, stats.max_miss_scan, stats.miss_false_tag);
+	printf("occupancy:\n");
+	for (unsigned i = 0; i <= 64; i++) {
+		if (stats.occupancy[i] != 0) {
+			printf("  %2u: %lu (%.4f%%)\n", i, stats.occupancy[i], Ratio(stats.occupancy[i], set_cnt) * 100.0);
+		}
+	}
+	printf("hit probe:\n");
+	for (unsigned i = 0; i < 16; i++) {
+		if (stats.hit_probe[i] != 0) {
+			printf("  %5lu-%-5lu: %lu\n", 1UL<<i, (2UL<<i)-1, stats.hit_probe[i]);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("usage: %s file...\n", argv[0]);
+		return 1;
+	}
+	int ret = 0;
+	for (int i = 1; i < argc; i++) {
+		ret |= Print(argv[i]);
+	}
+	return ret;
+}